@@ -1,254 +1,7771 @@
-// file_explorer.cpp
-// Console-Based File Explorer Application using C++ (C++17)
-// Works on Windows, macOS, and Linux using <filesystem>
-// Author: Rama Raman Sarangi
-// Date: November 2025
-
-#include <iostream>
-#include <iomanip>
-#include <string>
-#include <vector>
-#include <chrono>
-#include <filesystem>
-#include <fstream>
-#ifdef _WIN32
-#include <windows.h>
-#endif
-
-namespace fs = std::filesystem;
-
-std::string perms_to_string(fs::perms p) {
-    auto check = [&](fs::perms bit, char c){ return ((p & bit) != fs::perms::none) ? c : '-'; };
-    std::string s;
-    s += check(fs::perms::owner_read, 'r');
-    s += check(fs::perms::owner_write, 'w');
-    s += check(fs::perms::owner_exec, 'x');
-    s += check(fs::perms::group_read, 'r');
-    s += check(fs::perms::group_write, 'w');
-    s += check(fs::perms::group_exec, 'x');
-    s += check(fs::perms::others_read, 'r');
-    s += check(fs::perms::others_write, 'w');
-    s += check(fs::perms::others_exec, 'x');
-    return s;
-}
-
-std::string time_to_string(fs::file_time_type ftime) {
-    using namespace std::chrono;
-    auto sctp = time_point_cast<system_clock::duration>(ftime - fs::file_time_type::clock::now()
-                                                        + system_clock::now());
-    std::time_t tt = system_clock::to_time_t(sctp);
-    char buf[64];
-#ifdef _WIN32
-    ctime_s(buf, sizeof(buf), &tt);
-#else
-    ctime_r(&tt, buf);
-#endif
-    std::string res(buf);
-    if (!res.empty() && res.back() == '\n') res.pop_back();
-    return res;
-}
-
-void list_dir(const fs::path& cur) {
-    std::cout << "\nCurrent Directory: " << cur.string() << "\n";
-    std::cout << "------------------------------------------------------------\n";
-    std::cout << std::left << std::setw(8) << "TYPE"
-              << std::setw(12) << "PERMS"
-              << std::setw(12) << "SIZE(B)"
-              << std::setw(24) << "MODIFIED"
-              << "NAME\n";
-    std::cout << "------------------------------------------------------------\n";
-    try {
-        for (const auto& entry : fs::directory_iterator(cur)) {
-            const auto path = entry.path();
-            auto type = entry.is_directory() ? "[DIR]" : (entry.is_symlink() ? "[LNK]" : "[FILE]");
-            std::string perm = "----------";
-            std::uintmax_t size = 0;
-            std::string mod = "";
-            try {
-                auto st = fs::status(path);
-                perm = perms_to_string(st.permissions());
-            } catch(...) {}
-            if (entry.is_regular_file()) {
-                try { size = entry.file_size(); } catch(...) {}
-            }
-            try { mod = time_to_string(fs::last_write_time(path)); } catch(...) {}
-            std::cout << std::left << std::setw(8) << type
-                      << std::setw(12) << perm
-                      << std::setw(12) << size
-                      << std::setw(24) << mod
-                      << path.filename().string() << "\n";
-        }
-    } catch (const std::exception& e) {
-        std::cerr << "Error listing directory: " << e.what() << "\n";
-    }
-}
-
-bool input_path(const std::string& prompt, fs::path& out) {
-    std::cout << prompt;
-    std::string s;
-    std::getline(std::cin, s);
-    if (s.empty()) return false;
-    out = fs::path(s);
-    return true;
-}
-
-void create_file(const fs::path& p) {
-    try {
-        if (fs::exists(p)) { std::cout << "Path already exists.\n"; return; }
-        std::ofstream ofs(p.string());
-        if (!ofs) { std::cout << "Failed to create file.\n"; return; }
-        ofs << ""; ofs.close();
-        std::cout << "File created: " << p << "\n";
-    } catch (const std::exception& e) {
-        std::cerr << "Error: " << e.what() << "\n";
-    }
-}
-
-void create_directory_path(const fs::path& p) {
-    try {
-        if (fs::exists(p)) { std::cout << "Path already exists.\n"; return; }
-        fs::create_directories(p);
-        std::cout << "Directory created: " << p << "\n";
-    } catch (const std::exception& e) {
-        std::cerr << "Error: " << e.what() << "\n";
-    }
-}
-
-void delete_path(const fs::path& p) {
-    try {
-        if (!fs::exists(p)) { std::cout << "Path does not exist.\n"; return; }
-        std::uintmax_t count = fs::is_directory(p) ? fs::remove_all(p) : (fs::remove(p) ? 1 : 0);
-        std::cout << "Deleted entries: " << count << "\n";
-    } catch (const std::exception& e) {
-        std::cerr << "Error: " << e.what() << "\n";
-    }
-}
-
-void copy_path(const fs::path& from, const fs::path& to) {
-    try {
-        if (!fs::exists(from)) { std::cout << "Source does not exist.\n"; return; }
-        if (fs::is_directory(from)) {
-            fs::copy(from, to, fs::copy_options::recursive | fs::copy_options::overwrite_existing);
-        } else {
-            fs::copy_file(from, to, fs::copy_options::overwrite_existing);
-        }
-        std::cout << "Copied to: " << to << "\n";
-    } catch (const std::exception& e) {
-        std::cerr << "Error: " << e.what() << "\n";
-    }
-}
-
-void move_path(const fs::path& from, const fs::path& to) {
-    try {
-        fs::rename(from, to);
-        std::cout << "Moved/Renamed to: " << to << "\n";
-    } catch (const std::exception& e) {
-        std::cerr << "Error: " << e.what() << "\n";
-    }
-}
-
-void search_recursive(const fs::path& root, const std::string& needle) {
-    try {
-        for (auto it = fs::recursive_directory_iterator(root, fs::directory_options::skip_permission_denied);
-             it != fs::recursive_directory_iterator(); ++it) {
-            const auto& p = it->path();
-            if (p.filename().string().find(needle) != std::string::npos) {
-                std::cout << p.string() << "\n";
-            }
-        }
-    } catch (const std::exception& e) {
-        std::cerr << "Error searching: " << e.what() << "\n";
-    }
-}
-
-void print_menu() {
-    std::cout << "\nCommands:\n"
-              << "1. List current directory\n"
-              << "2. Enter directory\n"
-              << "3. Go up (..)\n"
-              << "4. Create file\n"
-              << "5. Create directory\n"
-              << "6. Delete file/directory\n"
-              << "7. Copy file/directory\n"
-              << "8. Move/Rename file/directory\n"
-              << "9. Search by name (recursive)\n"
-              << "0. Exit\n"
-              << "Choose: ";
-}
-
-int main() {
-#ifdef _WIN32
-    // Enable colored console output on Windows
-    HANDLE hOut = GetStdHandle(STD_OUTPUT_HANDLE);
-    if (hOut != INVALID_HANDLE_VALUE) {
-        DWORD dwMode = 0;
-        if (GetConsoleMode(hOut, &dwMode)) {
-            dwMode |= 0x0004; // ENABLE_VIRTUAL_TERMINAL_PROCESSING
-            SetConsoleMode(hOut, dwMode);
-        }
-    }
-#endif
-
-    fs::path cur = fs::current_path();
-    std::string choice;
-    while (true) {
-        list_dir(cur);
-        print_menu();
-        if (!std::getline(std::cin, choice)) break;
-        if (choice == "1") {
-            continue; // already listed
-        } else if (choice == "2") {
-            fs::path dir;
-            if (input_path("Enter directory name: ", dir)) {
-                fs::path cand = dir.is_absolute() ? dir : (cur / dir);
-                if (fs::exists(cand) && fs::is_directory(cand)) cur = fs::canonical(cand);
-                else std::cout << "Not a directory.\n";
-            }
-        } else if (choice == "3") {
-            if (cur.has_parent_path()) cur = cur.parent_path();
-        } else if (choice == "4") {
-            fs::path p;
-            if (input_path("Enter file path to create: ", p)) {
-                p = p.is_absolute() ? p : (cur / p);
-                create_file(p);
-            }
-        } else if (choice == "5") {
-            fs::path p;
-            if (input_path("Enter directory path to create: ", p)) {
-                p = p.is_absolute() ? p : (cur / p);
-                create_directory_path(p);
-            }
-        } else if (choice == "6") {
-            fs::path p;
-            if (input_path("Enter file/directory to delete: ", p)) {
-                p = p.is_absolute() ? p : (cur / p);
-                delete_path(p);
-            }
-        } else if (choice == "7") {
-            fs::path src, dst;
-            if (input_path("Enter source path: ", src) && input_path("Enter destination path: ", dst)) {
-                src = src.is_absolute() ? src : (cur / src);
-                dst = dst.is_absolute() ? dst : (cur / dst);
-                copy_path(src, dst);
-            }
-        } else if (choice == "8") {
-            fs::path src, dst;
-            if (input_path("Enter source path: ", src) && input_path("Enter destination path: ", dst)) {
-                src = src.is_absolute() ? src : (cur / src);
-                dst = dst.is_absolute() ? dst : (cur / dst);
-                move_path(src, dst);
-            }
-        } else if (choice == "9") {
-            std::cout << "Enter name to search: ";
-            std::string needle;
-            std::getline(std::cin, needle);
-            if (!needle.empty()) search_recursive(cur, needle);
-        } else if (choice == "0") {
-            std::cout << "Goodbye!\n";
-            break;
-        } else {
-            std::cout << "Invalid choice.\n";
-        }
-    }
-    return 0;
-}
+// file_explorer.cpp
+// Console-Based File Explorer Application using C++ (C++17)
+// Works on Windows, macOS, and Linux using <filesystem>
+// Author: Rama Raman Sarangi
+// Date: November 2025
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <cstring>
+#include <cstdio>
+#include <vector>
+#include <array>
+#include <memory>
+#include <utility>
+#include <cctype>
+#include <cstdint>
+#include <climits>
+#include <cerrno>
+#include <map>
+#include <tuple>
+#include <set>
+#include <unordered_map>
+#include <random>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <deque>
+#include <queue>
+#include <functional>
+#include <cstdlib>
+#include <chrono>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <pwd.h>
+#include <grp.h>
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/statvfs.h>
+#endif
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/sysmacros.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+#include <sys/syscall.h>
+#include <sys/xattr.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#endif
+
+namespace fs = std::filesystem;
+
+std::string perms_to_string(fs::perms p) {
+    auto check = [&](fs::perms bit, char c){ return ((p & bit) != fs::perms::none) ? c : '-'; };
+    std::string s;
+    s += check(fs::perms::owner_read, 'r');
+    s += check(fs::perms::owner_write, 'w');
+    s += check(fs::perms::owner_exec, 'x');
+    s += check(fs::perms::group_read, 'r');
+    s += check(fs::perms::group_write, 'w');
+    s += check(fs::perms::group_exec, 'x');
+    s += check(fs::perms::others_read, 'r');
+    s += check(fs::perms::others_write, 'w');
+    s += check(fs::perms::others_exec, 'x');
+    return s;
+}
+
+std::string unix_time_to_string(std::time_t tt) {
+    char buf[64];
+#ifdef _WIN32
+    ctime_s(buf, sizeof(buf), &tt);
+#else
+    ctime_r(&tt, buf);
+#endif
+    std::string res(buf);
+    if (!res.empty() && res.back() == '\n') res.pop_back();
+    return res;
+}
+
+std::time_t file_time_to_time_t(fs::file_time_type ftime) {
+    using namespace std::chrono;
+    auto sctp = time_point_cast<system_clock::duration>(ftime - fs::file_time_type::clock::now()
+                                                        + system_clock::now());
+    return system_clock::to_time_t(sctp);
+}
+
+std::string time_to_string(fs::file_time_type ftime) {
+    return unix_time_to_string(file_time_to_time_t(ftime));
+}
+
+// ---------------- Error reports ----------------
+// Filesystem operations use the std::error_code overloads or raw syscalls + errno; nothing
+// on a per-entry path throws. Failures are collected per operation, grouped by errno with
+// a few sample paths, and printed once at the end.
+
+class ErrorReport {
+public:
+    static constexpr std::size_t kSamples = 3;
+
+    void add(const fs::path& p, const std::error_code& ec) {
+        std::lock_guard<std::mutex> lk(mu_);
+        auto& b = by_code_[ec.value()];
+        if (b.count++ == 0) b.message = ec.message();
+        if (b.samples.size() < kSamples) b.samples.push_back(p.string());
+        ++total_;
+    }
+
+    std::size_t total() const {
+        std::lock_guard<std::mutex> lk(mu_);
+        return total_;
+    }
+
+    void print(std::ostream& out, const char* op) const {
+        std::lock_guard<std::mutex> lk(mu_);
+        if (total_ == 0) return;
+        out << op << ": " << total_ << " error(s)\n";
+        for (const auto& kv : by_code_) {
+            out << "  [errno " << kv.first << "] " << kv.second.message << ": " << kv.second.count;
+            const char* sep = "  e.g. ";
+            for (const auto& s : kv.second.samples) { out << sep << s; sep = ", "; }
+            out << "\n";
+        }
+    }
+
+private:
+    struct Bucket {
+        std::size_t count = 0;
+        std::string message;
+        std::vector<std::string> samples;
+    };
+    mutable std::mutex mu_;
+    std::map<int, Bucket> by_code_;
+    std::size_t total_ = 0;
+};
+
+// ---------------- Virtual filesystem ----------------
+// Every operation goes through a Vfs. PosixVfs talks to the real filesystem; MemVfs keeps a
+// whole tree in memory for fast, deterministic runs; FaultyVfs wraps either one with fixed
+// per-call latency and random error injection (e.g. to simulate a slow, flaky NFS mount).
+// Select with --vfs=posix|mem[,latency=USEC][,errors=RATE][,errno=N][,mirror=DIR].
+
+enum TypeBit : unsigned { kTypeFile = 1, kTypeDir = 2, kTypeLink = 4, kTypeOther = 8 };
+
+struct RawDirent {
+    std::string name;
+    std::uint64_t ino = 0;
+    unsigned type = 0; // TypeBit, 0 when the filesystem does not report it
+};
+
+enum VfsWant : unsigned { kWantMode = 1, kWantSize = 2, kWantMtime = 4, kWantOwner = 8 };
+
+struct VfsStat {
+    unsigned type = kTypeOther;
+    unsigned mode = 0; // permission bits
+    std::uint64_t size = 0;
+    std::uint64_t ino = 0;
+    std::int64_t mtime_ns = 0;
+    unsigned uid = 0, gid = 0;
+};
+
+// An open file for positional reads.
+class VfsFile {
+public:
+    virtual ~VfsFile() = default;
+    virtual std::uint64_t size() const = 0;
+    // Bytes read into `buf`; 0 at end of file, -1 with `ec` set on error.
+    virtual long long read_at(void* buf, std::size_t len, std::uint64_t off, std::error_code& ec) = 0;
+};
+
+// New contents for an existing file, written aside and swapped in atomically on commit.
+// Destroying it uncommitted discards the new contents.
+class VfsReplaceFile {
+public:
+    virtual ~VfsReplaceFile() = default;
+    virtual bool write(const void* buf, std::size_t len, std::error_code& ec) = 0;
+    // With `durable`, the new contents reach stable storage before the swap.
+    virtual bool commit(bool durable, std::error_code& ec) = 0;
+};
+
+class Vfs {
+public:
+    virtual ~Vfs() = default;
+    // Whether paths are real files, so device-level tricks (FIEMAP, mincore, sysfs) apply.
+    virtual bool real() const { return false; }
+    virtual bool read_dir(const fs::path& dir, std::vector<RawDirent>& out, std::error_code& ec) = 0;
+    // `want` is a VfsWant mask of fields the caller needs; type and ino are always filled.
+    virtual bool stat(const fs::path& p, bool follow, unsigned want, VfsStat& st, std::error_code& ec) = 0;
+    virtual bool create_file(const fs::path& p, std::error_code& ec) = 0; // fails with EEXIST
+    virtual bool make_dirs(const fs::path& p, std::error_code& ec) = 0;
+    virtual bool remove(const fs::path& p, std::error_code& ec) = 0; // file, link or empty directory
+    virtual bool rename(const fs::path& from, const fs::path& to, std::error_code& ec) = 0;
+    virtual bool copy_file(const fs::path& from, const fs::path& to, std::error_code& ec) = 0; // overwrites
+    virtual fs::path canonical(const fs::path& p, std::error_code& ec) = 0;
+    virtual std::unique_ptr<VfsFile> open_read(const fs::path& p, std::error_code& ec) = 0;
+    // Keeps the file's permissions, owner and extended attributes where the backend has them.
+    virtual std::unique_ptr<VfsReplaceFile> open_replace(const fs::path& p, std::error_code& ec) = 0;
+    // Creates or truncates `to` to `size` bytes with the permissions of `from`, so copy_range
+    // and copy_span calls can fill it in any order. Fails with EINVAL when `to` is `from`.
+    virtual bool prepare_copy(const fs::path& from, const fs::path& to, std::uint64_t size, std::error_code& ec) = 0;
+    // Copies `len` bytes at `from_off` in `from` to `to_off` in the existing file `to`.
+    virtual bool copy_span(const fs::path& from, std::uint64_t from_off, const fs::path& to, std::uint64_t to_off,
+                           std::uint64_t len, std::error_code& ec) = 0;
+    bool copy_range(const fs::path& from, const fs::path& to, std::uint64_t off, std::uint64_t len, std::error_code& ec) {
+        return copy_span(from, off, to, off, len, ec);
+    }
+    // Flushes `p` to stable storage: its data and metadata, or with `whole_fs` everything
+    // dirty on the filesystem holding it (syncfs).
+    virtual bool sync(const fs::path& p, bool whole_fs, std::error_code& ec) = 0;
+    // Bytes available to unprivileged users on the filesystem holding `p` (or its nearest
+    // existing ancestor), and its block size. False when unknown.
+    virtual bool free_space(const fs::path& p, std::uint64_t& avail, std::uint64_t& block, std::error_code& ec) {
+        (void)p; (void)avail; (void)block;
+        ec = std::make_error_code(std::errc::operation_not_supported);
+        return false;
+    }
+    // Sets permission bits and modification time, e.g. when restoring a saved tree.
+    virtual bool set_meta(const fs::path& p, unsigned mode, std::int64_t mtime_ns, std::error_code& ec) {
+        (void)p; (void)mode; (void)mtime_ns;
+        ec = std::make_error_code(std::errc::operation_not_supported);
+        return false;
+    }
+};
+
+inline void set_errno(std::error_code& ec, int e) { ec.assign(e, std::generic_category()); }
+
+class PosixVfs : public Vfs {
+public:
+    bool real() const override { return true; }
+
+    bool read_dir(const fs::path& dir, std::vector<RawDirent>& out, std::error_code& ec) override {
+        out.clear();
+#ifdef _WIN32
+        fs::directory_iterator it(dir, ec), end;
+        for (; !ec && it != end; it.increment(ec)) {
+            RawDirent d;
+            d.name = it->path().filename().string();
+            std::error_code tec;
+            d.type = it->is_symlink(tec) ? kTypeLink : it->is_directory(tec) ? kTypeDir
+                   : it->is_regular_file(tec) ? kTypeFile : kTypeOther;
+            out.push_back(std::move(d));
+        }
+        return !ec;
+#else
+        DIR* d = ::opendir(dir.c_str());
+        if (!d) { set_errno(ec, errno); return false; }
+        while (struct dirent* de = ::readdir(d)) {
+            if (de->d_name[0] == '.' && (de->d_name[1] == '\0' || (de->d_name[1] == '.' && de->d_name[2] == '\0')))
+                continue;
+            RawDirent r;
+            r.name = de->d_name;
+            r.ino = de->d_ino;
+            switch (de->d_type) {
+                case DT_REG: r.type = kTypeFile; break;
+                case DT_DIR: r.type = kTypeDir; break;
+                case DT_LNK: r.type = kTypeLink; break;
+                case DT_UNKNOWN: r.type = 0; break;
+                default: r.type = kTypeOther; break;
+            }
+            out.push_back(std::move(r));
+        }
+        ::closedir(d);
+        return true;
+#endif
+    }
+
+    bool stat(const fs::path& p, bool follow, unsigned want, VfsStat& st, std::error_code& ec) override {
+#if defined(STATX_TYPE)
+        unsigned mask = STATX_TYPE | STATX_INO;
+        if (want & kWantMode) mask |= STATX_MODE;
+        if (want & kWantSize) mask |= STATX_SIZE;
+        if (want & kWantMtime) mask |= STATX_MTIME;
+        if (want & kWantOwner) mask |= STATX_UID | STATX_GID;
+        struct statx sx;
+        int flags = AT_NO_AUTOMOUNT | (follow ? 0 : AT_SYMLINK_NOFOLLOW);
+        if (::statx(AT_FDCWD, p.c_str(), flags, mask, &sx) != 0) { set_errno(ec, errno); return false; }
+        st.type = mode_type(sx.stx_mode);
+        st.mode = sx.stx_mode & 07777;
+        st.size = sx.stx_size;
+        st.ino = sx.stx_ino;
+        st.mtime_ns = static_cast<std::int64_t>(sx.stx_mtime.tv_sec) * 1000000000 + sx.stx_mtime.tv_nsec;
+        st.uid = sx.stx_uid;
+        st.gid = sx.stx_gid;
+        return true;
+#elif !defined(_WIN32)
+        (void)want;
+        struct stat sb;
+        if ((follow ? ::stat(p.c_str(), &sb) : ::lstat(p.c_str(), &sb)) != 0) { set_errno(ec, errno); return false; }
+        st.type = mode_type(sb.st_mode);
+        st.mode = sb.st_mode & 07777;
+        st.size = static_cast<std::uint64_t>(sb.st_size);
+        st.ino = sb.st_ino;
+        st.mtime_ns = static_cast<std::int64_t>(sb.st_mtime) * 1000000000;
+        st.uid = sb.st_uid;
+        st.gid = sb.st_gid;
+        return true;
+#else
+        auto s = follow ? fs::status(p, ec) : fs::symlink_status(p, ec);
+        if (ec) return false;
+        st.type = fs::is_symlink(s) ? kTypeLink : fs::is_directory(s) ? kTypeDir
+                : fs::is_regular_file(s) ? kTypeFile : kTypeOther;
+        st.mode = static_cast<unsigned>(s.permissions()) & 07777;
+        if ((want & kWantSize) && st.type == kTypeFile) st.size = fs::file_size(p, ec);
+        if (want & kWantMtime) {
+            using namespace std::chrono;
+            auto t = fs::last_write_time(p, ec);
+            auto sys = time_point_cast<nanoseconds>(t - fs::file_time_type::clock::now() + system_clock::now());
+            st.mtime_ns = sys.time_since_epoch().count();
+        }
+        return !ec;
+#endif
+    }
+
+    bool create_file(const fs::path& p, std::error_code& ec) override {
+#ifdef _WIN32
+        if (fs::exists(p, ec)) { set_errno(ec, EEXIST); return false; }
+        std::ofstream ofs(p.string());
+        if (!ofs) { set_errno(ec, errno ? errno : EIO); return false; }
+        return true;
+#else
+        int fd = ::open(p.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+        if (fd < 0) { set_errno(ec, errno); return false; }
+        ::close(fd);
+        return true;
+#endif
+    }
+
+    bool make_dirs(const fs::path& p, std::error_code& ec) override {
+        fs::create_directories(p, ec);
+        return !ec;
+    }
+
+    bool remove(const fs::path& p, std::error_code& ec) override {
+        if (fs::remove(p, ec)) return true;
+        if (!ec) set_errno(ec, ENOENT);
+        return false;
+    }
+
+    bool rename(const fs::path& from, const fs::path& to, std::error_code& ec) override {
+        fs::rename(from, to, ec);
+        return !ec;
+    }
+
+    bool copy_file(const fs::path& from, const fs::path& to, std::error_code& ec) override {
+        fs::copy_file(from, to, fs::copy_options::overwrite_existing, ec);
+        return !ec;
+    }
+
+    fs::path canonical(const fs::path& p, std::error_code& ec) override { return fs::canonical(p, ec); }
+
+    std::unique_ptr<VfsFile> open_read(const fs::path& p, std::error_code& ec) override {
+#ifdef _WIN32
+        auto f = std::make_unique<File>();
+        f->in.open(p, std::ios::binary);
+        if (!f->in) { set_errno(ec, ENOENT); return nullptr; }
+        f->bytes = fs::file_size(p, ec);
+        if (ec) return nullptr;
+        return f;
+#else
+        int fd = ::open(p.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) { set_errno(ec, errno); return nullptr; }
+        auto f = std::make_unique<File>(fd);
+        struct stat st;
+        if (::fstat(fd, &st) != 0) { set_errno(ec, errno); return nullptr; }
+        if (S_ISDIR(st.st_mode)) { set_errno(ec, EISDIR); return nullptr; }
+        f->bytes = static_cast<std::uint64_t>(st.st_size);
+        return f;
+#endif
+    }
+
+    // Writes a temporary next to `p` (same filesystem, so the final rename is atomic).
+    std::unique_ptr<VfsReplaceFile> open_replace(const fs::path& p, std::error_code& ec) override {
+        fs::path tmp = p.parent_path() / ("." + p.filename().string() + ".fe-tmp");
+#ifdef _WIN32
+        auto f = std::make_unique<ReplaceFile>(tmp, p);
+        f->out.open(tmp, std::ios::binary | std::ios::trunc);
+        if (!f->out) { set_errno(ec, EACCES); return nullptr; }
+        return f;
+#else
+        int src = ::open(p.c_str(), O_RDONLY | O_CLOEXEC);
+        if (src < 0) { set_errno(ec, errno); return nullptr; }
+        struct stat st;
+        if (::fstat(src, &st) != 0) { set_errno(ec, errno); ::close(src); return nullptr; }
+        std::string name = tmp.string() + "XXXXXX";
+        int fd = ::mkstemp(&name[0]);
+        if (fd < 0) { set_errno(ec, errno); ::close(src); return nullptr; }
+        auto f = std::make_unique<ReplaceFile>(fd, name, p);
+        if (::fchmod(fd, st.st_mode & 07777) != 0) { set_errno(ec, errno); ::close(src); return nullptr; }
+        // Only root can give the file away; others keep their own uid, as cp -p does.
+        if ((st.st_uid != ::geteuid() || st.st_gid != ::getegid()) && ::fchown(fd, st.st_uid, st.st_gid) != 0 && errno != EPERM) {
+            set_errno(ec, errno);
+            ::close(src);
+            return nullptr;
+        }
+        copy_xattrs(src, fd);
+        ::close(src);
+        return f;
+#endif
+    }
+
+    bool prepare_copy(const fs::path& from, const fs::path& to, std::uint64_t size, std::error_code& ec) override {
+#ifdef _WIN32
+        fs::copy_file(from, to, fs::copy_options::overwrite_existing, ec);
+        if (!ec) fs::resize_file(to, size, ec);
+        return !ec;
+#else
+        struct stat st, dst;
+        if (::stat(from.c_str(), &st) != 0) { set_errno(ec, errno); return false; }
+        // Truncating the source itself (same path or a hard link) would destroy it.
+        if (::stat(to.c_str(), &dst) == 0 && dst.st_dev == st.st_dev && dst.st_ino == st.st_ino) {
+            set_errno(ec, EINVAL);
+            return false;
+        }
+        int fd = ::open(to.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, st.st_mode & 07777);
+        if (fd < 0) { set_errno(ec, errno); return false; }
+        bool ok = ::ftruncate(fd, static_cast<off_t>(size)) == 0;
+        if (!ok) set_errno(ec, errno);
+        ::close(fd);
+        return ok;
+#endif
+    }
+
+    bool copy_span(const fs::path& from, std::uint64_t from_off, const fs::path& to, std::uint64_t to_off,
+                   std::uint64_t len, std::error_code& ec) override {
+#ifdef _WIN32
+        std::ifstream in(from, std::ios::binary);
+        std::fstream out(to, std::ios::binary | std::ios::in | std::ios::out);
+        if (!in || !out) { set_errno(ec, EIO); return false; }
+        in.seekg(static_cast<std::streamoff>(from_off));
+        out.seekp(static_cast<std::streamoff>(to_off));
+        std::vector<char> buf(1 << 20);
+        while (len > 0 && in) {
+            in.read(buf.data(), static_cast<std::streamsize>(std::min<std::uint64_t>(len, buf.size())));
+            auto got = in.gcount();
+            if (got <= 0) break;
+            out.write(buf.data(), got);
+            len -= static_cast<std::uint64_t>(got);
+        }
+        if (!out || len > 0) set_errno(ec, EIO); // write failed or the source shrank
+        return !ec;
+#else
+        int in = ::open(from.c_str(), O_RDONLY | O_CLOEXEC);
+        if (in < 0) { set_errno(ec, errno); return false; }
+        int out = ::open(to.c_str(), O_WRONLY | O_CLOEXEC);
+        if (out < 0) { set_errno(ec, errno); ::close(in); return false; }
+        bool ok = copy_fd_range(in, from_off, out, to_off, len, ec);
+        ::close(in);
+        ::close(out);
+        return ok;
+#endif
+    }
+
+    bool sync(const fs::path& p, bool whole_fs, std::error_code& ec) override {
+#ifdef _WIN32
+        (void)p; (void)whole_fs;
+        ec = std::make_error_code(std::errc::operation_not_supported);
+        return false;
+#else
+        int fd = ::open(p.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) { set_errno(ec, errno); return false; }
+        int rc;
+#ifdef __linux__
+        rc = whole_fs ? ::syncfs(fd) : ::fsync(fd);
+#else
+        if (whole_fs) ::sync();
+        rc = whole_fs ? 0 : ::fsync(fd);
+#endif
+        if (rc != 0) set_errno(ec, errno);
+        ::close(fd);
+        return rc == 0;
+#endif
+    }
+
+    bool free_space(const fs::path& p, std::uint64_t& avail, std::uint64_t& block, std::error_code& ec) override {
+        fs::path at = p;
+        std::error_code xec;
+        while (!at.empty() && !fs::exists(at, xec) && at.has_parent_path() && at.parent_path() != at) at = at.parent_path();
+        if (at.empty()) at = ".";
+#ifdef _WIN32
+        auto info = fs::space(at, ec);
+        if (ec) return false;
+        avail = info.available;
+        block = 4096;
+        return true;
+#else
+        struct statvfs sv;
+        if (::statvfs(at.c_str(), &sv) != 0) { set_errno(ec, errno); return false; }
+        avail = static_cast<std::uint64_t>(sv.f_bavail) * sv.f_frsize;
+        block = sv.f_frsize ? sv.f_frsize : 4096;
+        return true;
+#endif
+    }
+
+    bool set_meta(const fs::path& p, unsigned mode, std::int64_t mtime_ns, std::error_code& ec) override {
+#ifdef _WIN32
+        // file_time_type has no portable epoch in C++17, so only the permissions carry over.
+        (void)mtime_ns;
+        fs::permissions(p, static_cast<fs::perms>(mode & 07777), ec);
+        return !ec;
+#else
+        if (::chmod(p.c_str(), static_cast<mode_t>(mode & 07777)) != 0) { set_errno(ec, errno); return false; }
+        struct timespec ts[2];
+        ts[0].tv_sec = 0;
+        ts[0].tv_nsec = UTIME_OMIT;
+        ts[1].tv_sec = static_cast<time_t>(mtime_ns / 1000000000);
+        ts[1].tv_nsec = static_cast<long>(mtime_ns % 1000000000);
+        if (::utimensat(AT_FDCWD, p.c_str(), ts, 0) != 0) { set_errno(ec, errno); return false; }
+        return true;
+#endif
+    }
+
+#ifndef _WIN32
+    // Copies `len` bytes from `in` at `off` to `out` at `to_off`, in the kernel when
+    // copy_file_range works. A source that ends early fails with ENODATA rather than leave
+    // a zero-filled tail in a pre-sized destination.
+    static bool copy_fd_range(int in, std::uint64_t off, int out, std::uint64_t to_off, std::uint64_t len,
+                              std::error_code& ec) {
+#ifdef __linux__
+        loff_t in_off = static_cast<loff_t>(off), out_off = static_cast<loff_t>(to_off);
+        while (len > 0) {
+            ssize_t n = ::copy_file_range(in, &in_off, out, &out_off, len, 0);
+            if (n > 0) { len -= static_cast<std::uint64_t>(n); continue; }
+            if (n == 0) { set_errno(ec, ENODATA); return false; } // source shrank
+            if (errno == EINTR) continue;
+            if (errno != EXDEV && errno != ENOSYS && errno != EINVAL && errno != EOPNOTSUPP) {
+                set_errno(ec, errno);
+                return false;
+            }
+            break; // fall back to read/write for the rest
+        }
+        off = static_cast<std::uint64_t>(in_off);
+        to_off = static_cast<std::uint64_t>(out_off);
+#endif
+        std::vector<char> buf(std::min<std::uint64_t>(len, 1 << 20));
+        while (len > 0) {
+            ssize_t n = ::pread(in, buf.data(), std::min<std::uint64_t>(len, buf.size()), static_cast<off_t>(off));
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) { set_errno(ec, errno); return false; }
+            if (n == 0) { set_errno(ec, ENODATA); return false; }
+            for (ssize_t w = 0; w < n;) {
+                ssize_t m = ::pwrite(out, buf.data() + w, static_cast<std::size_t>(n - w), static_cast<off_t>(to_off) + w);
+                if (m < 0 && errno == EINTR) continue;
+                if (m < 0) { set_errno(ec, errno); return false; }
+                w += m;
+            }
+            off += static_cast<std::uint64_t>(n);
+            to_off += static_cast<std::uint64_t>(n);
+            len -= static_cast<std::uint64_t>(n);
+        }
+        return true;
+    }
+#endif
+
+private:
+#ifdef _WIN32
+    struct File : VfsFile {
+        std::ifstream in;
+        std::uint64_t bytes = 0;
+        std::uint64_t size() const override { return bytes; }
+        long long read_at(void* buf, std::size_t len, std::uint64_t off, std::error_code& ec) override {
+            in.clear();
+            in.seekg(static_cast<std::streamoff>(off));
+            in.read(static_cast<char*>(buf), static_cast<std::streamsize>(len));
+            if (in.bad()) { set_errno(ec, EIO); return -1; }
+            return in.gcount();
+        }
+    };
+
+    struct ReplaceFile : VfsReplaceFile {
+        ReplaceFile(fs::path t, fs::path d) : tmp(std::move(t)), dst(std::move(d)) {}
+        ~ReplaceFile() override {
+            if (committed) return;
+            out.close();
+            std::error_code ec;
+            fs::remove(tmp, ec);
+        }
+        bool write(const void* buf, std::size_t len, std::error_code& ec) override {
+            if (!out.write(static_cast<const char*>(buf), static_cast<std::streamsize>(len))) { set_errno(ec, EIO); return false; }
+            return true;
+        }
+        bool commit(bool, std::error_code& ec) override {
+            out.close();
+            if (!out) { set_errno(ec, EIO); return false; }
+            fs::rename(tmp, dst, ec);
+            committed = !ec;
+            return committed;
+        }
+        fs::path tmp, dst;
+        std::ofstream out;
+        bool committed = false;
+    };
+#else
+    struct ReplaceFile : VfsReplaceFile {
+        ReplaceFile(int f, std::string t, fs::path d) : fd(f), tmp(std::move(t)), dst(std::move(d)) {}
+        ~ReplaceFile() override {
+            if (fd >= 0) ::close(fd);
+            if (!committed) ::unlink(tmp.c_str());
+        }
+        bool write(const void* buf, std::size_t len, std::error_code& ec) override {
+            auto p = static_cast<const char*>(buf);
+            while (len > 0) {
+                ssize_t n = ::write(fd, p, len);
+                if (n < 0 && errno == EINTR) continue;
+                if (n < 0) { set_errno(ec, errno); return false; }
+                p += n;
+                len -= static_cast<std::size_t>(n);
+            }
+            return true;
+        }
+        bool commit(bool durable, std::error_code& ec) override {
+            if (durable && ::fsync(fd) != 0) { set_errno(ec, errno); return false; }
+            int rc = ::close(fd);
+            fd = -1;
+            if (rc != 0) { set_errno(ec, errno); return false; }
+            if (::rename(tmp.c_str(), dst.c_str()) != 0) { set_errno(ec, errno); return false; }
+            committed = true;
+            return true;
+        }
+        int fd;
+        std::string tmp;
+        fs::path dst;
+        bool committed = false;
+    };
+
+    static void copy_xattrs(int from, int to) {
+#ifdef __linux__
+        ssize_t len = ::flistxattr(from, nullptr, 0);
+        if (len <= 0) return;
+        std::vector<char> names(static_cast<std::size_t>(len));
+        len = ::flistxattr(from, names.data(), names.size());
+        std::vector<char> value;
+        for (ssize_t i = 0; i < len; i += static_cast<ssize_t>(std::strlen(names.data() + i)) + 1) {
+            const char* name = names.data() + i;
+            ssize_t n = ::fgetxattr(from, name, nullptr, 0);
+            if (n < 0) continue;
+            value.resize(static_cast<std::size_t>(n));
+            n = ::fgetxattr(from, name, value.data(), value.size());
+            if (n >= 0) ::fsetxattr(to, name, value.data(), static_cast<std::size_t>(n), 0);
+        }
+#else
+        (void)from; (void)to;
+#endif
+    }
+
+    struct File : VfsFile {
+        explicit File(int f) : fd(f) {}
+        ~File() override { ::close(fd); }
+        int fd;
+        std::uint64_t bytes = 0;
+        std::uint64_t size() const override { return bytes; }
+        long long read_at(void* buf, std::size_t len, std::uint64_t off, std::error_code& ec) override {
+            for (;;) {
+                ssize_t n = ::pread(fd, buf, len, static_cast<off_t>(off));
+                if (n >= 0) return n;
+                if (errno != EINTR) { set_errno(ec, errno); return -1; }
+            }
+        }
+    };
+#endif
+
+#ifndef _WIN32
+    static unsigned mode_type(unsigned mode) {
+        return S_ISDIR(mode) ? kTypeDir : S_ISREG(mode) ? kTypeFile : S_ISLNK(mode) ? kTypeLink : kTypeOther;
+    }
+#endif
+};
+
+// Whole tree in memory, keyed by normalized absolute path. File sizes may exceed the stored
+// bytes (mirrored trees keep sizes only); missing bytes read as zeros.
+class MemVfs : public Vfs {
+public:
+    MemVfs() { nodes_["/"] = Node{kTypeDir, 0755, 0, next_ino_++, now_ns(), {}, {}}; }
+
+    bool read_dir(const fs::path& dir, std::vector<RawDirent>& out, std::error_code& ec) override {
+        std::lock_guard<std::mutex> lk(mu_);
+        out.clear();
+        auto it = nodes_.find(key(dir));
+        if (it == nodes_.end()) { set_errno(ec, ENOENT); return false; }
+        if (it->second.type != kTypeDir) { set_errno(ec, ENOTDIR); return false; }
+        std::string base = it->first == "/" ? "/" : it->first + "/";
+        for (const auto& name : it->second.children) {
+            const Node& n = nodes_.at(base + name);
+            out.push_back(RawDirent{name, n.ino, n.type});
+        }
+        return true;
+    }
+
+    bool stat(const fs::path& p, bool, unsigned, VfsStat& st, std::error_code& ec) override {
+        std::lock_guard<std::mutex> lk(mu_);
+        auto it = nodes_.find(key(p));
+        if (it == nodes_.end()) { set_errno(ec, ENOENT); return false; }
+        const Node& n = it->second;
+        st.type = n.type;
+        st.mode = n.mode;
+        st.size = n.size;
+        st.ino = n.ino;
+        st.mtime_ns = n.mtime_ns;
+        st.uid = st.gid = 0;
+        return true;
+    }
+
+    bool create_file(const fs::path& p, std::error_code& ec) override {
+        std::lock_guard<std::mutex> lk(mu_);
+        return add(key(p), kTypeFile, 0644, 0, ec);
+    }
+
+    bool make_dirs(const fs::path& p, std::error_code& ec) override {
+        std::lock_guard<std::mutex> lk(mu_);
+        std::string k = key(p), cur;
+        for (std::size_t pos = 1; pos <= k.size(); ++pos) {
+            if (pos != k.size() && k[pos] != '/') continue;
+            cur = k.substr(0, pos);
+            auto it = nodes_.find(cur);
+            if (it == nodes_.end()) {
+                if (!add(cur, kTypeDir, 0755, 0, ec)) return false;
+            } else if (it->second.type != kTypeDir) {
+                set_errno(ec, ENOTDIR);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool remove(const fs::path& p, std::error_code& ec) override {
+        std::lock_guard<std::mutex> lk(mu_);
+        std::string k = key(p);
+        auto it = nodes_.find(k);
+        if (it == nodes_.end() || k == "/") { set_errno(ec, k == "/" ? EBUSY : ENOENT); return false; }
+        if (it->second.type == kTypeDir && !it->second.children.empty()) { set_errno(ec, ENOTEMPTY); return false; }
+        nodes_.erase(it);
+        unlink_child(k);
+        return true;
+    }
+
+    bool rename(const fs::path& from, const fs::path& to, std::error_code& ec) override {
+        std::lock_guard<std::mutex> lk(mu_);
+        std::string src = key(from), dst = key(to);
+        auto it = nodes_.find(src);
+        if (it == nodes_.end()) { set_errno(ec, ENOENT); return false; }
+        if (src == dst) return true;
+        if (dst.compare(0, src.size() + 1, src + "/") == 0) { set_errno(ec, EINVAL); return false; }
+        auto parent = nodes_.find(parent_key(dst));
+        if (parent == nodes_.end() || parent->second.type != kTypeDir) { set_errno(ec, ENOENT); return false; }
+        auto existing = nodes_.find(dst);
+        if (existing != nodes_.end()) {
+            if (existing->second.type == kTypeDir && !existing->second.children.empty()) { set_errno(ec, ENOTEMPTY); return false; }
+            nodes_.erase(existing);
+            unlink_child(dst);
+        }
+        // Move the node and, for directories, every descendant key.
+        std::vector<std::pair<std::string, Node>> moved;
+        for (auto n = nodes_.begin(); n != nodes_.end();) {
+            if (n->first == src || n->first.compare(0, src.size() + 1, src + "/") == 0) {
+                moved.emplace_back(dst + n->first.substr(src.size()), std::move(n->second));
+                n = nodes_.erase(n);
+            } else {
+                ++n;
+            }
+        }
+        for (auto& m : moved) nodes_[m.first] = std::move(m.second);
+        unlink_child(src);
+        nodes_[parent_key(dst)].children.insert(base_name(dst));
+        return true;
+    }
+
+    bool copy_file(const fs::path& from, const fs::path& to, std::error_code& ec) override {
+        std::lock_guard<std::mutex> lk(mu_);
+        auto src = nodes_.find(key(from));
+        if (src == nodes_.end()) { set_errno(ec, ENOENT); return false; }
+        if (src->second.type != kTypeFile) { set_errno(ec, EISDIR); return false; }
+        Node copy = src->second;
+        std::string dst = key(to);
+        auto existing = nodes_.find(dst);
+        if (existing != nodes_.end()) {
+            if (existing->second.type != kTypeFile) { set_errno(ec, EISDIR); return false; }
+            existing->second.data = copy.data;
+            existing->second.size = copy.size;
+            existing->second.mtime_ns = now_ns();
+            return true;
+        }
+        if (!add(dst, kTypeFile, copy.mode, copy.size, ec)) return false;
+        nodes_[dst].data = std::move(copy.data);
+        return true;
+    }
+
+    fs::path canonical(const fs::path& p, std::error_code& ec) override {
+        std::lock_guard<std::mutex> lk(mu_);
+        std::string k = key(p);
+        if (!nodes_.count(k)) { set_errno(ec, ENOENT); return {}; }
+        return k;
+    }
+
+    std::unique_ptr<VfsReplaceFile> open_replace(const fs::path& p, std::error_code& ec) override {
+        std::lock_guard<std::mutex> lk(mu_);
+        auto it = nodes_.find(key(p));
+        if (it == nodes_.end()) { set_errno(ec, ENOENT); return nullptr; }
+        if (it->second.type != kTypeFile) { set_errno(ec, EISDIR); return nullptr; }
+        return std::make_unique<ReplaceFile>(*this, key(p));
+    }
+
+    // Reads see a snapshot of the file taken at open.
+    std::unique_ptr<VfsFile> open_read(const fs::path& p, std::error_code& ec) override {
+        std::lock_guard<std::mutex> lk(mu_);
+        auto it = nodes_.find(key(p));
+        if (it == nodes_.end()) { set_errno(ec, ENOENT); return nullptr; }
+        if (it->second.type == kTypeDir) { set_errno(ec, EISDIR); return nullptr; }
+        return std::make_unique<File>(it->second.data, it->second.size);
+    }
+
+    bool prepare_copy(const fs::path& from, const fs::path& to, std::uint64_t size, std::error_code& ec) override {
+        std::lock_guard<std::mutex> lk(mu_);
+        auto src = nodes_.find(key(from));
+        if (src == nodes_.end()) { set_errno(ec, ENOENT); return false; }
+        std::string dst = key(to);
+        if (dst == src->first) { set_errno(ec, EINVAL); return false; }
+        auto it = nodes_.find(dst);
+        if (it == nodes_.end()) {
+            if (!add(dst, kTypeFile, src->second.mode, size, ec)) return false;
+            it = nodes_.find(dst);
+        } else if (it->second.type != kTypeFile) {
+            set_errno(ec, EISDIR);
+            return false;
+        }
+        it->second.size = size;
+        it->second.data.assign(std::min<std::uint64_t>(size, src->second.data.size()), '\0');
+        it->second.mtime_ns = now_ns();
+        return true;
+    }
+
+    bool copy_span(const fs::path& from, std::uint64_t from_off, const fs::path& to, std::uint64_t to_off,
+                   std::uint64_t len, std::error_code& ec) override {
+        std::lock_guard<std::mutex> lk(mu_);
+        auto src = nodes_.find(key(from));
+        auto dst = nodes_.find(key(to));
+        if (src == nodes_.end() || dst == nodes_.end()) { set_errno(ec, ENOENT); return false; }
+        // Bytes past the stored data but within the size (mirrored files) read as zeros.
+        const std::string& in = src->second.data;
+        std::string& out = dst->second.data;
+        std::uint64_t avail = from_off < src->second.size ? std::min(len, src->second.size - from_off) : 0;
+        if (avail > 0) {
+            if (out.size() < to_off + avail) out.resize(to_off + avail);
+            if (from_off < in.size()) {
+                std::uint64_t n = std::min<std::uint64_t>(avail, in.size() - from_off);
+                out.replace(to_off, n, in, from_off, n);
+            }
+        }
+        dst->second.size = std::max<std::uint64_t>(dst->second.size, to_off + avail);
+        // Like PosixVfs: a source that ended early (shrank since it was sized) is an error.
+        if (avail < len) { set_errno(ec, ENODATA); return false; }
+        return true;
+    }
+
+    bool sync(const fs::path& p, bool, std::error_code& ec) override {
+        std::lock_guard<std::mutex> lk(mu_);
+        if (nodes_.count(key(p))) return true;
+        set_errno(ec, ENOENT);
+        return false;
+    }
+
+    bool set_meta(const fs::path& p, unsigned mode, std::int64_t mtime_ns, std::error_code& ec) override {
+        std::lock_guard<std::mutex> lk(mu_);
+        auto it = nodes_.find(key(p));
+        if (it == nodes_.end()) { set_errno(ec, ENOENT); return false; }
+        it->second.mode = mode & 07777;
+        it->second.mtime_ns = mtime_ns;
+        return true;
+    }
+
+    // Copies the names, types, modes, sizes and file mtimes of a real tree into memory under `at`.
+    std::size_t mirror(Vfs& src, const fs::path& from, const fs::path& at) {
+        std::error_code ec;
+        make_dirs(at, ec);
+        std::vector<RawDirent> ents;
+        if (!src.read_dir(from, ents, ec)) return 0;
+        std::size_t n = 0;
+        for (const auto& e : ents) {
+            VfsStat st;
+            if (!src.stat(from / e.name, false, kWantMode | kWantSize | kWantMtime, st, ec)) continue;
+            fs::path dst = at / e.name;
+            if (st.type == kTypeDir) {
+                n += mirror(src, from / e.name, dst) + 1;
+            } else {
+                std::lock_guard<std::mutex> lk(mu_);
+                if (!add(key(dst), st.type == kTypeFile ? kTypeFile : kTypeOther, st.mode, st.size, ec)) continue;
+                nodes_[key(dst)].mtime_ns = st.mtime_ns;
+                ++n;
+            }
+        }
+        return n;
+    }
+
+private:
+    struct File : VfsFile {
+        File(std::string d, std::uint64_t s) : data(std::move(d)), bytes(s) {}
+        std::string data;
+        std::uint64_t bytes;
+        std::uint64_t size() const override { return bytes; }
+        long long read_at(void* buf, std::size_t len, std::uint64_t off, std::error_code&) override {
+            if (off >= bytes) return 0;
+            std::size_t n = static_cast<std::size_t>(std::min<std::uint64_t>(len, bytes - off));
+            std::size_t have = off < data.size() ? std::min(n, data.size() - static_cast<std::size_t>(off)) : 0;
+            if (have) std::memcpy(buf, data.data() + off, have);
+            std::memset(static_cast<char*>(buf) + have, 0, n - have); // sizes beyond the stored bytes read as zeros
+            return static_cast<long long>(n);
+        }
+    };
+
+    struct ReplaceFile : VfsReplaceFile {
+        ReplaceFile(MemVfs& v, std::string k) : vfs(v), path(std::move(k)) {}
+        bool write(const void* buf, std::size_t len, std::error_code&) override {
+            data.append(static_cast<const char*>(buf), len);
+            return true;
+        }
+        bool commit(bool, std::error_code& ec) override {
+            std::lock_guard<std::mutex> lk(vfs.mu_);
+            auto it = vfs.nodes_.find(path);
+            if (it == vfs.nodes_.end()) { set_errno(ec, ENOENT); return false; }
+            it->second.size = data.size();
+            it->second.data = std::move(data);
+            it->second.mtime_ns = now_ns();
+            return true;
+        }
+        MemVfs& vfs;
+        std::string path, data;
+    };
+
+    struct Node {
+        unsigned type = kTypeFile;
+        unsigned mode = 0644;
+        std::uint64_t size = 0;
+        std::uint64_t ino = 0;
+        std::int64_t mtime_ns = 0;
+        std::string data;
+        std::set<std::string> children;
+    };
+
+    static std::int64_t now_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    static std::string key(const fs::path& p) {
+        std::string k = ("/" / p).lexically_normal().generic_string();
+        while (k.size() > 1 && k.back() == '/') k.pop_back();
+        return k;
+    }
+
+    static std::string parent_key(const std::string& k) {
+        auto slash = k.rfind('/');
+        return slash == 0 ? "/" : k.substr(0, slash);
+    }
+
+    static std::string base_name(const std::string& k) { return k.substr(k.rfind('/') + 1); }
+
+    // Caller holds mu_.
+    bool add(const std::string& k, unsigned type, unsigned mode, std::uint64_t size, std::error_code& ec) {
+        if (nodes_.count(k)) { set_errno(ec, EEXIST); return false; }
+        auto parent = nodes_.find(parent_key(k));
+        if (parent == nodes_.end()) { set_errno(ec, ENOENT); return false; }
+        if (parent->second.type != kTypeDir) { set_errno(ec, ENOTDIR); return false; }
+        parent->second.children.insert(base_name(k));
+        parent->second.mtime_ns = now_ns();
+        nodes_[k] = Node{type, mode, size, next_ino_++, now_ns(), {}, {}};
+        return true;
+    }
+
+    void unlink_child(const std::string& k) {
+        auto parent = nodes_.find(parent_key(k));
+        if (parent == nodes_.end()) return;
+        parent->second.children.erase(base_name(k));
+        parent->second.mtime_ns = now_ns();
+    }
+
+    std::mutex mu_;
+    std::unordered_map<std::string, Node> nodes_;
+    std::uint64_t next_ino_ = 1;
+};
+
+// Adds a fixed latency to every call and fails a random fraction of them.
+class FaultyVfs : public Vfs {
+public:
+    FaultyVfs(std::unique_ptr<Vfs> inner, std::chrono::microseconds latency, double error_rate, int error)
+        : inner_(std::move(inner)), latency_(latency), error_rate_(error_rate), error_(error) {}
+
+    bool real() const override { return inner_->real(); }
+    bool read_dir(const fs::path& d, std::vector<RawDirent>& out, std::error_code& ec) override {
+        return !fault(ec) && inner_->read_dir(d, out, ec);
+    }
+    bool stat(const fs::path& p, bool follow, unsigned want, VfsStat& st, std::error_code& ec) override {
+        return !fault(ec) && inner_->stat(p, follow, want, st, ec);
+    }
+    bool create_file(const fs::path& p, std::error_code& ec) override { return !fault(ec) && inner_->create_file(p, ec); }
+    bool make_dirs(const fs::path& p, std::error_code& ec) override { return !fault(ec) && inner_->make_dirs(p, ec); }
+    bool remove(const fs::path& p, std::error_code& ec) override { return !fault(ec) && inner_->remove(p, ec); }
+    bool rename(const fs::path& a, const fs::path& b, std::error_code& ec) override {
+        return !fault(ec) && inner_->rename(a, b, ec);
+    }
+    bool copy_file(const fs::path& a, const fs::path& b, std::error_code& ec) override {
+        return !fault(ec) && inner_->copy_file(a, b, ec);
+    }
+    fs::path canonical(const fs::path& p, std::error_code& ec) override {
+        return fault(ec) ? fs::path() : inner_->canonical(p, ec);
+    }
+    std::unique_ptr<VfsFile> open_read(const fs::path& p, std::error_code& ec) override {
+        return fault(ec) ? nullptr : inner_->open_read(p, ec);
+    }
+    std::unique_ptr<VfsReplaceFile> open_replace(const fs::path& p, std::error_code& ec) override {
+        return fault(ec) ? nullptr : inner_->open_replace(p, ec);
+    }
+    bool prepare_copy(const fs::path& a, const fs::path& b, std::uint64_t size, std::error_code& ec) override {
+        return !fault(ec) && inner_->prepare_copy(a, b, size, ec);
+    }
+    bool copy_span(const fs::path& a, std::uint64_t a_off, const fs::path& b, std::uint64_t b_off, std::uint64_t len,
+                   std::error_code& ec) override {
+        return !fault(ec) && inner_->copy_span(a, a_off, b, b_off, len, ec);
+    }
+    bool sync(const fs::path& p, bool whole_fs, std::error_code& ec) override {
+        return !fault(ec) && inner_->sync(p, whole_fs, ec);
+    }
+    bool free_space(const fs::path& p, std::uint64_t& avail, std::uint64_t& block, std::error_code& ec) override {
+        return !fault(ec) && inner_->free_space(p, avail, block, ec);
+    }
+    bool set_meta(const fs::path& p, unsigned mode, std::int64_t mtime_ns, std::error_code& ec) override {
+        return !fault(ec) && inner_->set_meta(p, mode, mtime_ns, ec);
+    }
+
+private:
+    bool fault(std::error_code& ec) {
+        if (latency_.count() > 0) std::this_thread::sleep_for(latency_);
+        if (error_rate_ <= 0) return false;
+        thread_local std::mt19937_64 rng{std::random_device{}()};
+        if (std::uniform_real_distribution<double>(0.0, 1.0)(rng) >= error_rate_) return false;
+        set_errno(ec, error_);
+        return true;
+    }
+
+    std::unique_ptr<Vfs> inner_;
+    std::chrono::microseconds latency_;
+    double error_rate_;
+    int error_;
+};
+
+std::unique_ptr<Vfs> g_vfs = std::make_unique<PosixVfs>();
+
+Vfs& vfs() { return *g_vfs; }
+
+// Where the menu and `ls` start: the working directory, or the root of an in-memory tree.
+fs::path start_dir() { return vfs().real() ? fs::current_path() : fs::path("/"); }
+
+// Parses --vfs=posix|mem[,latency=USEC][,errors=RATE][,errno=N][,mirror=DIR].
+bool configure_vfs(const std::string& spec) {
+    std::istringstream in(spec);
+    std::string kind, opt, mirror;
+    std::getline(in, kind, ',');
+    long latency_us = 0;
+    double rate = 0;
+    int error = EIO;
+    while (std::getline(in, opt, ',')) {
+        auto eq = opt.find('=');
+        std::string k = opt.substr(0, eq), v = eq == std::string::npos ? "" : opt.substr(eq + 1);
+        if (k == "latency") latency_us = std::strtol(v.c_str(), nullptr, 10);
+        else if (k == "errors") rate = std::strtod(v.c_str(), nullptr);
+        else if (k == "errno") error = static_cast<int>(std::strtol(v.c_str(), nullptr, 10));
+        else if (k == "mirror") mirror = v;
+        else return false;
+    }
+    std::unique_ptr<Vfs> base;
+    if (kind == "posix") {
+        base = std::make_unique<PosixVfs>();
+    } else if (kind == "mem") {
+        auto mem = std::make_unique<MemVfs>();
+        if (!mirror.empty()) {
+            PosixVfs disk;
+            std::cerr << "Mirrored " << mem->mirror(disk, mirror, "/") << " entries into memory.\n";
+        }
+        base = std::move(mem);
+    } else {
+        return false;
+    }
+    if (latency_us > 0 || rate > 0)
+        base = std::make_unique<FaultyVfs>(std::move(base), std::chrono::microseconds(latency_us), rate, error);
+    g_vfs = std::move(base);
+    return true;
+}
+
+// ---------------- Directory reading / HDD mode ----------------
+// On rotational disks, stat-ing entries in readdir order seeks all over the inode table.
+// HDD mode reads a directory's entries first, sorts them by inode number and stats in that
+// order; file content work is ordered by the physical block of the first extent (FIEMAP).
+
+enum class HddMode { Auto, On, Off };
+HddMode g_hdd_mode = HddMode::Auto;
+
+const char* hdd_mode_name(HddMode m) {
+    return m == HddMode::Auto ? "auto" : (m == HddMode::On ? "on" : "off");
+}
+
+bool read_dir_raw(const fs::path& dir, std::vector<RawDirent>& out, std::error_code& ec) {
+    return vfs().read_dir(dir, out, ec);
+}
+
+// Type of a path without following symlinks; used when readdir did not report d_type.
+unsigned lstat_type(const fs::path& p) {
+    std::error_code ec;
+    VfsStat st;
+    return vfs().stat(p, false, 0, st, ec) ? st.type : kTypeOther;
+}
+
+bool is_rotational(const fs::path& p) {
+#ifdef __linux__
+    if (!vfs().real()) return false;
+    struct stat st;
+    if (::stat(p.c_str(), &st) != 0) return false;
+    static std::mutex mu;
+    static std::map<dev_t, bool> cache;
+    std::lock_guard<std::mutex> lk(mu);
+    auto it = cache.find(st.st_dev);
+    if (it != cache.end()) return it->second;
+    // /sys/dev/block/MAJ:MIN links into /sys/block; partitions keep their queue on the parent.
+    std::string base = "/sys/dev/block/" + std::to_string(major(st.st_dev)) + ":" + std::to_string(minor(st.st_dev));
+    bool rot = false;
+    for (const char* q : {"/queue/rotational", "/../queue/rotational"}) {
+        std::ifstream in(base + q);
+        int v = 0;
+        if (in >> v) { rot = (v == 1); break; }
+    }
+    cache[st.st_dev] = rot;
+    return rot;
+#else
+    (void)p;
+    return false;
+#endif
+}
+
+bool hdd_mode_for(const fs::path& p) {
+    if (g_hdd_mode == HddMode::Auto) return is_rotational(p);
+    return g_hdd_mode == HddMode::On;
+}
+
+void sort_by_inode(std::vector<RawDirent>& ents) {
+    std::sort(ents.begin(), ents.end(), [](const RawDirent& a, const RawDirent& b) { return a.ino < b.ino; });
+}
+
+// Physical byte offset of the file's first extent, or UINT64_MAX when unknown.
+std::uint64_t physical_offset(const fs::path& p) {
+#ifdef __linux__
+    if (!vfs().real()) return UINT64_MAX;
+    int fd = ::open(p.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return UINT64_MAX;
+    alignas(struct fiemap) char buf[sizeof(struct fiemap) + sizeof(struct fiemap_extent)] = {};
+    auto* fm = reinterpret_cast<struct fiemap*>(buf);
+    fm->fm_start = 0;
+    fm->fm_length = FIEMAP_MAX_OFFSET;
+    fm->fm_extent_count = 1;
+    std::uint64_t off = UINT64_MAX;
+    if (::ioctl(fd, FS_IOC_FIEMAP, fm) == 0 && fm->fm_mapped_extents > 0)
+        off = fm->fm_extents[0].fe_physical;
+    ::close(fd);
+    return off;
+#else
+    (void)p;
+    return UINT64_MAX;
+#endif
+}
+
+// Orders files for content operations (copying, hashing) by their position on disk.
+void order_by_physical_block(std::vector<fs::path>& files) {
+    std::vector<std::pair<std::uint64_t, fs::path>> keyed;
+    keyed.reserve(files.size());
+    for (auto& f : files) keyed.emplace_back(physical_offset(f), std::move(f));
+    std::stable_sort(keyed.begin(), keyed.end(),
+                     [](const auto& a, const auto& b) { return a.first < b.first; });
+    files.clear();
+    for (auto& k : keyed) files.push_back(std::move(k.second));
+}
+
+// Depth-first, pre-order walk that does not follow directory symlinks. Unreadable
+// directories are recorded in `report` and skipped. Returns false if `root` is unreadable.
+template <class Visit>
+bool walk_tree(const fs::path& root, bool inode_order, Visit&& visit, ErrorReport& report) {
+    std::vector<RawDirent> ents;
+    std::error_code ec;
+    if (!read_dir_raw(root, ents, ec)) { report.add(root, ec); return false; }
+    if (inode_order) sort_by_inode(ents);
+    for (auto& e : ents) {
+        fs::path p = root / e.name;
+        if (e.type == 0) e.type = lstat_type(p);
+        visit(p, e);
+        if (e.type == kTypeDir) walk_tree(p, inode_order, visit, report);
+    }
+    return true;
+}
+
+// ---------------- Worker threads / concurrency autotuner ----------------
+// The best number of parallel stats, reads or unlinks depends on the device (NVMe, SSD, HDD,
+// network FS). The tuner learns it per (st_dev, operation class) from measured throughput,
+// hill-climbing along a power-of-two ladder, and persists what it learned between runs.
+
+// Helper threads running in parallel_for calls across the process, and their limit. The
+// daemon sets a limit so concurrent requests share one budget instead of each starting a
+// tuner-sized set; a call that finds the budget spent runs on its caller's thread alone.
+std::atomic<unsigned> g_helpers{0};
+unsigned g_max_helpers = UINT_MAX;
+
+unsigned reserve_helpers(unsigned want) {
+    unsigned cur = g_helpers.load();
+    for (;;) {
+        unsigned grant = cur >= g_max_helpers ? 0 : std::min(want, g_max_helpers - cur);
+        if (grant == 0 || g_helpers.compare_exchange_weak(cur, cur + grant)) return grant;
+    }
+}
+
+// Runs fn(i) for every i in [0, n) on up to `threads` threads, the caller's included.
+template <class Fn>
+void parallel_for(std::size_t n, unsigned threads, Fn&& fn) {
+    if (threads > n) threads = static_cast<unsigned>(n);
+    unsigned helpers = threads > 1 ? reserve_helpers(threads - 1) : 0;
+    if (helpers == 0) {
+        for (std::size_t i = 0; i < n; ++i) fn(i);
+        return;
+    }
+    std::atomic<std::size_t> next{0};
+    auto drain = [&] {
+        for (std::size_t i; (i = next.fetch_add(1)) < n;) fn(i);
+    };
+    std::vector<std::thread> pool;
+    pool.reserve(helpers);
+    for (unsigned t = 0; t < helpers; ++t) pool.emplace_back(drain);
+    drain();
+    for (auto& th : pool) th.join();
+    g_helpers -= helpers;
+}
+
+enum class OpClass { Stat, Read, Unlink };
+
+const char* op_class_name(OpClass c) {
+    return c == OpClass::Stat ? "stat" : (c == OpClass::Read ? "read" : "unlink");
+}
+
+std::uint64_t device_id(const fs::path& p) {
+#ifdef _WIN32
+    (void)p;
+    return 0;
+#else
+    if (!vfs().real()) return 0;
+    struct stat st;
+    return ::stat(p.c_str(), &st) == 0 ? static_cast<std::uint64_t>(st.st_dev) : 0;
+#endif
+}
+
+// True when both paths exist and name the same file (one path, or hard links to it).
+bool same_file(const fs::path& a, const fs::path& b) {
+    VfsStat sa, sb;
+    std::error_code ec;
+    if (!vfs().stat(a, true, 0, sa, ec) || !vfs().stat(b, true, 0, sb, ec)) return false;
+    return sa.ino == sb.ino && sa.type == sb.type && device_id(a) == device_id(b);
+}
+
+std::string home_file(const char* name) {
+#ifdef _WIN32
+    const char* home = std::getenv("USERPROFILE");
+#else
+    const char* home = std::getenv("HOME");
+#endif
+    return (fs::path(home ? home : ".") / name).string();
+}
+
+class Autotuner {
+public:
+    static constexpr unsigned kLadder[] = {1, 2, 4, 8, 16, 32, 64};
+    static constexpr unsigned kDefault = 4;
+
+    explicit Autotuner(std::string file) : file_(std::move(file)), saved_at_(std::chrono::steady_clock::now()) {
+        load();
+    }
+    ~Autotuner() { flush(); }
+
+    // Concurrency to use for the next operation of class `c` on device `dev`.
+    unsigned pick(std::uint64_t dev, OpClass c) {
+        std::lock_guard<std::mutex> lk(mu_);
+        auto& t = table_[{dev, static_cast<int>(c)}];
+        int idx = ladder_index(t.best);
+        // Try untested neighbours of the current best first, then re-probe one now and then
+        // so the choice can follow changes in load.
+        for (int d : {1, -1}) {
+            int j = idx + d;
+            if (j >= 0 && j < kSteps && !t.rate.count(kLadder[j])) return kLadder[j];
+        }
+        if (++t.picks % 8 == 0) {
+            int j = idx + (((t.picks / 8) % 2) ? 1 : -1);
+            if (j >= 0 && j < kSteps) return kLadder[j];
+        }
+        return t.best;
+    }
+
+    // Feeds back `units` (entries, bytes, files) processed in `secs` at concurrency `conc`.
+    // The table is only marked dirty here; it reaches disk at most every kSaveEvery and at exit.
+    void record(std::uint64_t dev, OpClass c, unsigned conc, std::size_t units, double secs) {
+        if (units < kMinUnits || secs < 1e-3) return; // too small to say anything
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            auto& t = table_[{dev, static_cast<int>(c)}];
+            conc = kLadder[ladder_index(conc)];
+            double r = units / secs;
+            auto it = t.rate.find(conc);
+            if (it == t.rate.end()) t.rate[conc] = r;
+            else it->second = 0.5 * it->second + 0.5 * r;
+            update_best(t);
+            dirty_ = true;
+            if (std::chrono::steady_clock::now() - saved_at_ < kSaveEvery) return;
+        }
+        flush();
+    }
+
+    // Writes the table if it changed since the last save.
+    void flush() {
+        std::string data;
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            if (!dirty_) return;
+            for (const auto& kv : table_)
+                for (const auto& r : kv.second.rate)
+                    data += std::to_string(kv.first.first) + " " + std::to_string(kv.first.second) + " "
+                            + std::to_string(r.first) + " " + std::to_string(r.second) + "\n";
+            dirty_ = false;
+            saved_at_ = std::chrono::steady_clock::now();
+        }
+        std::lock_guard<std::mutex> lk(save_mu_);
+        save(data);
+    }
+
+    // Measured rate at `conc` (or at the best concurrency when `conc` is untested); 0 if none.
+    double rate(std::uint64_t dev, OpClass c, unsigned conc) {
+        std::lock_guard<std::mutex> lk(mu_);
+        auto t = table_.find({dev, static_cast<int>(c)});
+        if (t == table_.end() || t->second.rate.empty()) return 0;
+        auto it = t->second.rate.find(kLadder[ladder_index(conc)]);
+        if (it == t->second.rate.end()) it = t->second.rate.find(t->second.best);
+        return it == t->second.rate.end() ? 0 : it->second;
+    }
+
+    void print(std::ostream& out) {
+        std::lock_guard<std::mutex> lk(mu_);
+        if (table_.empty()) { out << "No measurements yet.\n"; return; }
+        for (const auto& kv : table_) {
+            out << "dev " << kv.first.first << "  " << std::setw(7) << op_class_name(static_cast<OpClass>(kv.first.second))
+                << " best=" << std::setw(3) << kv.second.best << "  ";
+            for (const auto& r : kv.second.rate) out << r.first << ":" << static_cast<std::uint64_t>(r.second) << "/s ";
+            out << "\n";
+        }
+    }
+
+private:
+    static constexpr int kSteps = sizeof(kLadder) / sizeof(kLadder[0]);
+    static constexpr std::size_t kMinUnits = 32;
+    static constexpr std::chrono::seconds kSaveEvery{30};
+
+    struct Tuning {
+        unsigned best = kDefault;
+        unsigned picks = 0;
+        std::map<unsigned, double> rate; // concurrency -> smoothed units/s
+    };
+
+    static int ladder_index(unsigned conc) {
+        int idx = 0;
+        while (idx + 1 < kSteps && kLadder[idx + 1] <= conc) ++idx;
+        return idx;
+    }
+
+    static void update_best(Tuning& t) {
+        double top = -1;
+        for (const auto& kv : t.rate)
+            if (kv.second > top) { top = kv.second; t.best = kv.first; }
+    }
+
+    // File format, one line per measurement: <dev> <class> <concurrency> <units/s>
+    void load() {
+        std::ifstream in(file_);
+        std::uint64_t dev;
+        int cls;
+        unsigned conc;
+        double rate;
+        while (in >> dev >> cls >> conc >> rate) {
+            auto& t = table_[{dev, cls}];
+            t.rate[conc] = rate;
+            update_best(t);
+        }
+    }
+
+    // Written to a temporary file and renamed over the old one, so a crash or another
+    // process saving at the same time never leaves a truncated table behind.
+    void save(const std::string& data) const {
+        std::string tmp = file_ + ".tmp" + std::to_string(std::random_device{}());
+        {
+            std::ofstream out(tmp, std::ios::trunc);
+            if (!out.write(data.data(), static_cast<std::streamsize>(data.size())) || !out.flush()) {
+                out.close();
+                std::remove(tmp.c_str());
+                return;
+            }
+        }
+        std::error_code ec;
+        fs::rename(tmp, file_, ec);
+        if (ec) fs::remove(tmp, ec);
+    }
+
+    std::string file_;
+    std::mutex mu_, save_mu_;
+    std::map<std::pair<std::uint64_t, int>, Tuning> table_;
+    bool dirty_ = false;
+    std::chrono::steady_clock::time_point saved_at_;
+};
+
+Autotuner& tuner() {
+    static Autotuner t(home_file(".file_explorer_tune"));
+    return t;
+}
+
+double seconds_since(std::chrono::steady_clock::time_point t0) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+// Paces work to `rate` units per second (bytes, ops, ...); zero means unlimited. Up to
+// kBurst seconds of unused allowance may be spent at once. Thread-safe.
+class RateLimiter {
+public:
+    static constexpr double kBurst = 0.1;
+
+    explicit RateLimiter(double rate = 0) : rate_(rate) {}
+
+    void set_rate(double rate) {
+        std::lock_guard<std::mutex> lk(mu_);
+        rate_ = rate;
+    }
+
+    double rate() const {
+        std::lock_guard<std::mutex> lk(mu_);
+        return rate_;
+    }
+
+    // Blocks until `n` units may proceed.
+    void acquire(double n) {
+        std::chrono::steady_clock::time_point at;
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            if (rate_ <= 0) return;
+            auto now = std::chrono::steady_clock::now();
+            auto floor = now - std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(kBurst));
+            if (next_ < floor) next_ = floor;
+            at = next_;
+            next_ += std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(n / rate_));
+        }
+        std::this_thread::sleep_until(at);
+    }
+
+private:
+    mutable std::mutex mu_;
+    double rate_;
+    std::chrono::steady_clock::time_point next_{};
+};
+
+// Process-wide I/O throttling. Every background job class has a bytes/s and an ops/s token
+// bucket; workers pay before each operation, so limits hold across all threads and (in
+// daemon mode) all clients. A class can also run at the idle I/O priority (Linux
+// ioprio_set), so the kernel serves it only when the disk is otherwise free.
+enum class JobClass { Copy, Delete, Warm };
+constexpr std::size_t kJobClasses = 3;
+
+const char* job_class_name(JobClass c) {
+    return c == JobClass::Copy ? "copy" : (c == JobClass::Delete ? "delete" : "warm");
+}
+
+bool parse_job_class(const std::string& s, JobClass& c) {
+    for (std::size_t i = 0; i < kJobClasses; ++i)
+        if (s == job_class_name(static_cast<JobClass>(i))) { c = static_cast<JobClass>(i); return true; }
+    return false;
+}
+
+#ifdef __linux__
+constexpr int kIoprioWhoProcess = 1; // with id 0: the calling thread
+constexpr int kIoprioIdle = 3 << 13; // IOPRIO_PRIO_VALUE(IOPRIO_CLASS_IDLE, 0)
+#endif
+
+// Thread's priority before it first ran idle work, or -1 while it runs at its own priority.
+thread_local int t_saved_ioprio = -1;
+
+class IoScheduler {
+public:
+    struct Limits { double bytes = 0, ops = 0; bool idle = false; };
+
+    // Blocks until the class may do `ops` operations moving `bytes` bytes.
+    void charge(JobClass c, std::uint64_t bytes, std::uint64_t ops = 1) {
+        Class& k = cls_[static_cast<std::size_t>(c)];
+        if (k.idle) enter_idle();
+        if (bytes) k.bytes.acquire(static_cast<double>(bytes));
+        if (ops) k.ops.acquire(static_cast<double>(ops));
+        k.done_bytes += bytes;
+        k.done_ops += ops;
+    }
+
+    void set_limits(JobClass c, const Limits& l) {
+        Class& k = cls_[static_cast<std::size_t>(c)];
+        k.bytes.set_rate(l.bytes);
+        k.ops.set_rate(l.ops);
+        k.idle = l.idle;
+    }
+
+    Limits limits(JobClass c) const {
+        const Class& k = cls_[static_cast<std::size_t>(c)];
+        return Limits{k.bytes.rate(), k.ops.rate(), k.idle};
+    }
+
+    bool throttled(JobClass c) const {
+        auto l = limits(c);
+        return l.bytes > 0 || l.ops > 0 || l.idle;
+    }
+
+    std::uint64_t bytes_done(JobClass c) const { return cls_[static_cast<std::size_t>(c)].done_bytes; }
+    std::uint64_t ops_done(JobClass c) const { return cls_[static_cast<std::size_t>(c)].done_ops; }
+
+    void print(std::ostream& out) const {
+        out << std::left << std::setw(8) << "Class" << std::setw(14) << "Bytes/s" << std::setw(10) << "Ops/s"
+            << "Idle\n";
+        for (std::size_t i = 0; i < kJobClasses; ++i) {
+            auto l = limits(static_cast<JobClass>(i));
+            out << std::setw(8) << job_class_name(static_cast<JobClass>(i))
+                << std::setw(14) << (l.bytes > 0 ? std::to_string(static_cast<std::uint64_t>(l.bytes)) : "unlimited")
+                << std::setw(10) << (l.ops > 0 ? std::to_string(static_cast<std::uint64_t>(l.ops)) : "unlimited")
+                << (l.idle ? "yes" : "no") << "\n";
+        }
+    }
+
+    // Returns the calling thread to the priority it had before running idle work.
+    static void leave_idle() {
+#ifdef __linux__
+        if (t_saved_ioprio < 0) return;
+        ::syscall(SYS_ioprio_set, kIoprioWhoProcess, 0, t_saved_ioprio);
+#endif
+        t_saved_ioprio = -1;
+    }
+
+private:
+    struct Class {
+        RateLimiter bytes, ops;
+        std::atomic<bool> idle{false};
+        std::atomic<std::uint64_t> done_bytes{0}, done_ops{0};
+    };
+
+    static void enter_idle() {
+#ifdef __linux__
+        if (t_saved_ioprio >= 0) return;
+        long prev = ::syscall(SYS_ioprio_get, kIoprioWhoProcess, 0);
+        if (prev < 0 || ::syscall(SYS_ioprio_set, kIoprioWhoProcess, 0, kIoprioIdle) != 0) return;
+        t_saved_ioprio = static_cast<int>(prev);
+#endif
+    }
+
+    std::array<Class, kJobClasses> cls_;
+};
+
+IoScheduler& io_scheduler() {
+    static IoScheduler s;
+    return s;
+}
+
+// Tracks one job's share of its class counters. Interactive runs get a live line on stderr
+// once a second; finish() prints the achieved rate.
+class ProgressMeter {
+public:
+    ProgressMeter(JobClass c, std::ostream& err)
+        : cls_(c), bytes0_(io_scheduler().bytes_done(c)), ops0_(io_scheduler().ops_done(c)),
+          t0_(std::chrono::steady_clock::now()) {
+#ifndef _WIN32
+        if (&err == &std::cerr && ::isatty(STDERR_FILENO)) ticker_ = std::thread([this] { tick(); });
+#else
+        (void)err;
+#endif
+    }
+
+    ~ProgressMeter() { stop(); }
+
+    void finish(std::ostream& out) {
+        stop();
+        out << job_class_name(cls_) << ": " << line() << "\n";
+    }
+
+private:
+    std::string line() const {
+        double secs = seconds_since(t0_);
+        double bytes = static_cast<double>(io_scheduler().bytes_done(cls_) - bytes0_);
+        auto ops = io_scheduler().ops_done(cls_) - ops0_;
+        std::ostringstream s;
+        s << std::fixed << std::setprecision(1) << ops << " op(s), " << bytes / (1 << 20) << " MiB in "
+          << std::setprecision(2) << secs << " s (" << std::setprecision(1)
+          << (secs > 0 ? bytes / secs / (1 << 20) : 0) << " MiB/s, " << (secs > 0 ? static_cast<double>(ops) / secs : 0) << " ops/s)";
+        if (io_scheduler().throttled(cls_)) s << " [throttled]";
+        return s.str();
+    }
+
+    void tick() {
+        std::unique_lock<std::mutex> lk(mu_);
+        while (!cv_.wait_for(lk, std::chrono::seconds(1), [this] { return done_; }))
+            std::cerr << "\r" << job_class_name(cls_) << ": " << line() << "   " << std::flush;
+        std::cerr << "\r\033[K" << std::flush;
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            done_ = true;
+        }
+        cv_.notify_all();
+        if (ticker_.joinable()) ticker_.join();
+    }
+
+    JobClass cls_;
+    std::uint64_t bytes0_, ops0_;
+    std::chrono::steady_clock::time_point t0_;
+    std::mutex mu_;
+    std::condition_variable cv_;
+    bool done_ = false;
+    std::thread ticker_;
+};
+
+// Level-synchronous parallel walk. Each depth is read and then scanned concurrently
+// (`scan` runs on worker threads and may stat); `emit` runs serially on the caller's thread
+// in a stable breadth-first order. With `inode_order` (rotational disks) a level is read and
+// scanned on one thread, in inode order across all its directories, so the stats do not
+// seek back and forth. Returns the number of entries scanned.
+template <class Scan, class Emit>
+std::size_t walk_tree_parallel(const fs::path& root, unsigned threads, bool inode_order,
+                               Scan scan, Emit emit, ErrorReport& report) {
+    if (inode_order) threads = 1;
+    std::size_t scanned = 0;
+    std::vector<fs::path> level{root};
+    for (bool first = true; !level.empty(); first = false) {
+        std::vector<std::vector<RawDirent>> ents(level.size());
+        bool root_failed = false;
+        parallel_for(level.size(), threads, [&](std::size_t i) {
+            std::error_code ec;
+            if (!read_dir_raw(level[i], ents[i], ec)) {
+                report.add(level[i], ec);
+                if (first) root_failed = true;
+            } else if (inode_order) {
+                sort_by_inode(ents[i]);
+            }
+        });
+        if (root_failed) return 0;
+        std::vector<std::pair<std::size_t, std::size_t>> flat;
+        for (std::size_t i = 0; i < ents.size(); ++i)
+            for (std::size_t j = 0; j < ents[i].size(); ++j) flat.emplace_back(i, j);
+        std::vector<std::size_t> order(flat.size());
+        for (std::size_t k = 0; k < order.size(); ++k) order[k] = k;
+        if (inode_order)
+            std::stable_sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) {
+                return ents[flat[a].first][flat[a].second].ino < ents[flat[b].first][flat[b].second].ino;
+            });
+        std::vector<char> hit(flat.size());
+        parallel_for(flat.size(), threads, [&](std::size_t n) {
+            std::size_t k = order[n];
+            auto& e = ents[flat[k].first][flat[k].second];
+            fs::path p = level[flat[k].first] / e.name;
+            if (e.type == 0) e.type = lstat_type(p);
+            hit[k] = scan(p, e);
+        });
+        scanned += flat.size();
+        std::vector<fs::path> next;
+        for (std::size_t k = 0; k < flat.size(); ++k) {
+            const auto& e = ents[flat[k].first][flat[k].second];
+            if (!hit[k] && e.type != kTypeDir) continue;
+            fs::path p = level[flat[k].first] / e.name;
+            if (hit[k]) emit(p, e);
+            if (e.type == kTypeDir) next.push_back(std::move(p));
+        }
+        level.swap(next);
+    }
+    return scanned;
+}
+
+// ---------------- Listing columns ----------------
+// Each column declares what it costs to fetch. A listing only pays for the columns that
+// are shown: name, type and inode come straight from getdents; perms, size, mtime and owner
+// share one statx() restricted to the fields they need; page-cache residency opens and
+// maps each file; content kind reads each file's first block unless its inode and mtime
+// match a cached result.
+
+enum Column : unsigned {
+    kColType = 1, kColPerms = 2, kColSize = 4, kColMtime = 8, kColInode = 16, kColOwner = 32, kColCache = 64,
+    kColKind = 128
+};
+constexpr unsigned kStatColumns = kColPerms | kColSize | kColMtime | kColOwner;
+
+struct ColumnInfo {
+    Column bit;
+    const char* name;
+    const char* header;
+    int width;
+    const char* cost;
+};
+
+const ColumnInfo kColumns[] = {
+    {kColType, "type", "TYPE", 8, "free (d_type; statx only if the filesystem omits it)"},
+    {kColPerms, "perms", "PERMS", 12, "statx(MODE)"},
+    {kColSize, "size", "SIZE(B)", 12, "statx(SIZE)"},
+    {kColMtime, "mtime", "MODIFIED", 24, "statx(MTIME)"},
+    {kColInode, "inode", "INODE", 12, "free (d_ino)"},
+    {kColOwner, "owner", "OWNER", 18, "statx(UID,GID) + cached passwd/group lookup"},
+    {kColCache, "cache", "CACHED", 8, "open + mmap + mincore per file"},
+    {kColKind, "kind", "CONTENT", 14, "statx(INO,MTIME) + first 4 KiB read, cached per (inode, mtime)"},
+};
+
+constexpr unsigned kDefaultColumns = kColType | kColPerms | kColSize | kColMtime;
+// Thread-local so daemon requests can carry their own column set.
+thread_local unsigned g_columns = kDefaultColumns;
+
+std::string columns_to_string(unsigned cols) {
+    std::string s = "name";
+    for (const auto& c : kColumns)
+        if (cols & c.bit) s += std::string(",") + c.name;
+    return s;
+}
+
+bool parse_columns(const std::string& text, unsigned& cols) {
+    std::istringstream in(text);
+    std::string tok;
+    unsigned out = 0;
+    while (std::getline(in, tok, ',')) {
+        tok.erase(std::remove_if(tok.begin(), tok.end(), [](unsigned char c) { return std::isspace(c); }), tok.end());
+        if (tok.empty() || tok == "name") continue;
+        auto it = std::find_if(std::begin(kColumns), std::end(kColumns),
+                               [&](const ColumnInfo& c) { return tok == c.name; });
+        if (it == std::end(kColumns)) { std::cout << "Unknown column: " << tok << "\n"; return false; }
+        out |= it->bit;
+    }
+    cols = out;
+    return true;
+}
+
+void print_column_costs(unsigned cols) {
+    std::cout << "Columns: " << columns_to_string(cols) << "\n";
+    std::cout << "  name: free (getdents)\n";
+    for (const auto& c : kColumns)
+        if (cols & c.bit) std::cout << "  " << c.name << ": " << c.cost << "\n";
+    std::cout << "Per entry: getdents";
+    if (cols & (kStatColumns | kColKind)) std::cout << " + 1 statx";
+    if (cols & kColCache) std::cout << " + open/mmap/mincore";
+    if (cols & kColKind) std::cout << " + 4 KiB read (uncached files)";
+    std::cout << "\n";
+}
+
+std::string owner_name(unsigned uid, unsigned gid) {
+#ifdef _WIN32
+    return std::to_string(uid) + ":" + std::to_string(gid);
+#else
+    static std::mutex mu;
+    static std::map<std::pair<unsigned, unsigned>, std::string> cache;
+    std::lock_guard<std::mutex> lk(mu);
+    auto it = cache.find({uid, gid});
+    if (it != cache.end()) return it->second;
+    char buf[4096];
+    std::string user = std::to_string(uid), group = std::to_string(gid);
+    struct passwd pw, *pwp = nullptr;
+    if (::getpwuid_r(uid, &pw, buf, sizeof(buf), &pwp) == 0 && pwp) user = pwp->pw_name;
+    struct group gr, *grp = nullptr;
+    if (::getgrgid_r(gid, &gr, buf, sizeof(buf), &grp) == 0 && grp) group = grp->gr_name;
+    return cache[{uid, gid}] = user + ":" + group;
+#endif
+}
+
+// Counts the pages of a regular file that are resident in the page cache (mmap + mincore).
+// False with `ec` set when residency cannot be measured; false with `ec` clear when `p` is
+// not a regular file (nothing to report).
+bool page_cache_residency(const fs::path& p, std::uint64_t& resident, std::uint64_t& total, std::error_code& ec) {
+    resident = total = 0;
+#ifdef _WIN32
+    (void)p;
+    ec = std::make_error_code(std::errc::operation_not_supported);
+    return false;
+#else
+    if (!vfs().real()) { ec = std::make_error_code(std::errc::operation_not_supported); return false; }
+    int fd = ::open(p.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) { set_errno(ec, errno); return false; }
+    struct stat st;
+    if (::fstat(fd, &st) != 0) { set_errno(ec, errno); ::close(fd); return false; }
+    if (!S_ISREG(st.st_mode)) { ::close(fd); return false; }
+    const std::uint64_t page = static_cast<std::uint64_t>(::sysconf(_SC_PAGESIZE));
+    const std::uint64_t size = static_cast<std::uint64_t>(st.st_size);
+    total = (size + page - 1) / page;
+    // Map in 1 GiB windows so huge files do not need a huge mapping.
+    const std::uint64_t kWindow = 1ull << 30;
+    std::vector<unsigned char> vec;
+    for (std::uint64_t off = 0; off < size; off += kWindow) {
+        std::size_t len = static_cast<std::size_t>(std::min(kWindow, size - off));
+        void* m = ::mmap(nullptr, len, PROT_READ, MAP_SHARED, fd, static_cast<off_t>(off));
+        if (m == MAP_FAILED) { set_errno(ec, errno); ::close(fd); return false; }
+        vec.resize((len + page - 1) / page);
+        int rc = ::mincore(m, len, vec.data());
+        if (rc != 0) set_errno(ec, errno);
+        ::munmap(m, len);
+        if (rc != 0) { ::close(fd); return false; }
+        for (unsigned char v : vec) resident += v & 1;
+    }
+    ::close(fd);
+    return true;
+#endif
+}
+
+// Content kind from a file's first kSniffBytes: a magic signature, else text (with an
+// encoding guess) or binary.
+constexpr std::size_t kSniffBytes = 4096;
+
+struct Magic {
+    std::size_t off;
+    std::string_view bytes;
+    const char* kind;
+};
+
+const Magic kMagics[] = {
+    {0, std::string_view("\x1f\x8b", 2), "gzip"},
+    {0, "PK\x03\x04", "zip"},
+    {0, "PK\x05\x06", "zip"},
+    {0, "\x7f" "ELF", "elf"},
+    {0, "\x89PNG\r\n\x1a\n", "png"},
+    {0, "PAR1", "parquet"},
+    {0, std::string_view("SQLite format 3\0", 16), "sqlite"},
+    {0, "%PDF-", "pdf"},
+    {0, "\xff\xd8\xff", "jpeg"},
+    {0, "GIF8", "gif"},
+    {0, std::string_view("\xfd" "7zXZ\0", 6), "xz"},
+    {0, "\x28\xb5\x2f\xfd", "zstd"},
+    {0, "BZh", "bzip2"},
+    {257, "ustar", "tar"},
+};
+
+// True when p[0..n) is valid UTF-8, allowing a sequence cut off by the end of the block.
+bool valid_utf8(const unsigned char* p, std::size_t n) {
+    for (std::size_t i = 0; i < n;) {
+        unsigned char c = p[i];
+        std::size_t len = c < 0x80 ? 1 : (c >> 5) == 6 ? 2 : (c >> 4) == 14 ? 3 : (c >> 3) == 30 ? 4 : 0;
+        if (len == 0 || (len == 2 && c < 0xc2)) return false;
+        for (std::size_t k = 1; k < len; ++k) {
+            if (i + k == n) return true;
+            if ((p[i + k] & 0xc0) != 0x80) return false;
+        }
+        i += len;
+    }
+    return true;
+}
+
+const char* classify_content(const unsigned char* p, std::size_t n) {
+    if (n == 0) return "empty";
+    for (const auto& m : kMagics)
+        if (n >= m.off + m.bytes.size() && std::memcmp(p + m.off, m.bytes.data(), m.bytes.size()) == 0) return m.kind;
+    if (n >= 3 && std::memcmp(p, "\xef\xbb\xbf", 3) == 0) return "text/utf-8-bom";
+    if (n >= 2 && p[0] == 0xff && p[1] == 0xfe) return "text/utf-16le";
+    if (n >= 2 && p[0] == 0xfe && p[1] == 0xff) return "text/utf-16be";
+    // Text has no NULs and few control bytes besides \t \n \f \r, backspace and escape.
+    std::size_t controls = 0, high = 0;
+    for (std::size_t i = 0; i < n; ++i) {
+        unsigned char c = p[i];
+        if (c == 0) return "binary";
+        if ((c < 0x20 && c != '\t' && c != '\n' && c != '\f' && c != '\r' && c != '\b' && c != 0x1b) || c == 0x7f)
+            ++controls;
+        high += c >= 0x80;
+    }
+    if (controls * 10 > n) return "binary";
+    if (high == 0) return "text/ascii";
+    return valid_utf8(p, n) ? "text/utf-8" : "text/8-bit";
+}
+
+// Classifications by path, reused while the inode, size and mtime are unchanged.
+class ContentKindCache {
+public:
+    static constexpr std::size_t kMaxEntries = 1 << 16;
+
+    const char* get(const fs::path& p, const VfsStat& st, std::error_code& ec) {
+        std::string key = p.string();
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            auto it = map_.find(key);
+            if (it != map_.end() && it->second.ino == st.ino && it->second.mtime_ns == st.mtime_ns
+                && it->second.size == st.size) {
+                ++hits_;
+                return it->second.kind;
+            }
+        }
+        auto f = vfs().open_read(p, ec);
+        if (!f) return nullptr;
+        unsigned char buf[kSniffBytes];
+        long long n = f->read_at(buf, sizeof buf, 0, ec);
+        if (n < 0) return nullptr;
+        const char* kind = classify_content(buf, static_cast<std::size_t>(n));
+        std::lock_guard<std::mutex> lk(mu_);
+        if (map_.size() >= kMaxEntries) map_.clear();
+        map_[key] = Entry{st.ino, st.mtime_ns, st.size, kind};
+        return kind;
+    }
+
+    std::size_t hits() const { return hits_; }
+
+private:
+    struct Entry {
+        std::uint64_t ino;
+        std::int64_t mtime_ns;
+        std::uint64_t size;
+        const char* kind;
+    };
+    std::mutex mu_;
+    std::unordered_map<std::string, Entry> map_;
+    std::atomic<std::size_t> hits_{0};
+};
+
+ContentKindCache& content_kinds() {
+    static ContentKindCache c;
+    return c;
+}
+
+struct ListedEntry {
+    unsigned type = kTypeFile; // as displayed: links to directories show as kTypeDir once stat-ed
+    bool stat_ok = false;
+    unsigned mode = 0;
+    std::uintmax_t size = 0;
+    std::int64_t mtime = 0;
+    std::string owner;
+    int cached_pct = -1;
+    const char* kind = nullptr; // content kind of regular files
+};
+
+// Fetches only what `cols` needs. The type column follows symlinks when a stat is being
+// made anyway (so a link to a directory shows as [DIR]) and otherwise uses d_type.
+ListedEntry stat_entry(const fs::path& path, unsigned dtype, unsigned cols, std::error_code& ec) {
+    ListedEntry row;
+    if (dtype == kTypeDir || dtype == kTypeLink) row.type = dtype;
+    if (cols & kColCache) {
+        std::uint64_t resident = 0, total = 0;
+        std::error_code cec;
+        if (page_cache_residency(path, resident, total, cec))
+            row.cached_pct = total ? static_cast<int>(resident * 100 / total) : 100;
+    }
+    if ((cols & (kStatColumns | kColKind)) == 0) return row;
+    unsigned want = 0;
+    if (cols & kColKind) want |= kWantSize | kWantMtime;
+    if (cols & kColPerms) want |= kWantMode;
+    if (cols & kColSize) want |= kWantSize;
+    if (cols & kColMtime) want |= kWantMtime;
+    if (cols & kColOwner) want |= kWantOwner;
+    VfsStat st;
+    if (!vfs().stat(path, true, want, st, ec)) return row;
+    row.stat_ok = true;
+    if (st.type == kTypeDir) row.type = kTypeDir;
+    else if (dtype != kTypeLink) row.type = kTypeFile;
+    row.mode = st.mode;
+    if ((cols & kColSize) && st.type == kTypeFile) row.size = st.size;
+    row.mtime = st.mtime_ns / 1000000000;
+    if (cols & kColOwner) row.owner = owner_name(st.uid, st.gid);
+    if ((cols & kColKind) && st.type == kTypeFile) row.kind = content_kinds().get(path, st, ec);
+    return row;
+}
+
+const char* type_label(unsigned type) {
+    return type == kTypeDir ? "[DIR]" : (type == kTypeLink ? "[LNK]" : "[FILE]");
+}
+
+void print_listing_header(std::ostream& out, unsigned cols) {
+    out << std::left;
+    for (const auto& c : kColumns)
+        if (cols & c.bit) out << std::setw(c.width) << c.header;
+    out << "NAME\n";
+}
+
+void print_listing_row(std::ostream& out, unsigned cols, const RawDirent& e, const ListedEntry& r) {
+    out << std::left;
+    if (cols & kColType) out << std::setw(8) << type_label(r.type);
+    if (cols & kColPerms) out << std::setw(12) << (r.stat_ok ? perms_to_string(static_cast<fs::perms>(r.mode)) : "----------");
+    if (cols & kColSize) out << std::setw(12) << r.size;
+    if (cols & kColMtime) out << std::setw(24) << (r.stat_ok ? unix_time_to_string(static_cast<std::time_t>(r.mtime)) : "");
+    if (cols & kColInode) out << std::setw(12) << e.ino;
+    if (cols & kColOwner) out << std::setw(18) << r.owner;
+    if (cols & kColCache) out << std::setw(8) << (r.cached_pct < 0 ? std::string("-") : std::to_string(r.cached_pct) + "%");
+    if (cols & kColKind) out << std::setw(14) << (r.kind ? r.kind : "-");
+    out << e.name << "\n";
+}
+
+// ---------------- Machine-readable output ----------------
+// list/search/filter results can be emitted as JSON Lines, NUL-terminated paths, or a
+// length-prefixed binary record stream for piping into other tools. Records are encoded
+// straight into one reusable buffer, so the steady state does no allocation per row.
+//
+// Binary record: u32 LE payload length, then fields of
+//   u8 id, u8 kind (0 = string: u32 LE length + bytes, 1 = u64 LE).
+
+enum class OutputFormat { Text, JsonLines, Nul, Binary };
+// Thread-local so daemon workers can serve each request in the format it asked for.
+thread_local OutputFormat g_format = OutputFormat::Text;
+
+const char* format_name(OutputFormat f) {
+    switch (f) {
+        case OutputFormat::JsonLines: return "jsonl";
+        case OutputFormat::Nul: return "nul";
+        case OutputFormat::Binary: return "binary";
+        default: return "text";
+    }
+}
+
+bool parse_format(const std::string& s, OutputFormat& f) {
+    for (auto c : {OutputFormat::Text, OutputFormat::JsonLines, OutputFormat::Nul, OutputFormat::Binary})
+        if (s == format_name(c)) { f = c; return true; }
+    return false;
+}
+
+enum FieldId : unsigned char {
+    kFieldPath = 1, kFieldName, kFieldType, kFieldPerms, kFieldSize, kFieldMtime, kFieldInode, kFieldOwner, kFieldCached,
+    kFieldPages, kFieldResident, kFieldExt, kFieldFiles, kFieldLines, kFieldWords, kFieldMatches, kFieldKind
+};
+
+class RecordWriter {
+public:
+    static constexpr std::size_t kFlushAt = 48 * 1024;
+
+    RecordWriter(std::ostream& out, OutputFormat fmt) : out_(out), fmt_(fmt) { buf_.reserve(64 * 1024); }
+    ~RecordWriter() { flush(); }
+
+    void begin() {
+        first_ = true;
+        start_ = buf_.size();
+        if (fmt_ == OutputFormat::JsonLines) put('{');
+        else if (fmt_ == OutputFormat::Binary) put("\0\0\0\0", 4);
+    }
+
+    // String field; a non-empty `b` is appended to `a` as a path component (dir + name),
+    // with a '/' only where fs::path::operator/ would add one, so "/" + "etc" is "/etc".
+    void str(FieldId id, const char* key, std::string_view a, std::string_view b = {}) {
+        bool sep = !b.empty() && !a.empty() && a.back() != '/';
+        switch (fmt_) {
+            case OutputFormat::Nul:
+                if (id != kFieldPath) return;
+                put(a.data(), a.size());
+                if (sep) put('/');
+                put(b.data(), b.size());
+                return;
+            case OutputFormat::JsonLines:
+                json_key(key);
+                put('"');
+                json_escape(a);
+                if (sep) put('/');
+                json_escape(b);
+                put('"');
+                return;
+            case OutputFormat::Binary: {
+                put(static_cast<char>(id));
+                put('\0');
+                std::uint32_t n = static_cast<std::uint32_t>(a.size() + sep + b.size());
+                put_le(n, 4);
+                put(a.data(), a.size());
+                if (sep) put('/');
+                put(b.data(), b.size());
+                return;
+            }
+            default: return;
+        }
+    }
+
+    void num(FieldId id, const char* key, std::uint64_t v) {
+        if (fmt_ == OutputFormat::JsonLines) {
+            json_key(key);
+            char tmp[24];
+            int n = std::snprintf(tmp, sizeof(tmp), "%llu", static_cast<unsigned long long>(v));
+            put(tmp, static_cast<std::size_t>(n));
+        } else if (fmt_ == OutputFormat::Binary) {
+            put(static_cast<char>(id));
+            put('\1');
+            put_le(v, 8);
+        }
+    }
+
+    void end() {
+        if (fmt_ == OutputFormat::JsonLines) { put('}'); put('\n'); }
+        else if (fmt_ == OutputFormat::Nul) put('\0');
+        else if (fmt_ == OutputFormat::Binary) {
+            auto n = static_cast<std::uint32_t>(buf_.size() - start_ - 4);
+            for (int i = 0; i < 4; ++i) buf_[start_ + i] = static_cast<char>((n >> (8 * i)) & 0xff);
+        }
+        if (buf_.size() >= kFlushAt) flush();
+    }
+
+    void flush() {
+        if (!buf_.empty()) out_.write(buf_.data(), static_cast<std::streamsize>(buf_.size()));
+        buf_.clear();
+        out_.flush();
+    }
+
+private:
+    void put(char c) { buf_.push_back(c); }
+    void put(const char* p, std::size_t n) { buf_.insert(buf_.end(), p, p + n); }
+    void put_le(std::uint64_t v, int bytes) {
+        for (int i = 0; i < bytes; ++i) put(static_cast<char>((v >> (8 * i)) & 0xff));
+    }
+    void json_key(const char* key) {
+        if (!first_) put(',');
+        first_ = false;
+        put('"');
+        put(key, std::strlen(key));
+        put('"');
+        put(':');
+    }
+    // Length of the well-formed UTF-8 sequence at s[i] (no overlongs, surrogates or code
+    // points past U+10FFFF), or 0.
+    static std::size_t utf8_length(std::string_view s, std::size_t i) {
+        auto at = [&](std::size_t k) { return i + k < s.size() ? static_cast<unsigned char>(s[i + k]) : 0u; };
+        unsigned c = at(0);
+        auto cont = [&](std::size_t k) { return (at(k) & 0xc0) == 0x80; };
+        if (c >= 0xc2 && c <= 0xdf) return cont(1) ? 2 : 0;
+        if (c >= 0xe0 && c <= 0xef) {
+            unsigned lo = c == 0xe0 ? 0xa0 : 0x80, hi = c == 0xed ? 0x9f : 0xbf;
+            return at(1) >= lo && at(1) <= hi && cont(2) ? 3 : 0;
+        }
+        if (c >= 0xf0 && c <= 0xf4) {
+            unsigned lo = c == 0xf0 ? 0x90 : 0x80, hi = c == 0xf4 ? 0x8f : 0xbf;
+            return at(1) >= lo && at(1) <= hi && cont(2) && cont(3) ? 4 : 0;
+        }
+        return 0;
+    }
+
+    // File names are bytes. Valid UTF-8 passes through; every byte that is not part of a
+    // valid sequence becomes \udcXX (a lone low surrogate, as in Python's surrogateescape),
+    // which no valid text produces, so the original bytes can always be recovered.
+    void json_escape(std::string_view s) {
+        static const char hex[] = "0123456789abcdef";
+        for (std::size_t i = 0; i < s.size();) {
+            auto c = static_cast<unsigned char>(s[i]);
+            if (c < 0x80) {
+                if (c == '"' || c == '\\') { put('\\'); put(s[i]); }
+                else if (c < 0x20) {
+                    put("\\u00", 4);
+                    put(hex[c >> 4]);
+                    put(hex[c & 15]);
+                } else put(s[i]);
+                ++i;
+            } else if (std::size_t n = utf8_length(s, i)) {
+                put(s.data() + i, n);
+                i += n;
+            } else {
+                put("\\udc", 4);
+                put(hex[c >> 4]);
+                put(hex[c & 15]);
+                ++i;
+            }
+        }
+    }
+
+    std::ostream& out_;
+    OutputFormat fmt_;
+    std::vector<char> buf_;
+    std::size_t start_ = 0;
+    bool first_ = true;
+};
+
+void write_listing_record(RecordWriter& w, unsigned cols, const std::string& dir, const RawDirent& e,
+                          const ListedEntry& r) {
+    static const char* kTypeNames[] = {"other", "file", "dir", "other", "link"};
+    w.begin();
+    w.str(kFieldPath, "path", dir, e.name);
+    w.str(kFieldName, "name", e.name);
+    if (cols & kColType) w.str(kFieldType, "type", kTypeNames[r.type <= kTypeLink ? r.type : 0]);
+    if ((cols & kColPerms) && r.stat_ok) w.num(kFieldPerms, "mode", r.mode);
+    if (cols & kColSize) w.num(kFieldSize, "size", r.size);
+    if ((cols & kColMtime) && r.stat_ok) w.num(kFieldMtime, "mtime", static_cast<std::uint64_t>(r.mtime));
+    if (cols & kColInode) w.num(kFieldInode, "inode", e.ino);
+    if (cols & kColOwner) w.str(kFieldOwner, "owner", r.owner);
+    if ((cols & kColCache) && r.cached_pct >= 0) w.num(kFieldCached, "cached_pct", static_cast<std::uint64_t>(r.cached_pct));
+    if ((cols & kColKind) && r.kind) w.str(kFieldKind, "content", r.kind);
+    w.end();
+}
+
+void write_path_record(RecordWriter& w, const fs::path& p) {
+    w.begin();
+    w.str(kFieldPath, "path", p.native());
+    w.end();
+}
+
+// ---------------- Directory prefetch ----------------
+// After a listing, the user usually enters one of its subdirectories next. A background
+// thread warms (readdir + stat) a bounded number of them so option 2 can show the child's
+// rows from cache straight away and then re-stat them against warm inodes. Pending work
+// is dropped whenever the user navigates or lists somewhere else.
+
+struct DirListing {
+    unsigned cols = 0; // columns the rows were fetched for
+    std::vector<RawDirent> ents;
+    std::vector<ListedEntry> rows;
+    std::int64_t dir_mtime_ns = 0;
+    std::chrono::steady_clock::time_point fetched;
+};
+
+class Prefetcher {
+public:
+    static constexpr std::size_t kMaxDirs = 32;       // subdirectories warmed per listing
+    static constexpr std::size_t kMaxEntries = 20000; // entries stat-ed per listing
+    static constexpr std::size_t kCacheDirs = 128;
+    static constexpr std::chrono::seconds kTtl{30};
+
+    ~Prefetcher() {
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            stop_ = true;
+            ++gen_;
+        }
+        cv_.notify_all();
+        if (worker_.joinable()) worker_.join();
+    }
+
+    // Replaces pending work with the subdirectories of `dir`.
+    void schedule(const fs::path& dir, const std::vector<RawDirent>& ents, unsigned cols) {
+        std::lock_guard<std::mutex> lk(mu_);
+        ++gen_;
+        cols_ = cols;
+        queue_.clear();
+        budget_ = kMaxEntries;
+        for (const auto& e : ents)
+            if (e.type == kTypeDir && queue_.size() < kMaxDirs) queue_.push_back(dir / e.name);
+        if (!worker_.joinable()) worker_ = std::thread([this] { run(); });
+        cv_.notify_one();
+    }
+
+    void cancel() {
+        std::lock_guard<std::mutex> lk(mu_);
+        ++gen_;
+        queue_.clear();
+    }
+
+    // Copies a cached listing of `dir` if it is recent, the directory has not changed and
+    // it was fetched with at least the columns in `cols`. Only its names and types can be
+    // trusted; per-file columns may be stale until the caller re-stats them.
+    bool lookup(const fs::path& dir, unsigned cols, DirListing& out) {
+        std::error_code ec;
+        VfsStat st;
+        if (!vfs().stat(dir, true, kWantMtime, st, ec)) return false;
+        std::lock_guard<std::mutex> lk(mu_);
+        auto it = cache_.find(dir.string());
+        if (it == cache_.end() || it->second.dir_mtime_ns != st.mtime_ns || (it->second.cols & cols) != cols
+            || std::chrono::steady_clock::now() - it->second.fetched > kTtl)
+            return false;
+        out = it->second;
+        return true;
+    }
+
+private:
+    void run() {
+        std::unique_lock<std::mutex> lk(mu_);
+        while (!stop_) {
+            cv_.wait(lk, [this] { return stop_ || !queue_.empty(); });
+            if (stop_) break;
+            unsigned gen = gen_, cols = cols_;
+            fs::path dir = std::move(queue_.front());
+            queue_.pop_front();
+            auto hit = cache_.find(dir.string());
+            if (hit != cache_.end() && std::chrono::steady_clock::now() - hit->second.fetched < kTtl / 2) continue;
+            lk.unlock();
+            DirListing l;
+            bool ok = warm(dir, l, gen, cols);
+            lk.lock();
+            if (ok && gen == gen_) store(dir, std::move(l));
+        }
+    }
+
+    bool warm(const fs::path& dir, DirListing& l, unsigned gen, unsigned cols) {
+        std::error_code ec;
+        l.cols = cols;
+        VfsStat st;
+        if (!vfs().stat(dir, true, kWantMtime, st, ec) || !read_dir_raw(dir, l.ents, ec)) return false;
+        l.dir_mtime_ns = st.mtime_ns;
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            if (l.ents.size() > budget_) return false;
+            budget_ -= l.ents.size();
+        }
+        std::vector<std::size_t> order(l.ents.size());
+        for (std::size_t i = 0; i < order.size(); ++i) order[i] = i;
+        if (hdd_mode_for(dir))
+            std::sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) { return l.ents[a].ino < l.ents[b].ino; });
+        l.rows.resize(l.ents.size());
+        for (auto i : order) {
+            if (gen != gen_) return false;
+            auto& e = l.ents[i];
+            if (e.type == 0) e.type = lstat_type(dir / e.name);
+            std::error_code sec;
+            l.rows[i] = stat_entry(dir / e.name, e.type, cols, sec);
+        }
+        l.fetched = std::chrono::steady_clock::now();
+        return true;
+    }
+
+    void store(const fs::path& dir, DirListing&& l) {
+        if (cache_.size() >= kCacheDirs) {
+            auto oldest = cache_.begin();
+            for (auto it = cache_.begin(); it != cache_.end(); ++it)
+                if (it->second.fetched < oldest->second.fetched) oldest = it;
+            cache_.erase(oldest);
+        }
+        cache_[dir.string()] = std::move(l);
+    }
+
+    std::mutex mu_;
+    std::condition_variable cv_;
+    std::thread worker_;
+    std::deque<fs::path> queue_;
+    std::map<std::string, DirListing> cache_;
+    std::atomic<unsigned> gen_{0};
+    std::size_t budget_ = 0;
+    unsigned cols_ = 0;
+    bool stop_ = false;
+};
+
+Prefetcher& prefetcher() {
+    static Prefetcher p;
+    return p;
+}
+
+// ---------------- Binary encoding ----------------
+// Little-endian integers and u32-length-prefixed strings, shared by the daemon protocol and
+// the on-disk index.
+
+void put_u32(std::string& b, std::uint32_t v) {
+    for (int i = 0; i < 4; ++i) b.push_back(static_cast<char>((v >> (8 * i)) & 0xff));
+}
+
+void put_u64(std::string& b, std::uint64_t v) {
+    put_u32(b, static_cast<std::uint32_t>(v));
+    put_u32(b, static_cast<std::uint32_t>(v >> 32));
+}
+
+void put_str(std::string& b, std::string_view s) {
+    put_u32(b, static_cast<std::uint32_t>(s.size()));
+    b.append(s.data(), s.size());
+}
+
+// LEB128: seven bits per byte, high bit set on all but the last.
+void put_varint(std::string& b, std::uint64_t v) {
+    for (; v >= 0x80; v >>= 7) b.push_back(static_cast<char>((v & 0x7f) | 0x80));
+    b.push_back(static_cast<char>(v));
+}
+
+bool get_u32(const char*& p, const char* end, std::uint32_t& v) {
+    if (end - p < 4) return false;
+    v = 0;
+    for (int i = 0; i < 4; ++i) v |= static_cast<std::uint32_t>(static_cast<unsigned char>(p[i])) << (8 * i);
+    p += 4;
+    return true;
+}
+
+bool get_u64(const char*& p, const char* end, std::uint64_t& v) {
+    std::uint32_t lo, hi;
+    if (!get_u32(p, end, lo) || !get_u32(p, end, hi)) return false;
+    v = (static_cast<std::uint64_t>(hi) << 32) | lo;
+    return true;
+}
+
+bool get_varint(const char*& p, const char* end, std::uint64_t& v) {
+    v = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+        auto c = static_cast<unsigned char>(*p++);
+        v |= static_cast<std::uint64_t>(c & 0x7f) << shift;
+        if (!(c & 0x80)) return true;
+    }
+    return false;
+}
+
+bool get_str(const char*& p, const char* end, std::string& s) {
+    std::uint32_t n;
+    if (!get_u32(p, end, n) || static_cast<std::uint32_t>(end - p) < n) return false;
+    s.assign(p, n);
+    p += n;
+    return true;
+}
+
+bool read_whole_file(const std::string& file, std::string& data) {
+    std::ifstream in(file, std::ios::binary);
+    if (!in) return false;
+    std::ostringstream s;
+    s << in.rdbuf();
+    data = s.str();
+    return true;
+}
+
+// Writes via a temporary and rename, so readers never see a half-written file.
+bool write_whole_file(const std::string& file, const std::string& data) {
+    std::string tmp = file + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if (!out.write(data.data(), static_cast<std::streamsize>(data.size()))) return false;
+    }
+    std::error_code ec;
+    fs::rename(tmp, file, ec);
+    return !ec;
+}
+
+std::uint64_t fnv1a(std::string_view s) {
+    std::uint64_t h = 1469598103934665603ull;
+    for (unsigned char c : s) h = (h ^ c) * 1099511628211ull;
+    return h;
+}
+
+// ---------------- Path index ----------------
+// `index build ROOT` records ROOT's tree under ~/.file_explorer_index/: each directory's
+// entries and mtime, plus two Bloom filters of name n-grams (every 1-, 2- and 3-byte
+// substring), one for the directory's own names and one for its whole subtree.
+// `isearch` walks the index and skips every subtree whose filter rules the needle out.
+// Live searches under an indexed root reuse the recorded entries of directories whose
+// mtime is unchanged instead of reading them again, and skip their names outright when
+// the local filter rules the needle out. `index refresh` rebuilds the same way.
+
+inline std::uint32_t name_gram(const char* p, std::size_t len) {
+    std::uint32_t g = static_cast<std::uint32_t>(len) << 24;
+    for (std::size_t i = 0; i < len; ++i) g |= static_cast<std::uint32_t>(static_cast<unsigned char>(p[i])) << (16 - 8 * i);
+    return g;
+}
+
+void name_grams(std::string_view name, std::vector<std::uint32_t>& out) {
+    for (std::size_t i = 0; i < name.size(); ++i)
+        for (std::size_t len = 1; len <= 3 && i + len <= name.size(); ++len) out.push_back(name_gram(name.data() + i, len));
+}
+
+void sort_unique(std::vector<std::uint32_t>& v) {
+    std::sort(v.begin(), v.end());
+    v.erase(std::unique(v.begin(), v.end()), v.end());
+}
+
+// Grams every name containing `needle` must have: its trigrams, or the needle itself when
+// shorter. Empty for an empty needle (everything matches).
+std::vector<std::uint32_t> needle_grams(std::string_view needle) {
+    std::vector<std::uint32_t> g;
+    if (needle.size() < 3) {
+        if (!needle.empty()) g.push_back(name_gram(needle.data(), needle.size()));
+        return g;
+    }
+    for (std::size_t i = 0; i + 3 <= needle.size(); ++i) g.push_back(name_gram(needle.data() + i, 3));
+    sort_unique(g);
+    return g;
+}
+
+class NameBloom {
+public:
+    static constexpr std::size_t kMaxGrams = 1 << 16; // larger sets would match nearly anything
+    static constexpr unsigned kProbes = 3;             // ~3% false positives at 8 bits per gram
+
+    // `grams` sorted and unique; `all` builds a filter that matches everything.
+    static NameBloom build(const std::vector<std::uint32_t>& grams, bool all = false) {
+        NameBloom b;
+        if (all || grams.size() > kMaxGrams) { b.all_ = true; return b; }
+        if (grams.empty()) return b;
+        std::size_t bits = 64;
+        while (bits < grams.size() * 8) bits <<= 1;
+        b.words_.assign(bits / 64, 0);
+        for (auto g : grams) {
+            auto h = mix(g);
+            for (unsigned i = 0; i < kProbes; ++i) b.set(probe(h, i, bits));
+        }
+        return b;
+    }
+
+    bool all() const { return all_; }
+
+    bool may_match(const std::vector<std::uint32_t>& grams) const {
+        if (all_) return true;
+        if (words_.empty()) return grams.empty();
+        const std::size_t bits = words_.size() * 64;
+        for (auto g : grams) {
+            auto h = mix(g);
+            for (unsigned i = 0; i < kProbes; ++i)
+                if (!test(probe(h, i, bits))) return false;
+        }
+        return true;
+    }
+
+    // u32 word count (UINT32_MAX for "all"), then the words.
+    void save(std::string& b) const {
+        put_u32(b, all_ ? UINT32_MAX : static_cast<std::uint32_t>(words_.size()));
+        for (auto w : words_) put_u64(b, w);
+    }
+
+    bool load(const char*& p, const char* end) {
+        std::uint32_t n;
+        if (!get_u32(p, end, n)) return false;
+        all_ = n == UINT32_MAX;
+        words_.assign(all_ ? 0 : n, 0);
+        for (auto& w : words_)
+            if (!get_u64(p, end, w)) return false;
+        return true;
+    }
+
+private:
+    static std::uint64_t mix(std::uint64_t x) { // splitmix64 finalizer
+        x += 0x9e3779b97f4a7c15ull;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+        return x ^ (x >> 31);
+    }
+    static std::size_t probe(std::uint64_t h, unsigned i, std::size_t bits) {
+        return static_cast<std::size_t>((h + i * ((h >> 32) | 1)) & (bits - 1));
+    }
+    void set(std::size_t bit) { words_[bit / 64] |= 1ull << (bit % 64); }
+    bool test(std::size_t bit) const { return (words_[bit / 64] >> (bit % 64)) & 1; }
+
+    bool all_ = false;
+    std::vector<std::uint64_t> words_;
+};
+
+class PathIndex {
+public:
+    static constexpr std::uint32_t kNone = UINT32_MAX;
+    static constexpr std::uint32_t kVersion = 2;
+    // Directory mtimes this close to the build time are not trusted: a change in the same
+    // timestamp tick would go unnoticed (the same rule git applies to racy index entries).
+    static constexpr std::int64_t kRacyNs = 2000000000;
+
+    struct Entry {
+        std::string name;
+        unsigned type = 0;
+    };
+
+    struct Dir {
+        std::string rel; // path below the root with '/' separators, "" for the root itself
+        std::uint32_t parent = kNone;
+        std::int64_t mtime_ns = 0;
+        std::vector<Entry> entries; // sorted by name
+        std::vector<std::uint32_t> subdirs;
+        NameBloom local, subtree;
+    };
+
+    fs::path root;
+    std::int64_t built_ns = 0;
+    bool shallow = false;  // only the root's own entries; its subdirectories are other shards
+    std::vector<Dir> dirs; // pre-order; dirs[0] is the root
+
+    std::uint32_t find(const std::string& rel) const {
+        if (by_rel_.size() != dirs.size()) {
+            by_rel_.clear();
+            for (std::uint32_t i = 0; i < dirs.size(); ++i) by_rel_.emplace(dirs[i].rel, i);
+        }
+        auto it = by_rel_.find(rel);
+        return it == by_rel_.end() ? kNone : it->second;
+    }
+
+    // Whether directory `id`'s recorded entries are still valid for a directory now at `mtime_ns`.
+    bool fresh(std::uint32_t id, std::int64_t mtime_ns) const {
+        return id != kNone && dirs[id].mtime_ns == mtime_ns && mtime_ns != 0 && mtime_ns < built_ns - kRacyNs;
+    }
+
+    // End of `id`'s subtree: pre-order makes it the contiguous id run [id, subtree_end(id)).
+    std::uint32_t subtree_end(std::uint32_t id) const {
+        const std::string& base = dirs[id].rel;
+        auto end = id + 1;
+        while (end < dirs.size() && (base.empty() || (dirs[end].rel.size() > base.size()
+               && dirs[end].rel[base.size()] == '/' && dirs[end].rel.compare(0, base.size(), base) == 0)))
+            ++end;
+        return end;
+    }
+
+    fs::path path_of(std::uint32_t id) const { return dirs[id].rel.empty() ? root : root / dirs[id].rel; }
+
+    std::size_t entry_count() const {
+        std::size_t n = 0;
+        for (const auto& d : dirs) n += d.entries.size();
+        return n;
+    }
+
+    std::string serialize() const {
+        std::string b = "FEIX";
+        put_u32(b, kVersion);
+        put_str(b, root.generic_string());
+        put_u64(b, static_cast<std::uint64_t>(built_ns));
+        put_u32(b, shallow ? 1 : 0);
+        put_u32(b, static_cast<std::uint32_t>(dirs.size()));
+        for (const auto& d : dirs) {
+            put_str(b, d.rel);
+            put_u32(b, d.parent);
+            put_u64(b, static_cast<std::uint64_t>(d.mtime_ns));
+            put_u32(b, static_cast<std::uint32_t>(d.entries.size()));
+            for (const auto& e : d.entries) {
+                put_str(b, e.name);
+                b.push_back(static_cast<char>(e.type));
+            }
+            d.local.save(b);
+            d.subtree.save(b);
+        }
+        return b;
+    }
+
+    bool parse(const std::string& data) {
+        const char* p = data.data();
+        const char* end = p + data.size();
+        std::uint32_t version, flags, ndirs;
+        std::uint64_t built;
+        std::string r;
+        if (data.compare(0, 4, "FEIX") != 0) return false;
+        p += 4;
+        if (!get_u32(p, end, version) || version != kVersion || !get_str(p, end, r) || !get_u64(p, end, built)
+            || !get_u32(p, end, flags) || !get_u32(p, end, ndirs))
+            return false;
+        root = r;
+        built_ns = static_cast<std::int64_t>(built);
+        shallow = flags & 1;
+        dirs.assign(ndirs, Dir{});
+        for (std::uint32_t i = 0; i < ndirs; ++i) {
+            Dir& d = dirs[i];
+            std::uint64_t mtime;
+            std::uint32_t nents;
+            if (!get_str(p, end, d.rel) || !get_u32(p, end, d.parent) || !get_u64(p, end, mtime) || !get_u32(p, end, nents))
+                return false;
+            d.mtime_ns = static_cast<std::int64_t>(mtime);
+            if (d.parent != kNone && (d.parent >= i)) return false;
+            if (d.parent != kNone) dirs[d.parent].subdirs.push_back(i);
+            d.entries.resize(nents);
+            for (auto& e : d.entries) {
+                if (!get_str(p, end, e.name) || p == end) return false;
+                e.type = static_cast<unsigned char>(*p++);
+            }
+            if (!d.local.load(p, end) || !d.subtree.load(p, end)) return false;
+        }
+        by_rel_.clear();
+        return !dirs.empty();
+    }
+
+private:
+    mutable std::unordered_map<std::string, std::uint32_t> by_rel_;
+};
+
+std::int64_t now_unix_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// Absolute, normalized form used as the index key.
+fs::path index_key_path(const fs::path& p) {
+    std::error_code ec;
+    fs::path a = vfs().real() ? fs::absolute(p, ec) : ("/" / p);
+    fs::path n = (ec ? p : a).lexically_normal();
+    auto s = n.generic_string();
+    while (s.size() > 1 && s.back() == '/') s.pop_back();
+    return s;
+}
+
+fs::path index_dir() {
+    fs::path dir = home_file(".file_explorer_index");
+    std::error_code ec;
+    fs::create_directories(dir, ec);
+    return dir;
+}
+
+std::string index_file(const fs::path& root, const char* ext = ".idx") {
+    fs::path dir = index_dir();
+    // In-memory trees get their own namespace so they never shadow a real path's index.
+    std::string key = (vfs().real() ? "" : "mem:") + index_key_path(root).generic_string();
+    std::ostringstream name;
+    name << std::hex << std::setw(16) << std::setfill('0') << fnv1a(key) << ext;
+    return (dir / name.str()).string();
+}
+
+struct IndexBuildStats {
+    std::size_t reread = 0, reused = 0;
+};
+
+// Builds the index of `root`. Directories that `prev` recorded and that have not changed
+// since keep their entries without a readdir.
+class IndexBuilder {
+public:
+    IndexBuilder(PathIndex& idx, const PathIndex* prev, ErrorReport& report) : idx_(idx), prev_(prev), report_(report) {}
+
+    bool build(const fs::path& root) {
+        idx_.root = index_key_path(root);
+        idx_.built_ns = now_unix_ns();
+        idx_.dirs.clear();
+        std::vector<std::uint32_t> grams;
+        bool all = false;
+        add_dir(idx_.root, "", PathIndex::kNone, grams, all);
+        return !idx_.dirs.empty() && !(stats.reread + stats.reused == 0);
+    }
+
+    IndexBuildStats stats;
+
+private:
+    // Appends `path` and its subtree; `grams` receives the subtree's grams unless `all`.
+    void add_dir(const fs::path& path, const std::string& rel, std::uint32_t parent, std::vector<std::uint32_t>& grams,
+                 bool& all) {
+        std::error_code ec;
+        VfsStat st;
+        if (!vfs().stat(path, false, kWantMtime, st, ec)) { report_.add(path, ec); return; }
+        auto id = static_cast<std::uint32_t>(idx_.dirs.size());
+        idx_.dirs.emplace_back();
+        idx_.dirs[id].rel = rel;
+        idx_.dirs[id].parent = parent;
+        idx_.dirs[id].mtime_ns = st.mtime_ns;
+        if (parent != PathIndex::kNone) idx_.dirs[parent].subdirs.push_back(id);
+        std::vector<PathIndex::Entry> entries;
+        std::uint32_t old = prev_ ? prev_->find(rel) : PathIndex::kNone;
+        if (prev_ && prev_->fresh(old, st.mtime_ns)) {
+            entries = prev_->dirs[old].entries;
+            ++stats.reused;
+        } else {
+            std::vector<RawDirent> ents;
+            if (!read_dir_raw(path, ents, ec)) report_.add(path, ec);
+            for (auto& e : ents) {
+                if (e.type == 0) e.type = lstat_type(path / e.name);
+                entries.push_back(PathIndex::Entry{std::move(e.name), e.type});
+            }
+            std::sort(entries.begin(), entries.end(),
+                      [](const PathIndex::Entry& a, const PathIndex::Entry& b) { return a.name < b.name; });
+            ++stats.reread;
+        }
+        std::vector<std::uint32_t> local;
+        for (const auto& e : entries) name_grams(e.name, local);
+        sort_unique(local);
+        idx_.dirs[id].local = NameBloom::build(local);
+        grams = local;
+        all = grams.size() > NameBloom::kMaxGrams;
+        for (const auto& e : entries) {
+            if (e.type != kTypeDir || idx_.shallow) continue;
+            std::vector<std::uint32_t> sub, merged;
+            bool sub_all = false;
+            add_dir(path / e.name, rel.empty() ? e.name : rel + "/" + e.name, id, sub, sub_all);
+            all = all || sub_all;
+            if (all) { grams.clear(); continue; }
+            std::set_union(grams.begin(), grams.end(), sub.begin(), sub.end(), std::back_inserter(merged));
+            grams.swap(merged);
+            if (grams.size() > NameBloom::kMaxGrams) { all = true; grams.clear(); }
+        }
+        idx_.dirs[id].subtree = NameBloom::build(grams, all);
+        idx_.dirs[id].entries = std::move(entries);
+    }
+
+    PathIndex& idx_;
+    const PathIndex* prev_;
+    ErrorReport& report_;
+};
+
+bool load_index(const fs::path& root, PathIndex& idx) {
+    std::string data;
+    return read_whole_file(index_file(root), data) && idx.parse(data);
+}
+
+// Finds an index covering `p` (its own or an ancestor's) and the id of `p`'s directory in it.
+bool load_index_for(const fs::path& p, PathIndex& idx, std::uint32_t& id) {
+    fs::path key = index_key_path(p);
+    for (fs::path at = key;; at = at.parent_path()) {
+        if (load_index(at, idx)) {
+            auto rel = key.lexically_relative(idx.root).generic_string();
+            id = idx.find(rel == "." ? "" : rel);
+            return id != PathIndex::kNone;
+        }
+        if (!at.has_relative_path() || at.parent_path() == at) return false;
+    }
+}
+
+// ---------------- Name dictionary ----------------
+// Written next to each index: every distinct name under the root, sorted and front-coded in
+// blocks of 16 (the first name of a block whole, each later one as the length it shares
+// with its predecessor plus the rest), each followed by the delta-coded ids of the
+// directories holding it. Lookups mmap the file and binary-search the block heads, so
+// exact, prefix and range queries touch a few pages whatever the tree size.
+
+// Read-only view of a whole file: mmapped where possible, read into memory otherwise.
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() {
+#ifndef _WIN32
+        if (map_) ::munmap(map_, size_);
+#endif
+    }
+
+    bool open(const std::string& file) {
+#ifndef _WIN32
+        int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd >= 0) {
+            struct stat st;
+            if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+                void* m = ::mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+                if (m != MAP_FAILED) { map_ = m; size_ = static_cast<std::size_t>(st.st_size); }
+            }
+            ::close(fd);
+            if (map_) return true;
+        }
+#endif
+        if (!read_whole_file(file, copy_)) return false;
+        size_ = copy_.size();
+        return true;
+    }
+
+    const char* data() const { return map_ ? static_cast<const char*>(map_) : copy_.data(); }
+    std::size_t size() const { return size_; }
+
+private:
+    void* map_ = nullptr;
+    std::size_t size_ = 0;
+    std::string copy_;
+};
+
+class NameDict {
+public:
+    static constexpr std::uint32_t kBlock = 16;
+    static constexpr std::uint32_t kVersion = 1;
+
+    struct Stats {
+        std::size_t names = 0;       // distinct
+        std::size_t occurrences = 0; // entries in the tree
+        std::uint64_t plain = 0;     // bytes of a NUL-terminated table of the distinct names
+        std::uint64_t coded = 0;     // bytes of the front-coded names alone
+    };
+
+    static std::string build(const PathIndex& idx, Stats& stats) {
+        std::vector<std::pair<std::string_view, std::uint32_t>> all;
+        for (std::uint32_t d = 0; d < idx.dirs.size(); ++d)
+            for (const auto& e : idx.dirs[d].entries) all.emplace_back(e.name, d);
+        std::sort(all.begin(), all.end());
+        stats.occurrences = all.size();
+        std::string body, offsets;
+        std::string_view prev;
+        for (std::size_t i = 0; i < all.size();) {
+            std::string_view name = all[i].first;
+            std::size_t j = i;
+            while (j < all.size() && all[j].first == name) ++j;
+            auto before = body.size();
+            stats.plain += name.size() + 1;
+            if (stats.names % kBlock == 0) {
+                put_u32(offsets, static_cast<std::uint32_t>(body.size()));
+                put_varint(body, name.size());
+            } else {
+                std::size_t shared = 0;
+                while (shared < prev.size() && shared < name.size() && prev[shared] == name[shared]) ++shared;
+                put_varint(body, shared);
+                put_varint(body, name.size() - shared);
+                name.remove_prefix(shared);
+            }
+            body.append(name.data(), name.size());
+            stats.coded += body.size() - before;
+            put_varint(body, j - i);
+            for (std::size_t k = i, last = 0; k < j; last = all[k++].second) put_varint(body, all[k].second - last);
+            prev = all[i].first;
+            ++stats.names;
+            i = j;
+        }
+        std::string b = "FEND";
+        put_u32(b, kVersion);
+        put_u32(b, static_cast<std::uint32_t>(stats.names));
+        put_u32(b, static_cast<std::uint32_t>(offsets.size() / 4));
+        return b + offsets + body;
+    }
+
+    bool open(const std::string& file) {
+        if (!file_.open(file) || file_.size() < 16 || std::memcmp(file_.data(), "FEND", 4) != 0) return false;
+        const char* p = file_.data() + 4;
+        const char* end = file_.data() + file_.size();
+        std::uint32_t version;
+        if (!get_u32(p, end, version) || version != kVersion || !get_u32(p, end, count_) || !get_u32(p, end, blocks_)
+            || static_cast<std::size_t>(end - p) / 4 < blocks_)
+            return false;
+        offsets_ = p;
+        body_ = p + 4 * static_cast<std::size_t>(blocks_);
+        end_ = end;
+        return true;
+    }
+
+    std::size_t size() const { return count_; }
+    std::size_t bytes() const { return file_.size(); }
+
+    // Calls fn(name, dir_ids) for each name >= `lo` in order until fn returns false.
+    template <class Fn>
+    void scan_from(std::string_view lo, Fn fn) const {
+        // Last block whose head is <= lo; earlier blocks hold only smaller names.
+        std::uint32_t a = 0, b = blocks_;
+        while (b - a > 1) {
+            std::uint32_t mid = a + (b - a) / 2;
+            if (head(mid) <= lo) a = mid;
+            else b = mid;
+        }
+        if (blocks_ == 0) return;
+        const char* p = block(a);
+        std::string name;
+        std::vector<std::uint32_t> dirs;
+        for (std::size_t i = std::size_t(a) * kBlock; i < count_; ++i) {
+            if (!decode(p, i % kBlock == 0, name, dirs)) return;
+            if (name < lo) continue;
+            if (!fn(static_cast<const std::string&>(name), static_cast<const std::vector<std::uint32_t>&>(dirs))) return;
+        }
+    }
+
+private:
+    const char* block(std::uint32_t b) const {
+        const char* p = offsets_ + 4 * static_cast<std::size_t>(b);
+        std::uint32_t off = 0;
+        get_u32(p, end_, off);
+        return body_ + std::min<std::size_t>(off, static_cast<std::size_t>(end_ - body_));
+    }
+
+    std::string_view head(std::uint32_t b) const {
+        const char* p = block(b);
+        std::uint64_t n = 0;
+        if (!get_varint(p, end_, n) || static_cast<std::uint64_t>(end_ - p) < n) return {};
+        return std::string_view(p, static_cast<std::size_t>(n));
+    }
+
+    bool decode(const char*& p, bool first, std::string& name, std::vector<std::uint32_t>& dirs) const {
+        std::uint64_t shared = 0, n, count;
+        if (!first && !get_varint(p, end_, shared)) return false;
+        if (!get_varint(p, end_, n) || shared > name.size() || static_cast<std::uint64_t>(end_ - p) < n) return false;
+        name.resize(static_cast<std::size_t>(shared));
+        name.append(p, static_cast<std::size_t>(n));
+        p += n;
+        if (!get_varint(p, end_, count)) return false;
+        dirs.clear();
+        std::uint64_t id = 0;
+        for (std::uint64_t k = 0; k < count; ++k) {
+            std::uint64_t delta;
+            if (!get_varint(p, end_, delta)) return false;
+            dirs.push_back(static_cast<std::uint32_t>(id += delta));
+        }
+        return true;
+    }
+
+    MappedFile file_;
+    std::uint32_t count_ = 0, blocks_ = 0;
+    const char* offsets_ = nullptr;
+    const char* body_ = nullptr;
+    const char* end_ = nullptr;
+};
+
+// ---------------- Index shards ----------------
+// Every indexed root is a shard with its own index and dictionary; a registry lists them.
+// `index build --split ROOT` makes each top-level directory of ROOT a shard of its own, plus
+// a shallow shard holding ROOT's own entries. Builds and refreshes run one shard per worker;
+// queries load and search the shards at or under the query root (and the one covering it)
+// in parallel, streaming results back as they come. Where shards nest, the deeper one owns
+// its subtree, so nothing is reported twice.
+
+std::string shard_registry() {
+    return (index_dir() / (vfs().real() ? "shards" : "shards.mem")).string();
+}
+
+std::vector<fs::path> load_shards() {
+    std::vector<fs::path> roots;
+    std::ifstream in(shard_registry());
+    for (std::string line; std::getline(in, line);)
+        if (!line.empty()) roots.push_back(line);
+    return roots;
+}
+
+void save_shards(std::vector<fs::path> roots) {
+    std::sort(roots.begin(), roots.end());
+    roots.erase(std::unique(roots.begin(), roots.end()), roots.end());
+    std::string data;
+    for (const auto& r : roots) data += r.generic_string() + "\n";
+    write_whole_file(shard_registry(), data);
+}
+
+// Whether key path `p` is `dir` or lies below it.
+bool path_within(const fs::path& p, const fs::path& dir) {
+    auto rel = p.lexically_relative(dir).generic_string();
+    return !rel.empty() && rel.compare(0, 2, "..") != 0;
+}
+
+struct ShardBuild {
+    std::size_t dirs = 0, entries = 0;
+    IndexBuildStats dirs_read;
+    NameDict::Stats names;
+};
+
+// Builds or refreshes one shard and writes its files. Returns false if nothing was indexed.
+bool index_shard(const fs::path& root, bool refresh, bool shallow, ShardBuild& sb, ErrorReport& report) {
+    PathIndex prev, idx;
+    bool have_prev = refresh && load_index(root, prev);
+    idx.shallow = have_prev ? prev.shallow : shallow;
+    IndexBuilder builder(idx, have_prev ? &prev : nullptr, report);
+    if (!builder.build(root) || !write_whole_file(index_file(root), idx.serialize())
+        || !write_whole_file(index_file(root, ".dict"), NameDict::build(idx, sb.names)))
+        return false;
+    sb.dirs = idx.dirs.size();
+    sb.entries = idx.entry_count();
+    sb.dirs_read = builder.stats;
+    return true;
+}
+
+// `index build [--split] ROOT...`, `index refresh [ROOT...]` (no ROOT: every shard),
+// `index list`, `index drop ROOT...`.
+void index_command(const std::string& action, std::vector<std::string> args, std::ostream& out = std::cout,
+                   std::ostream& err = std::cerr) {
+    ErrorReport report;
+    auto registered = load_shards();
+    bool split = !args.empty() && args[0] == "--split";
+    if (split) args.erase(args.begin());
+    if (action == "list") {
+        for (const auto& r : registered) {
+            PathIndex idx;
+            out << r.string();
+            if (load_index(r, idx))
+                out << (idx.shallow ? " (shallow)" : "") << ": " << idx.dirs.size() << " dirs, " << idx.entry_count()
+                    << " entries, built " << (now_unix_ns() - idx.built_ns) / 1000000000 << " s ago\n";
+            else
+                out << ": missing\n";
+        }
+        out << "Shards: " << registered.size() << "\n";
+        return;
+    }
+    if (action == "drop") {
+        std::vector<fs::path> keep;
+        for (const auto& r : registered) {
+            bool drop = std::any_of(args.begin(), args.end(), [&](const std::string& a) { return index_key_path(a) == r; });
+            if (!drop) { keep.push_back(r); continue; }
+            std::error_code ec;
+            fs::remove(index_file(r), ec);
+            fs::remove(index_file(r, ".dict"), ec);
+            out << "Dropped " << r.string() << "\n";
+        }
+        save_shards(keep);
+        return;
+    }
+    // Shards to (re)build: shallow ones carry `true`.
+    std::vector<std::pair<fs::path, bool>> shards;
+    bool refresh = action == "refresh";
+    if (refresh && args.empty())
+        for (const auto& r : registered) shards.emplace_back(r, false);
+    for (const auto& a : args) {
+        fs::path key = index_key_path(a);
+        std::size_t before = shards.size();
+        if (refresh)
+            for (const auto& r : registered)
+                if (path_within(r, key)) shards.emplace_back(r, false);
+        if (shards.size() > before) continue;
+        if (!split) { shards.emplace_back(key, false); continue; }
+        std::vector<RawDirent> ents;
+        std::error_code ec;
+        if (!read_dir_raw(key, ents, ec)) { report.add(key, ec); continue; }
+        shards.emplace_back(key, true);
+        for (auto& e : ents) {
+            if (e.type == 0) e.type = lstat_type(key / e.name);
+            if (e.type == kTypeDir) shards.emplace_back(key / e.name, false);
+        }
+    }
+    auto t0 = std::chrono::steady_clock::now();
+    std::vector<ShardBuild> builds(shards.size());
+    std::vector<char> ok(shards.size(), 0);
+    unsigned threads = shards.empty() ? 1 : tuner().pick(device_id(shards[0].first), OpClass::Stat);
+    parallel_for(shards.size(), threads, [&](std::size_t i) {
+        ok[i] = index_shard(shards[i].first, refresh, shards[i].second, builds[i], report);
+    });
+    std::size_t built = 0;
+    ShardBuild total;
+    for (std::size_t i = 0; i < shards.size(); ++i) {
+        if (!ok[i]) { err << "Could not index " << shards[i].first.string() << "\n"; continue; }
+        registered.push_back(shards[i].first);
+        ++built;
+        total.dirs += builds[i].dirs;
+        total.entries += builds[i].entries;
+        total.dirs_read.reread += builds[i].dirs_read.reread;
+        total.dirs_read.reused += builds[i].dirs_read.reused;
+        total.names.names += builds[i].names.names;
+        total.names.plain += builds[i].names.plain;
+        total.names.coded += builds[i].names.coded;
+    }
+    save_shards(registered);
+    const auto& ds = total.names;
+    out << "Indexed " << built << " shard(s): " << total.dirs << " directories, " << total.entries << " entries in "
+        << std::fixed << std::setprecision(2) << seconds_since(t0) << " s (" << total.dirs_read.reread << " read, "
+        << total.dirs_read.reused << " unchanged)\n"
+        << "Names: " << ds.names << " distinct, " << ds.plain / 1024 << " KiB as a plain table, " << ds.coded / 1024 << " KiB front-coded ("
+        << std::setprecision(1) << (ds.coded ? static_cast<double>(ds.plain) / ds.coded : 0.0) << "x)\n"
+        << std::defaultfloat;
+    report.print(err, "index");
+}
+
+// One shard as seen from a query root.
+struct ShardView {
+    PathIndex idx;
+    std::uint32_t start = 0, stop = 0;                      // the query root's subtree, as dir ids
+    std::vector<std::pair<std::uint32_t, std::uint32_t>> skip; // subtrees owned by nested shards
+    std::string base;                                       // rel of `start` in the shard
+    fs::path lead;                                          // shard root below the query root, or ""
+
+    bool owns(std::uint32_t id) const {
+        if (id < start || id >= stop) return false;
+        for (const auto& s : skip)
+            if (id >= s.first && id < s.second) return false;
+        return true;
+    }
+
+    // Where directory `id` is, spelled under the query root as the user gave it.
+    fs::path display(const fs::path& root, std::uint32_t id) const {
+        const std::string& rel = idx.dirs[id].rel;
+        std::string below = rel.substr(std::min(rel.size(), base.size() + (base.empty() ? 0 : 1)));
+        fs::path p = lead.empty() ? root : root / lead;
+        return below.empty() ? p : p / below;
+    }
+};
+
+// Loads, in parallel, every shard that can hold paths under `root`.
+bool select_shards(const fs::path& root, std::vector<ShardView>& views, std::ostream& err) {
+    fs::path key = index_key_path(root);
+    std::vector<fs::path> roots;
+    for (const auto& r : load_shards())
+        if (path_within(r, key) || path_within(key, r)) roots.push_back(r);
+    std::vector<ShardView> loaded(roots.size());
+    std::vector<char> ok(roots.size(), 0);
+    parallel_for(roots.size(), std::thread::hardware_concurrency(), [&](std::size_t i) {
+        ShardView& v = loaded[i];
+        if (!load_index(roots[i], v.idx)) return;
+        if (path_within(roots[i], key)) {
+            auto lead = roots[i].lexically_relative(key).generic_string();
+            v.lead = lead == "." ? "" : lead;
+        } else {
+            auto rel = key.lexically_relative(roots[i]).generic_string();
+            v.start = v.idx.find(rel);
+            if (v.start == PathIndex::kNone) return;
+            v.base = v.idx.dirs[v.start].rel;
+        }
+        v.stop = v.idx.subtree_end(v.start);
+        ok[i] = 1;
+    });
+    for (std::size_t i = 0; i < roots.size(); ++i) {
+        if (!ok[i]) continue;
+        for (std::size_t j = 0; j < roots.size(); ++j) {
+            if (j == i || !ok[j] || roots[j] == roots[i] || !path_within(roots[j], roots[i])) continue;
+            auto id = loaded[i].idx.find(roots[j].lexically_relative(roots[i]).generic_string());
+            if (id != PathIndex::kNone) loaded[i].skip.emplace_back(id, loaded[i].idx.subtree_end(id));
+        }
+        if (loaded[i].owns(loaded[i].start)) views.push_back(std::move(loaded[i]));
+    }
+    if (views.empty()) err << "No index covers " << root.string() << " (run: index build).\n";
+    return !views.empty();
+}
+
+// A queue of result batches from one or more producers, drained while they run.
+template <class T>
+class ResultStream {
+public:
+    void push(std::vector<T>&& batch) {
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            batches_.push_back(std::move(batch));
+        }
+        cv_.notify_one();
+    }
+
+    void close() {
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            closed_ = true;
+        }
+        cv_.notify_all();
+    }
+
+    // Blocks for the next batch; false once closed and drained.
+    bool pop(std::vector<T>& batch) {
+        std::unique_lock<std::mutex> lk(mu_);
+        cv_.wait(lk, [this] { return closed_ || !batches_.empty(); });
+        if (batches_.empty()) return false;
+        batch = std::move(batches_.front());
+        batches_.pop_front();
+        return true;
+    }
+
+private:
+    std::mutex mu_;
+    std::condition_variable cv_;
+    std::deque<std::vector<T>> batches_;
+    bool closed_ = false;
+};
+
+struct ShardHit {
+    std::string key;  // merge key (the name) for ordered queries
+    std::string text; // what is printed: a path or a name
+};
+
+// Runs produce(i, emit) for every shard on the worker pool while this thread hands results
+// to write(): as they arrive, or, when `ordered`, merged by key across shards (each shard
+// emits in key order). Returns the number written.
+template <class Produce, class Write>
+std::size_t fan_out(std::size_t shards, bool ordered, Produce produce, Write write) {
+    constexpr std::size_t kBatch = 256;
+    std::vector<ResultStream<ShardHit>> streams(ordered ? shards : 1);
+    std::thread runner([&] {
+        parallel_for(shards, std::thread::hardware_concurrency(), [&](std::size_t i) {
+            auto& s = streams[ordered ? i : 0];
+            std::vector<ShardHit> batch;
+            produce(i, [&](ShardHit&& h) {
+                batch.push_back(std::move(h));
+                if (batch.size() == kBatch) s.push(std::move(batch)), batch.clear();
+            });
+            if (!batch.empty()) s.push(std::move(batch));
+            if (ordered) s.close();
+        });
+        if (!ordered && !streams.empty()) streams[0].close();
+    });
+    std::size_t n = 0;
+    if (!ordered) {
+        std::vector<ShardHit> batch;
+        while (!streams.empty() && streams[0].pop(batch))
+            for (auto& h : batch) write(h), ++n;
+    } else {
+        struct Head {
+            std::vector<ShardHit> batch;
+            std::size_t pos = 0;
+        };
+        std::vector<Head> heads(shards);
+        auto later = [&](std::size_t a, std::size_t b) {
+            const auto& x = heads[a].batch[heads[a].pos].key;
+            const auto& y = heads[b].batch[heads[b].pos].key;
+            return x != y ? x > y : a > b;
+        };
+        std::priority_queue<std::size_t, std::vector<std::size_t>, decltype(later)> q(later);
+        for (std::size_t i = 0; i < shards; ++i)
+            if (streams[i].pop(heads[i].batch)) q.push(i);
+        while (!q.empty()) {
+            auto i = q.top();
+            q.pop();
+            write(heads[i].batch[heads[i].pos]);
+            ++n;
+            if (++heads[i].pos == heads[i].batch.size()) {
+                heads[i].pos = 0;
+                if (!streams[i].pop(heads[i].batch)) continue;
+            }
+            q.push(i);
+        }
+    }
+    runner.join();
+    return n;
+}
+
+void write_hit(RecordWriter& w, std::ostream& out, const ShardHit& h, bool is_path) {
+    if (g_format == OutputFormat::Text) out << h.text << "\n";
+    else if (is_path) write_path_record(w, h.text);
+    else { w.begin(); w.str(kFieldName, "name", h.text); w.end(); }
+}
+
+// Indexed name search: never touches the filesystem and skips subtrees whose filter rules
+// the needle out.
+void search_index(const fs::path& root, const std::string& needle, std::ostream& out = std::cout,
+                  std::ostream& err = std::cerr) {
+    std::vector<ShardView> views;
+    if (!select_shards(root, views, err)) return;
+    auto grams = needle_grams(needle);
+    std::atomic<std::size_t> visited{0}, pruned{0};
+    RecordWriter w(out, g_format);
+    auto hits = fan_out(views.size(), false, [&](std::size_t i, auto&& emit) {
+        const ShardView& v = views[i];
+        std::vector<std::uint32_t> stack{v.start};
+        while (!stack.empty()) {
+            auto id = stack.back();
+            stack.pop_back();
+            const auto& d = v.idx.dirs[id];
+            if (!v.owns(id)) continue;
+            if (!d.subtree.may_match(grams)) { ++pruned; continue; }
+            ++visited;
+            if (d.local.may_match(grams))
+                for (const auto& e : d.entries)
+                    if (e.name.find(needle) != std::string::npos)
+                        emit(ShardHit{std::string(), (v.display(root, id) / e.name).string()});
+            for (auto it = d.subdirs.rbegin(); it != d.subdirs.rend(); ++it) stack.push_back(*it);
+        }
+    }, [&](const ShardHit& h) { write_hit(w, out, h, true); });
+    w.flush();
+    if (g_format == OutputFormat::Text)
+        out << "Matches: " << hits << " (" << views.size() << " shard(s), " << visited << " directories searched, "
+            << pruned << " subtrees pruned)\n";
+}
+
+enum class DictQuery { Prefix, Complete, Range };
+
+// Prefix search (paths), completion (distinct names) or a [lo, hi) name range, answered
+// from the name dictionaries of the shards under `root` and merged in name order.
+void dict_query(const fs::path& root, DictQuery q, const std::string& lo, const std::string& hi,
+                std::ostream& out = std::cout, std::ostream& err = std::cerr) {
+    std::vector<ShardView> views;
+    if (!select_shards(root, views, err)) return;
+    RecordWriter w(out, g_format);
+    std::string last;
+    bool any = false;
+    std::size_t written = 0;
+    fan_out(views.size(), true, [&](std::size_t i, auto&& emit) {
+        const ShardView& v = views[i];
+        NameDict dict;
+        if (!dict.open(index_file(v.idx.root, ".dict"))) return;
+        dict.scan_from(lo, [&](const std::string& name, const std::vector<std::uint32_t>& dirs) {
+            if (q == DictQuery::Range ? (!hi.empty() && name >= hi) : name.compare(0, lo.size(), lo) != 0) return false;
+            for (auto d : dirs) {
+                if (!v.owns(d)) continue;
+                if (q != DictQuery::Prefix) { emit(ShardHit{name, name}); break; }
+                emit(ShardHit{name, (v.display(root, d) / name).string()});
+            }
+            return true;
+        });
+    }, [&](const ShardHit& h) {
+        // Names held by several shards arrive adjacent; list each once.
+        if (q != DictQuery::Prefix && any && h.text == last) return;
+        any = true;
+        last = h.text;
+        ++written;
+        write_hit(w, out, h, q == DictQuery::Prefix);
+    });
+    w.flush();
+    if (g_format == OutputFormat::Text) out << (q == DictQuery::Prefix ? "Matches: " : "Names: ") << written << "\n";
+}
+
+// Live search under an indexed root: level-synchronous like walk_tree_parallel, but a
+// directory whose mtime matches the index is listed from the index, and its names are
+// skipped entirely when its local filter rules the needle out. Returns entries scanned.
+template <class Emit>
+std::size_t walk_with_index(const PathIndex& idx, std::uint32_t start, const fs::path& root, const std::string& needle,
+                            unsigned threads, Emit emit, ErrorReport& report) {
+    struct Node {
+        fs::path path;
+        std::string rel;
+        std::uint32_t id;
+    };
+    auto grams = needle_grams(needle);
+    std::size_t scanned = 0;
+    std::vector<Node> level{Node{root, idx.dirs[start].rel, start}};
+    while (!level.empty()) {
+        std::vector<std::vector<RawDirent>> ents(level.size());
+        std::vector<std::vector<std::size_t>> hits(level.size());
+        parallel_for(level.size(), threads, [&](std::size_t i) {
+            Node& n = level[i];
+            std::error_code ec;
+            VfsStat st;
+            bool cached = vfs().stat(n.path, false, kWantMtime, st, ec) && idx.fresh(n.id, st.mtime_ns);
+            if (cached) {
+                for (const auto& e : idx.dirs[n.id].entries) ents[i].push_back(RawDirent{e.name, 0, e.type});
+                if (!idx.dirs[n.id].local.may_match(grams)) return;
+            } else {
+                if (!read_dir_raw(n.path, ents[i], ec)) { report.add(n.path, ec); return; }
+                for (auto& e : ents[i])
+                    if (e.type == 0) e.type = lstat_type(n.path / e.name);
+            }
+            for (std::size_t j = 0; j < ents[i].size(); ++j)
+                if (ents[i][j].name.find(needle) != std::string::npos) hits[i].push_back(j);
+        });
+        std::vector<Node> next;
+        for (std::size_t i = 0; i < level.size(); ++i) {
+            scanned += ents[i].size();
+            for (auto j : hits[i]) emit(level[i].path / ents[i][j].name, ents[i][j]);
+            for (const auto& e : ents[i]) {
+                if (e.type != kTypeDir) continue;
+                std::string rel = level[i].rel.empty() ? e.name : level[i].rel + "/" + e.name;
+                auto id = level[i].id == PathIndex::kNone ? PathIndex::kNone : idx.find(rel);
+                next.push_back(Node{level[i].path / e.name, std::move(rel), id});
+            }
+        }
+        level.swap(next);
+    }
+    return scanned;
+}
+
+// Fills the rows of `listing.ents` for the columns in `cols`.
+void stat_listing(const fs::path& cur, unsigned cols, DirListing& listing, ErrorReport& report) {
+    auto& ents = listing.ents;
+    auto& rows = listing.rows;
+    std::error_code ec;
+    // Stat in inode order on rotational disks, but keep the readdir order for display.
+    std::vector<std::size_t> order(ents.size());
+    for (std::size_t i = 0; i < order.size(); ++i) order[i] = i;
+    if (hdd_mode_for(cur))
+        std::sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) { return ents[a].ino < ents[b].ino; });
+    rows.resize(ents.size());
+    if ((cols & (kStatColumns | kColCache | kColKind)) == 0) {
+        // Name/type/inode-only listings never leave getdents.
+        for (std::size_t i = 0; i < ents.size(); ++i) {
+            if ((cols & kColType) && ents[i].type == 0) ents[i].type = lstat_type(cur / ents[i].name);
+            rows[i] = stat_entry(cur / ents[i].name, ents[i].type, cols, ec);
+        }
+        return;
+    }
+    auto dev = device_id(cur);
+    unsigned threads = tuner().pick(dev, OpClass::Stat);
+    auto t0 = std::chrono::steady_clock::now();
+    parallel_for(order.size(), threads, [&](std::size_t k) {
+        auto i = order[k];
+        if (ents[i].type == 0) ents[i].type = lstat_type(cur / ents[i].name);
+        std::error_code sec;
+        rows[i] = stat_entry(cur / ents[i].name, ents[i].type, cols, sec);
+        if (sec) report.add(cur / ents[i].name, sec);
+    });
+    tuner().record(dev, OpClass::Stat, threads, rows.size(), seconds_since(t0));
+}
+
+// Reads and stats `cur` for the columns in `cols`.
+bool fetch_listing(const fs::path& cur, unsigned cols, DirListing& listing, ErrorReport& report) {
+    std::error_code ec;
+    if (!read_dir_raw(cur, listing.ents, ec)) { report.add(cur, ec); return false; }
+    stat_listing(cur, cols, listing, report);
+    return true;
+}
+
+bool same_row(const ListedEntry& a, const ListedEntry& b) {
+    return a.type == b.type && a.stat_ok == b.stat_ok && a.mode == b.mode && a.size == b.size && a.mtime == b.mtime
+           && a.owner == b.owner && a.cached_pct == b.cached_pct && a.kind == b.kind;
+}
+
+void list_dir(const fs::path& cur, std::ostream& out = std::cout, std::ostream& err = std::cerr) {
+    const unsigned cols = g_columns;
+    DirListing listing;
+    ErrorReport report;
+    bool cached = prefetcher().lookup(cur, cols, listing);
+    // An unchanged directory mtime vouches for names and types only: a file rewritten in
+    // place keeps it. Text listings show the prefetched rows at once and re-stat afterwards,
+    // reprinting the rows that changed; records are re-stat-ed before they are written,
+    // since scripts cannot tell a stale row from a fresh one.
+    bool restat = cached && (cols & (kStatColumns | kColCache | kColKind));
+    if (!cached && !fetch_listing(cur, cols, listing, report) && g_format != OutputFormat::Text) {
+        report.print(err, "list");
+        return;
+    }
+    if (g_format != OutputFormat::Text) {
+        if (restat) stat_listing(cur, cols, listing, report);
+        RecordWriter w(out, g_format);
+        for (std::size_t i = 0; i < listing.ents.size(); ++i)
+            write_listing_record(w, cols, cur.native(), listing.ents[i], listing.rows[i]);
+    } else {
+        out << "\nCurrent Directory: " << cur.string() << (cached ? "  (prefetched)" : "") << "\n";
+        out << "------------------------------------------------------------\n";
+        print_listing_header(out, cols);
+        out << "------------------------------------------------------------\n";
+        for (std::size_t i = 0; i < listing.ents.size(); ++i) print_listing_row(out, cols, listing.ents[i], listing.rows[i]);
+        if (restat) {
+            out.flush();
+            auto shown = listing.rows;
+            stat_listing(cur, cols, listing, report);
+            bool header = false;
+            for (std::size_t i = 0; i < listing.ents.size(); ++i) {
+                if (same_row(shown[i], listing.rows[i])) continue;
+                if (!header) out << "Changed since prefetch:\n";
+                header = true;
+                print_listing_row(out, cols, listing.ents[i], listing.rows[i]);
+            }
+        }
+    }
+    report.print(err, "list");
+    prefetcher().schedule(cur, listing.ents, cols);
+}
+
+bool input_path(const std::string& prompt, fs::path& out) {
+    std::cout << prompt;
+    std::string s;
+    std::getline(std::cin, s);
+    if (s.empty()) return false;
+    out = fs::path(s);
+    return true;
+}
+
+void create_file(const fs::path& p) {
+    std::error_code ec;
+    if (!vfs().create_file(p, ec)) {
+        if (ec == std::errc::file_exists) std::cout << "Path already exists.\n";
+        else std::cerr << "Error: " << ec.message() << "\n";
+        return;
+    }
+    std::cout << "File created: " << p << "\n";
+}
+
+void create_directory_path(const fs::path& p) {
+    std::error_code ec;
+    VfsStat st;
+    if (vfs().stat(p, false, 0, st, ec)) { std::cout << "Path already exists.\n"; return; }
+    ec.clear();
+    if (!vfs().make_dirs(p, ec)) { std::cerr << "Error: " << ec.message() << "\n"; return; }
+    std::cout << "Directory created: " << p << "\n";
+}
+
+// Unlinks the files of a tree in parallel, then removes directories deepest-first.
+std::uintmax_t remove_tree(const fs::path& root, ErrorReport& report) {
+    std::vector<fs::path> files, dirs{root};
+    if (!walk_tree(root, hdd_mode_for(root), [&](const fs::path& p, const RawDirent& e) {
+            (e.type == kTypeDir ? dirs : files).push_back(p);
+        }, report))
+        return 0;
+    auto dev = device_id(root);
+    unsigned threads = tuner().pick(dev, OpClass::Unlink);
+    std::atomic<std::uintmax_t> removed{0};
+    auto t0 = std::chrono::steady_clock::now();
+    parallel_for(files.size(), threads, [&](std::size_t i) {
+        std::error_code ec;
+        io_scheduler().charge(JobClass::Delete, 0);
+        if (vfs().remove(files[i], ec)) ++removed;
+        else if (ec) report.add(files[i], ec);
+    });
+    // Throttled runs say nothing about the device's best concurrency.
+    if (!io_scheduler().throttled(JobClass::Delete))
+        tuner().record(dev, OpClass::Unlink, threads, files.size(), seconds_since(t0));
+    for (auto it = dirs.rbegin(); it != dirs.rend(); ++it) {
+        std::error_code ec;
+        io_scheduler().charge(JobClass::Delete, 0);
+        if (vfs().remove(*it, ec)) ++removed;
+        else if (ec) report.add(*it, ec);
+    }
+    return removed;
+}
+
+void delete_path(const fs::path& p, std::ostream& out = std::cout, std::ostream& err = std::cerr) {
+    std::error_code ec;
+    VfsStat st;
+    if (!vfs().stat(p, false, 0, st, ec)) { out << "Path does not exist.\n"; return; }
+    ErrorReport report;
+    ProgressMeter meter(JobClass::Delete, err);
+    std::uintmax_t count = 0;
+    if (st.type == kTypeDir) {
+        count = remove_tree(p, report);
+    } else {
+        io_scheduler().charge(JobClass::Delete, 0);
+        if (vfs().remove(p, ec)) count = 1;
+        else if (ec) report.add(p, ec);
+    }
+    IoScheduler::leave_idle();
+    out << "Deleted entries: " << count << "\n";
+    meter.finish(out);
+    report.print(err, "delete");
+}
+
+// ---------------- Copy planner ----------------
+// Copies are planned before any data moves: sizes are collected, the destination's free
+// space is checked (statvfs), files over kCopyChunk are split into ranges, and every piece
+// is queued largest-first. Workers take pieces in that order, so huge files start early and
+// small files fill the tail instead of one worker finishing a huge file while the rest idle.
+// The predicted makespan, simulated from the tuned device throughput, is reported next to
+// the actual time.
+
+constexpr std::uint64_t kCopyChunk = 64ull << 20;
+constexpr double kPerFileSecs = 100e-6; // create/open/close overhead assumed per whole file
+
+struct CopyItem {
+    fs::path from, to;
+    std::uint64_t size = 0;
+};
+
+struct CopyTask {
+    std::size_t item;
+    std::uint64_t off, len;
+    bool whole; // copy_file instead of copy_range into a prepared file
+};
+
+struct CopyPlan {
+    std::vector<CopyItem> items;
+    std::vector<CopyTask> tasks;
+    std::uint64_t bytes = 0;
+    std::uint64_t dev = 0;
+    unsigned threads = 1;
+    double predicted = -1; // seconds; negative without throughput history
+    double actual = 0;
+    std::uint64_t flushes = 0;
+    double flush_secs = 0; // summed over workers
+};
+
+// Splits items into tasks, orders them and predicts the makespan.
+void plan_copy(CopyPlan& plan) {
+    plan.tasks.clear();
+    plan.bytes = 0;
+    for (std::size_t i = 0; i < plan.items.size(); ++i) {
+        std::uint64_t size = plan.items[i].size;
+        plan.bytes += size;
+        if (size <= kCopyChunk) {
+            plan.tasks.push_back(CopyTask{i, 0, size, true});
+            continue;
+        }
+        for (std::uint64_t off = 0; off < size; off += kCopyChunk)
+            plan.tasks.push_back(CopyTask{i, off, std::min(kCopyChunk, size - off), false});
+    }
+    std::stable_sort(plan.tasks.begin(), plan.tasks.end(),
+                     [](const CopyTask& a, const CopyTask& b) { return a.len > b.len; });
+    plan.threads = tuner().pick(plan.dev, OpClass::Read);
+    double rate = tuner().rate(plan.dev, OpClass::Read, plan.threads);
+    if (rate <= 0) return;
+    // Greedy list scheduling, as parallel_for hands out tasks: each goes to the worker that
+    // frees up first.
+    unsigned workers = std::max(1u, std::min<unsigned>(plan.threads, static_cast<unsigned>(plan.tasks.size())));
+    double per_worker = rate / workers;
+    std::priority_queue<double, std::vector<double>, std::greater<double>> free_at;
+    for (unsigned t = 0; t < workers; ++t) free_at.push(0);
+    double makespan = 0;
+    for (const auto& t : plan.tasks) {
+        double done = free_at.top() + static_cast<double>(t.len) / per_worker + (t.whole ? kPerFileSecs : 0);
+        free_at.pop();
+        free_at.push(done);
+        makespan = std::max(makespan, done);
+    }
+    double cap = io_scheduler().limits(JobClass::Copy).bytes;
+    if (cap > 0) makespan = std::max(makespan, static_cast<double>(plan.bytes) / cap);
+    plan.predicted = makespan;
+}
+
+// Refuses plans that cannot fit; unknown free space lets the copy proceed.
+bool check_free_space(const CopyPlan& plan, const fs::path& to, std::size_t dirs, ErrorReport& report) {
+    std::uint64_t avail = 0, block = 4096;
+    std::error_code ec;
+    if (!vfs().free_space(to, avail, block, ec)) return true;
+    auto blocks = [&](std::uint64_t n) { return (n + block - 1) / block * block; };
+    std::uint64_t need = dirs * block;
+    for (const auto& it : plan.items) need += blocks(it.size);
+    if (need <= avail) return true;
+    // Overwritten files give their blocks back; only stat them when it matters.
+    for (const auto& it : plan.items) {
+        VfsStat st;
+        std::error_code sec;
+        if (vfs().stat(it.to, true, kWantSize, st, sec) && st.type == kTypeFile)
+            need -= std::min(need, std::min(blocks(st.size), blocks(it.size)));
+    }
+    if (need <= avail) return true;
+    report.add(to, std::make_error_code(std::errc::no_space_on_device));
+    return false;
+}
+
+// Copy durability. none leaves writeback to the kernel; syncfs flushes the destination
+// filesystem once at the end; dir flushes a destination directory's files and then the
+// directory as soon as its last file lands; file fsyncs each file as soon as it is complete
+// and each directory after its last file. Flushes run on the copy workers, overlapping
+// the copies still in flight.
+enum class Durability { None, Syncfs, Dir, File };
+Durability g_durability = Durability::None;
+
+const char* durability_name(Durability d) {
+    switch (d) {
+        case Durability::None: return "none";
+        case Durability::Syncfs: return "syncfs";
+        case Durability::Dir: return "dir";
+        case Durability::File: return "file";
+    }
+    return "none";
+}
+
+bool parse_durability(const std::string& s, Durability& d) {
+    for (Durability m : {Durability::None, Durability::Syncfs, Durability::Dir, Durability::File})
+        if (s == durability_name(m)) { d = m; return true; }
+    return false;
+}
+
+// Counts down the pieces of each file and the files of each destination directory, and
+// issues the flushes the durability mode asks for when a count reaches zero.
+class FlushTracker {
+public:
+    FlushTracker(const CopyPlan& plan, Durability mode, ErrorReport& report)
+        : plan_(plan), mode_(mode), report_(report), pieces_(new std::atomic<std::uint32_t>[plan.items.size()]),
+          failed_(new std::atomic<bool>[plan.items.size()]) {
+        std::map<fs::path, std::size_t> index;
+        group_of_.resize(plan.items.size());
+        for (std::size_t i = 0; i < plan.items.size(); ++i) {
+            pieces_[i] = 0;
+            failed_[i] = false;
+            auto dir = plan.items[i].to.parent_path();
+            auto it = index.emplace(dir, groups_.size()).first;
+            if (it->second == groups_.size()) groups_.push_back(Group{dir, {}});
+            groups_[it->second].items.push_back(i);
+            group_of_[i] = it->second;
+        }
+        for (const auto& t : plan.tasks) ++pieces_[t.item];
+        left_.reset(new std::atomic<std::size_t>[groups_.size()]);
+        for (std::size_t g = 0; g < groups_.size(); ++g) left_[g] = groups_[g].items.size();
+    }
+
+    void fail(std::size_t item) { failed_[item] = true; }
+    bool failed(std::size_t item) const { return failed_[item]; }
+
+    // Called once per finished (or failed) piece.
+    void piece_done(std::size_t item) {
+        if (--pieces_[item] != 0) return;
+        if (mode_ == Durability::File && !failed_[item]) flush(plan_.items[item].to, false);
+        std::size_t g = group_of_[item];
+        if (--left_[g] != 0) return;
+        if (mode_ == Durability::Dir)
+            for (auto i : groups_[g].items)
+                if (!failed_[i]) flush(plan_.items[i].to, false);
+        if (mode_ == Durability::Dir || mode_ == Durability::File) flush(groups_[g].dir, false);
+    }
+
+    // Final step for modes that flush in one batch.
+    void finish(const fs::path& dest) {
+        if (mode_ == Durability::Syncfs && !plan_.items.empty()) flush(dest, true);
+    }
+
+    std::uint64_t flushes() const { return flushes_; }
+    double flush_secs() const { return static_cast<double>(flush_ns_) / 1e9; }
+
+private:
+    struct Group {
+        fs::path dir;
+        std::vector<std::size_t> items;
+    };
+
+    void flush(const fs::path& p, bool whole_fs) {
+        auto t0 = std::chrono::steady_clock::now();
+        std::error_code ec;
+        if (!vfs().sync(p, whole_fs, ec)) report_.add(p, ec);
+        flush_ns_ += static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count());
+        ++flushes_;
+    }
+
+    const CopyPlan& plan_;
+    Durability mode_;
+    ErrorReport& report_;
+    std::unique_ptr<std::atomic<std::uint32_t>[]> pieces_;
+    std::unique_ptr<std::atomic<bool>[]> failed_;
+    std::vector<std::size_t> group_of_;
+    std::vector<Group> groups_;
+    std::unique_ptr<std::atomic<std::size_t>[]> left_;
+    std::atomic<std::uint64_t> flushes_{0}, flush_ns_{0};
+};
+
+void run_copy_plan(CopyPlan& plan, const fs::path& dest, ErrorReport& report) {
+    auto t0 = std::chrono::steady_clock::now();
+    FlushTracker flush(plan, g_durability, report);
+    // Split files get their full-size destination first, so chunks can land in any order.
+    for (std::size_t i = 0; i < plan.items.size(); ++i) {
+        if (plan.items[i].size <= kCopyChunk) continue;
+        std::error_code ec;
+        if (!vfs().prepare_copy(plan.items[i].from, plan.items[i].to, plan.items[i].size, ec)) {
+            flush.fail(i);
+            report.add(plan.items[i].to, ec);
+        }
+    }
+    std::atomic<std::uint64_t> bytes{0};
+    parallel_for(plan.tasks.size(), plan.threads, [&](std::size_t k) {
+        const CopyTask& t = plan.tasks[k];
+        const CopyItem& it = plan.items[t.item];
+        if (!flush.failed(t.item)) {
+            io_scheduler().charge(JobClass::Copy, t.len);
+            std::error_code ec;
+            bool ok = t.whole ? vfs().copy_file(it.from, it.to, ec) : vfs().copy_range(it.from, it.to, t.off, t.len, ec);
+            if (ok) {
+                bytes += t.len;
+            } else {
+                flush.fail(t.item);
+                report.add(it.from, ec);
+            }
+        }
+        flush.piece_done(t.item);
+    });
+    flush.finish(dest);
+    plan.actual = seconds_since(t0);
+    plan.flushes = flush.flushes();
+    plan.flush_secs = flush.flush_secs();
+    if (!io_scheduler().throttled(JobClass::Copy) && g_durability == Durability::None)
+        tuner().record(plan.dev, OpClass::Read, plan.threads, bytes, plan.actual);
+}
+
+void print_copy_plan(const CopyPlan& plan, std::ostream& out) {
+    out << "Plan: " << plan.items.size() << " file(s), " << plan.bytes / (1 << 20) << " MiB, " << plan.tasks.size()
+        << " task(s) on " << plan.threads << " thread(s)\n" << std::fixed << std::setprecision(2);
+    if (plan.predicted >= 0) out << "Predicted " << plan.predicted << " s, actual " << plan.actual << " s\n";
+    else out << "Actual " << plan.actual << " s (no throughput history for a prediction)\n";
+    if (g_durability != Durability::None)
+        out << "Durability " << durability_name(g_durability) << ": " << plan.flushes << " flush(es), "
+            << plan.flush_secs << " s spent flushing\n";
+    out << std::defaultfloat;
+}
+
+// Recursive copy: creates the directory skeleton, sizes the files on the worker threads,
+// then runs the copy plan. On rotational disks the walk runs in inode order and files of
+// equal size are copied in physical block order.
+void copy_tree(const fs::path& from, const fs::path& to, CopyPlan& plan, ErrorReport& report) {
+    bool hdd = hdd_mode_for(from);
+    std::error_code ec;
+    std::vector<std::pair<fs::path, fs::path>> others;
+    std::vector<fs::path> files, dirs;
+    if (!walk_tree(from, hdd, [&](const fs::path& p, const RawDirent& e) {
+            if (e.type == kTypeDir) dirs.push_back(p);
+            else if (e.type == kTypeFile) files.push_back(p);
+            else others.emplace_back(p, to / p.lexically_relative(from));
+        }, report))
+        return;
+    if (hdd) order_by_physical_block(files);
+    plan.dev = device_id(from);
+    plan.items.resize(files.size());
+    std::vector<char> ok(files.size(), 0);
+    unsigned threads = tuner().pick(plan.dev, OpClass::Stat);
+    parallel_for(files.size(), threads, [&](std::size_t i) {
+        VfsStat st;
+        std::error_code sec;
+        if (vfs().stat(files[i], true, kWantSize, st, sec)) ok[i] = 1;
+        else report.add(files[i], sec);
+        plan.items[i] = CopyItem{files[i], to / files[i].lexically_relative(from), st.size};
+    });
+    std::size_t kept = 0;
+    for (std::size_t i = 0; i < files.size(); ++i)
+        if (ok[i]) plan.items[kept++] = std::move(plan.items[i]);
+    plan.items.resize(kept);
+    plan_copy(plan);
+    if (!check_free_space(plan, to, dirs.size() + 1, report)) return;
+    if (!vfs().make_dirs(to, ec)) { report.add(to, ec); return; }
+    for (const auto& d : dirs) {
+        std::error_code dec;
+        fs::path dst = to / d.lexically_relative(from);
+        if (!vfs().make_dirs(dst, dec)) report.add(dst, dec);
+    }
+    run_copy_plan(plan, to, report);
+    // Symlinks and special files are only supported on the real filesystem.
+    for (const auto& o : others) {
+        if (!vfs().real()) { report.add(o.first, std::make_error_code(std::errc::operation_not_supported)); continue; }
+        fs::copy(o.first, o.second, fs::copy_options::recursive | fs::copy_options::overwrite_existing, ec);
+        if (ec) report.add(o.first, ec);
+    }
+}
+
+void copy_path(const fs::path& from, const fs::path& to, std::ostream& out = std::cout, std::ostream& err = std::cerr) {
+    std::error_code ec;
+    VfsStat st;
+    if (!vfs().stat(from, true, kWantSize, st, ec)) { out << "Source does not exist.\n"; return; }
+    if (same_file(from, to)) { out << "Source and destination are the same file.\n"; return; }
+    ErrorReport report;
+    ProgressMeter meter(JobClass::Copy, err);
+    CopyPlan plan;
+    if (st.type == kTypeDir) {
+        copy_tree(from, to, plan, report);
+    } else {
+        plan.dev = device_id(from);
+        plan.items.push_back(CopyItem{from, to, st.size});
+        plan_copy(plan);
+        if (check_free_space(plan, to, 0, report)) run_copy_plan(plan, to, report);
+    }
+    IoScheduler::leave_idle();
+    if (report.total() == 0) out << "Copied to: " << to << "\n";
+    print_copy_plan(plan, out);
+    meter.finish(out);
+    report.print(err, "copy");
+}
+
+void move_path(const fs::path& from, const fs::path& to) {
+    std::error_code ec;
+    if (!vfs().rename(from, to, ec)) { std::cerr << "Error: " << ec.message() << "\n"; return; }
+    std::cout << "Moved/Renamed to: " << to << "\n";
+}
+
+void search_recursive(const fs::path& root, const std::string& needle, std::ostream& out = std::cout,
+                      std::ostream& err = std::cerr) {
+    ErrorReport report;
+    auto dev = device_id(root);
+    unsigned threads = tuner().pick(dev, OpClass::Stat);
+    auto t0 = std::chrono::steady_clock::now();
+    RecordWriter w(out, g_format);
+    auto emit = [&](const fs::path& p, const RawDirent&) {
+        if (g_format == OutputFormat::Text) out << p.string() << "\n";
+        else write_path_record(w, p);
+    };
+    PathIndex idx;
+    std::uint32_t start;
+    if (load_index_for(root, idx, start)) {
+        // Cached listings make the rate meaningless for tuning, so indexed runs are not recorded.
+        walk_with_index(idx, start, root, needle, threads, emit, report);
+        w.flush();
+        report.print(err, "search");
+        return;
+    }
+    auto scanned = walk_tree_parallel(root, threads, hdd_mode_for(root),
+        [&](const fs::path&, const RawDirent& e) { return e.name.find(needle) != std::string::npos; }, emit, report);
+    w.flush();
+    // Rotational walks run on one thread, so they say nothing about the best concurrency.
+    if (!hdd_mode_for(root)) tuner().record(dev, OpClass::Stat, threads, scanned, seconds_since(t0));
+    report.print(err, "search");
+}
+
+// ---------------- Filter search ----------------
+// Query clauses: ext=.log  size=MIN..MAX (K/M/G suffix)  age=MIN..MAX (days)  type=fdl  name=substr
+// Queries built only from ext/size/age/type run through a kernel specialized for that exact
+// combination; anything else falls back to the generic clause interpreter.
+
+enum FilterShape : unsigned { kShapeExt = 1, kShapeSize = 2, kShapeAge = 4, kShapeType = 8, kShapeCount = 16 };
+
+struct FilterQuery {
+    unsigned shape = 0;
+    bool generic = false; // has clauses without a specialized kernel
+    std::string ext;
+    std::uintmax_t size_min = 0, size_max = UINTMAX_MAX;
+    std::int64_t mtime_min = INT64_MIN, mtime_max = INT64_MAX; // ns since the epoch
+    unsigned type_mask = 0;
+    std::string name;
+};
+
+// Extension test on the bare name, following fs::path::extension() rules.
+bool has_extension(const std::string& name, const std::string& ext) {
+    auto dot = name.rfind('.');
+    if (dot == std::string::npos || dot == 0 || name == "..") return ext.empty();
+    return name.compare(dot, std::string::npos, ext) == 0;
+}
+
+bool parse_size(const std::string& s, std::uintmax_t& out) {
+    if (s.empty()) return false;
+    std::uintmax_t mul = 1;
+    std::string digits = s;
+    switch (std::toupper(static_cast<unsigned char>(s.back()))) {
+        case 'K': mul = 1ull << 10; digits.pop_back(); break;
+        case 'M': mul = 1ull << 20; digits.pop_back(); break;
+        case 'G': mul = 1ull << 30; digits.pop_back(); break;
+        default: break;
+    }
+    if (digits.empty() || !std::isdigit(static_cast<unsigned char>(digits[0]))) return false;
+    char* end = nullptr;
+    errno = 0;
+    auto v = std::strtoull(digits.c_str(), &end, 10);
+    if (errno != 0 || *end != '\0') return false;
+    out = static_cast<std::uintmax_t>(v) * mul;
+    return true;
+}
+
+// Splits "A..B" into its two (possibly empty) halves.
+bool split_range(const std::string& v, std::string& lo, std::string& hi) {
+    auto dots = v.find("..");
+    if (dots == std::string::npos) return false;
+    lo = v.substr(0, dots);
+    hi = v.substr(dots + 2);
+    return true;
+}
+
+bool parse_filter_query(const std::string& text, FilterQuery& q, std::ostream& err) {
+    std::istringstream in(text);
+    std::string tok;
+    while (in >> tok) {
+        auto eq = tok.find('=');
+        if (eq == std::string::npos) { err << "Bad clause: " << tok << "\n"; return false; }
+        std::string key = tok.substr(0, eq), val = tok.substr(eq + 1), lo, hi;
+        if (key == "ext") {
+            q.ext = (!val.empty() && val[0] != '.') ? "." + val : val;
+            q.shape |= kShapeExt;
+        } else if (key == "size") {
+            if (!split_range(val, lo, hi) || (!lo.empty() && !parse_size(lo, q.size_min))
+                || (!hi.empty() && !parse_size(hi, q.size_max))) {
+                err << "Bad size range: " << val << "\n"; return false;
+            }
+            q.shape |= kShapeSize;
+        } else if (key == "age") {
+            // Whole days, capped so the offset in nanoseconds stays well inside int64.
+            constexpr std::int64_t kMaxAgeDays = 100000;
+            auto parse_days = [](const std::string& v, std::int64_t& d) {
+                if (v.empty() || v.size() > 6 || !std::all_of(v.begin(), v.end(), ::isdigit)) return false;
+                d = std::stoll(v);
+                return d <= kMaxAgeDays;
+            };
+            std::int64_t dmin = 0, dmax = 0;
+            if (!split_range(val, lo, hi) || (!lo.empty() && !parse_days(lo, dmin))
+                || (!hi.empty() && !parse_days(hi, dmax))) {
+                err << "Bad age range: " << val << " (whole days, at most " << kMaxAgeDays << ")\n"; return false;
+            }
+            using namespace std::chrono;
+            auto now = duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count();
+            auto days_ago = [&](std::int64_t d) { return now - d * 86400 * 1000000000LL; };
+            if (!lo.empty()) q.mtime_max = days_ago(dmin);
+            if (!hi.empty()) q.mtime_min = days_ago(dmax);
+            q.shape |= kShapeAge;
+        } else if (key == "type") {
+            if (val.empty()) { err << "Bad type: empty (use f, d or l)\n"; return false; }
+            for (char c : val) {
+                if (c == 'f') q.type_mask |= kTypeFile;
+                else if (c == 'd') q.type_mask |= kTypeDir;
+                else if (c == 'l') q.type_mask |= kTypeLink;
+                else { err << "Bad type: " << c << "\n"; return false; }
+            }
+            q.shape |= kShapeType;
+        } else if (key == "name") {
+            q.name = val;
+            q.generic = true;
+        } else {
+            err << "Unknown clause: " << key << "\n";
+            return false;
+        }
+    }
+    return q.shape != 0 || q.generic;
+}
+
+// Generic interpreter: one virtual call per clause per entry.
+struct FilterClause {
+    virtual ~FilterClause() = default;
+    virtual bool eval(const fs::path& p, const RawDirent& e) const = 0;
+};
+
+struct ExtClause : FilterClause {
+    std::string ext;
+    explicit ExtClause(std::string x) : ext(std::move(x)) {}
+    bool eval(const fs::path&, const RawDirent& e) const override { return has_extension(e.name, ext); }
+};
+
+struct SizeClause : FilterClause {
+    std::uintmax_t lo, hi;
+    SizeClause(std::uintmax_t l, std::uintmax_t h) : lo(l), hi(h) {}
+    bool eval(const fs::path& p, const RawDirent& e) const override {
+        std::error_code ec;
+        if (e.type == kTypeDir) return false;
+        VfsStat st;
+        return vfs().stat(p, true, kWantSize, st, ec) && st.type == kTypeFile && st.size >= lo && st.size <= hi;
+    }
+};
+
+struct AgeClause : FilterClause {
+    std::int64_t lo, hi;
+    AgeClause(std::int64_t l, std::int64_t h) : lo(l), hi(h) {}
+    bool eval(const fs::path& p, const RawDirent&) const override {
+        std::error_code ec;
+        VfsStat st;
+        return vfs().stat(p, true, kWantMtime, st, ec) && st.mtime_ns >= lo && st.mtime_ns <= hi;
+    }
+};
+
+struct TypeClause : FilterClause {
+    unsigned mask;
+    explicit TypeClause(unsigned m) : mask(m) {}
+    bool eval(const fs::path&, const RawDirent& e) const override { return (e.type & mask) != 0; }
+};
+
+struct NameClause : FilterClause {
+    std::string needle;
+    explicit NameClause(std::string n) : needle(std::move(n)) {}
+    bool eval(const fs::path&, const RawDirent& e) const override {
+        return e.name.find(needle) != std::string::npos;
+    }
+};
+
+std::vector<std::unique_ptr<FilterClause>> build_clauses(const FilterQuery& q) {
+    std::vector<std::unique_ptr<FilterClause>> clauses;
+    if (q.shape & kShapeType) clauses.push_back(std::make_unique<TypeClause>(q.type_mask));
+    if (q.shape & kShapeExt) clauses.push_back(std::make_unique<ExtClause>(q.ext));
+    if (!q.name.empty()) clauses.push_back(std::make_unique<NameClause>(q.name));
+    if (q.shape & kShapeSize) clauses.push_back(std::make_unique<SizeClause>(q.size_min, q.size_max));
+    if (q.shape & kShapeAge) clauses.push_back(std::make_unique<AgeClause>(q.mtime_min, q.mtime_max));
+    return clauses;
+}
+
+// Specialized kernel: the clause set is a template parameter, so unused clauses compile away
+// and only the attributes the query needs are fetched (cheap d_type checks first, stat last).
+template <unsigned Shape>
+bool filter_kernel(const FilterQuery& q, const fs::path& p, const RawDirent& e) {
+    std::error_code ec;
+    if constexpr ((Shape & kShapeType) != 0) {
+        if ((e.type & q.type_mask) == 0) return false;
+    }
+    if constexpr ((Shape & kShapeExt) != 0) {
+        if (!has_extension(e.name, q.ext)) return false;
+    }
+    if constexpr ((Shape & kShapeSize) != 0) {
+        if (e.type == kTypeDir) return false;
+    }
+    if constexpr ((Shape & (kShapeSize | kShapeAge)) != 0) {
+        // One stat serves both clauses.
+        constexpr unsigned want = ((Shape & kShapeSize) ? unsigned(kWantSize) : 0u) | ((Shape & kShapeAge) ? unsigned(kWantMtime) : 0u);
+        VfsStat st;
+        if (!vfs().stat(p, true, want, st, ec)) return false;
+        if ((Shape & kShapeSize) && (st.type != kTypeFile || st.size < q.size_min || st.size > q.size_max)) return false;
+        if ((Shape & kShapeAge) && (st.mtime_ns < q.mtime_min || st.mtime_ns > q.mtime_max)) return false;
+    }
+    return true;
+}
+
+template <class Pred>
+std::size_t filter_walk(const fs::path& root, Pred pred, std::ostream& out, std::ostream& err) {
+    std::size_t hits = 0;
+    ErrorReport report;
+    auto dev = device_id(root);
+    unsigned threads = tuner().pick(dev, OpClass::Stat);
+    auto t0 = std::chrono::steady_clock::now();
+    RecordWriter w(out, g_format);
+    auto scanned = walk_tree_parallel(root, threads, hdd_mode_for(root), pred,
+        [&](const fs::path& p, const RawDirent&) {
+            if (g_format == OutputFormat::Text) out << p.string() << "\n";
+            else write_path_record(w, p);
+            ++hits;
+        }, report);
+    w.flush();
+    // Rotational walks run on one thread, so they say nothing about the best concurrency.
+    if (!hdd_mode_for(root)) tuner().record(dev, OpClass::Stat, threads, scanned, seconds_since(t0));
+    report.print(err, "search");
+    return hits;
+}
+
+template <unsigned Shape>
+std::size_t run_filter_kernel(const fs::path& root, const FilterQuery& q, std::ostream& out, std::ostream& err) {
+    return filter_walk(root, [&q](const fs::path& p, const RawDirent& e) { return filter_kernel<Shape>(q, p, e); }, out, err);
+}
+
+using FilterRunner = std::size_t (*)(const fs::path&, const FilterQuery&, std::ostream&, std::ostream&);
+
+template <std::size_t... Shapes>
+constexpr std::array<FilterRunner, sizeof...(Shapes)> make_filter_kernels(std::index_sequence<Shapes...>) {
+    return {{ &run_filter_kernel<Shapes>... }};
+}
+
+constexpr auto kFilterKernels = make_filter_kernels(std::make_index_sequence<kShapeCount>{});
+
+std::size_t run_filter_generic(const fs::path& root, const FilterQuery& q, std::ostream& out, std::ostream& err) {
+    auto clauses = build_clauses(q);
+    return filter_walk(root, [&clauses](const fs::path& p, const RawDirent& e) {
+        for (const auto& c : clauses)
+            if (!c->eval(p, e)) return false;
+        return true;
+    }, out, err);
+}
+
+void filter_search(const fs::path& root, const std::string& text, std::ostream& out = std::cout,
+                   std::ostream& err = std::cerr) {
+    FilterQuery q;
+    if (!parse_filter_query(text, q, err)) { err << "Invalid query.\n"; return; }
+    std::size_t hits = q.generic ? run_filter_generic(root, q, out, err) : kFilterKernels[q.shape](root, q, out, err);
+    if (g_format == OutputFormat::Text)
+        out << "Matches: " << hits << (q.generic ? " (generic)" : " (specialized)") << "\n";
+}
+
+// `filter-bench [--entries=N] QUERY` times the specialized kernel against the generic
+// interpreter on N synthetic entries (default 10M: a 1M-entry batch evaluated repeatedly),
+// single-threaded, so the predicate cost is measured without the walk or I/O. Only ext and
+// type clauses are accepted: size/age clauses stat every entry, which would dominate both.
+
+template <unsigned Shape>
+std::size_t bench_filter_kernel(const FilterQuery& q, const fs::path& p, const std::vector<RawDirent>& ents) {
+    std::size_t n = 0;
+    for (const auto& e : ents) n += filter_kernel<Shape>(q, p, e);
+    return n;
+}
+
+using FilterBench = std::size_t (*)(const FilterQuery&, const fs::path&, const std::vector<RawDirent>&);
+
+template <std::size_t... Shapes>
+constexpr std::array<FilterBench, sizeof...(Shapes)> make_filter_benches(std::index_sequence<Shapes...>) {
+    return {{ &bench_filter_kernel<Shapes>... }};
+}
+
+bool filter_bench(const std::string& text, std::uint64_t entries, std::ostream& out = std::cout,
+                  std::ostream& err = std::cerr) {
+    FilterQuery q;
+    if (!parse_filter_query(text, q, err)) { err << "Invalid query.\n"; return false; }
+    if (q.generic || (q.shape & (kShapeSize | kShapeAge))) {
+        err << "filter-bench: only ext= and type= clauses can be benchmarked.\n";
+        return false;
+    }
+    static constexpr auto kBenches = make_filter_benches(std::make_index_sequence<kShapeCount>{});
+    static const char* kExts[] = {".log", ".txt", ".cpp", ".h", ".json", ".gz", "", ".tar.gz"};
+    constexpr std::size_t kBatch = 1000000;
+    std::vector<RawDirent> batch(static_cast<std::size_t>(std::min<std::uint64_t>(entries, kBatch)));
+    std::mt19937_64 rng(42);
+    for (std::size_t i = 0; i < batch.size(); ++i) {
+        auto r = rng();
+        batch[i].name = "f" + std::to_string(r % 1000000) + kExts[(r >> 20) % 8];
+        batch[i].ino = i + 1;
+        batch[i].type = (r >> 24) % 10 == 0 ? kTypeDir : ((r >> 24) % 10 == 1 ? kTypeLink : kTypeFile);
+    }
+    const fs::path dummy("/bench");
+    auto clauses = build_clauses(q);
+    std::size_t passes = static_cast<std::size_t>((entries + batch.size() - 1) / std::max<std::size_t>(batch.size(), 1));
+    auto time_it = [&](auto&& run, std::size_t& matches) {
+        matches = 0;
+        auto t0 = std::chrono::steady_clock::now();
+        for (std::size_t k = 0; k < passes; ++k) matches += run();
+        return seconds_since(t0);
+    };
+    std::size_t spec_hits = 0, gen_hits = 0;
+    double spec = time_it([&] { return kBenches[q.shape](q, dummy, batch); }, spec_hits);
+    double gen = time_it([&] {
+        std::size_t n = 0;
+        for (const auto& e : batch) {
+            bool ok = true;
+            for (const auto& c : clauses)
+                if (!(ok = c->eval(dummy, e))) break;
+            n += ok;
+        }
+        return n;
+    }, gen_hits);
+    double total = static_cast<double>(passes * batch.size());
+    out << "Entries: " << passes * batch.size() << " (" << batch.size() << " synthetic, " << passes << " pass(es))\n"
+        << std::fixed << std::setprecision(3)
+        << "specialized: " << spec << " s, " << total / spec / 1e6 << " M entries/s, " << spec_hits << " matches\n"
+        << "generic:     " << gen << " s, " << total / gen / 1e6 << " M entries/s, " << gen_hits << " matches\n"
+        << std::setprecision(2) << "speedup:     " << gen / spec << "x\n" << std::defaultfloat;
+    if (spec_hits != gen_hits) { err << "filter-bench: match counts differ\n"; return false; }
+    return true;
+}
+
+// `error-bench [--entries=N] [--rate=R] [--threads=N]` measures what error handling costs on
+// a tree where a fraction R (default 0.3) of entries cannot be read. N files are created in
+// an in-memory tree behind a FaultyVfs that fails stat with EACCES at rate R; every entry is
+// then stat-ed twice on the worker threads: once reporting failures through error_code into
+// an ErrorReport (the explorer's path), and once throwing and catching fs::filesystem_error
+// per failure, as the per-entry try/catch code it replaced did.
+bool error_bench(std::size_t entries, double rate, unsigned threads, std::ostream& out = std::cout,
+                 std::ostream& err = std::cerr) {
+    constexpr std::size_t kPerDir = 100;
+    auto mem = std::make_unique<MemVfs>();
+    std::vector<fs::path> paths;
+    paths.reserve(entries);
+    std::error_code ec;
+    for (std::size_t i = 0; i < entries; ++i) {
+        fs::path dir = fs::path("/bench") / ("d" + std::to_string(i / kPerDir));
+        if (i % kPerDir == 0 && !mem->make_dirs(dir, ec)) { err << "error-bench: " << ec.message() << "\n"; return false; }
+        paths.push_back(dir / ("f" + std::to_string(i % kPerDir)));
+        if (!mem->create_file(paths.back(), ec)) { err << "error-bench: " << ec.message() << "\n"; return false; }
+    }
+    FaultyVfs faulty(std::move(mem), std::chrono::microseconds(0), rate, EACCES);
+    auto pass = [&](bool exceptions, ErrorReport& report) {
+        auto t0 = std::chrono::steady_clock::now();
+        parallel_for(paths.size(), threads, [&](std::size_t i) {
+            VfsStat st;
+            std::error_code sec;
+            if (!exceptions) {
+                if (!faulty.stat(paths[i], true, kWantSize, st, sec)) report.add(paths[i], sec);
+                return;
+            }
+            try {
+                if (!faulty.stat(paths[i], true, kWantSize, st, sec)) throw fs::filesystem_error("stat", paths[i], sec);
+            } catch (const fs::filesystem_error& e) {
+                report.add(e.path1(), e.code());
+            }
+        });
+        return seconds_since(t0);
+    };
+    ErrorReport codes, thrown;
+    double a = pass(false, codes), b = pass(true, thrown);
+    auto rate_of = [&](double secs) { return static_cast<double>(entries) / secs / 1e6; };
+    out << "Entries: " << entries << ", failing: " << rate * 100 << "% (EACCES), threads: " << threads << "\n"
+        << std::fixed << std::setprecision(3)
+        << "error_code: " << a << " s, " << rate_of(a) << " M entries/s, " << codes.total() << " errors\n"
+        << "exceptions: " << b << " s, " << rate_of(b) << " M entries/s, " << thrown.total() << " errors\n"
+        << std::setprecision(2) << "speedup:    " << b / a << "x\n" << std::defaultfloat;
+    return true;
+}
+
+// `copy-bench [--files=N] [--size=BYTES] [DIR]` measures copy throughput under each
+// --durability mode. N files (default 2000 of 4 KiB, 100 per directory) are written under a
+// scratch directory in DIR (default: the temp directory, or / with --vfs=mem), then the tree
+// is copied once per mode and each copy is deleted again. With
+// --vfs=mem,latency=USEC every call, flushes included, costs USEC, so the modes can be
+// compared without a real disk.
+bool copy_bench(std::size_t files, std::uint64_t size, const fs::path& dir, std::ostream& out = std::cout,
+                std::ostream& err = std::cerr) {
+    constexpr std::size_t kPerDir = 100;
+    fs::path root = dir / ("copy-bench-" + std::to_string(now_unix_ns()));
+    fs::path src = root / "src";
+    std::error_code ec;
+    std::string data(size, 'x');
+    for (std::size_t i = 0; i < files; ++i) {
+        fs::path d = src / ("d" + std::to_string(i / kPerDir));
+        if (i % kPerDir == 0 && !vfs().make_dirs(d, ec)) { err << "copy-bench: " << ec.message() << "\n"; return false; }
+        fs::path f = d / ("f" + std::to_string(i % kPerDir));
+        std::unique_ptr<VfsReplaceFile> w;
+        if (!vfs().create_file(f, ec) || !(w = vfs().open_replace(f, ec)) || !w->write(data.data(), data.size(), ec)
+            || !w->commit(false, ec)) {
+            err << "copy-bench: " << f.string() << ": " << ec.message() << "\n";
+            return false;
+        }
+    }
+    Durability saved = g_durability;
+    out << "Files: " << files << " x " << size << " bytes under " << root.string() << "\n"
+        << std::fixed << std::setprecision(3);
+    bool ok = true;
+    for (Durability m : {Durability::None, Durability::Syncfs, Durability::Dir, Durability::File}) {
+        g_durability = m;
+        ErrorReport report;
+        CopyPlan plan;
+        fs::path dst = root / (std::string("dst-") + durability_name(m));
+        copy_tree(src, dst, plan, report);
+        out << std::left << std::setw(7) << durability_name(m) << std::right << plan.actual << " s, "
+            << std::setprecision(0) << static_cast<double>(plan.items.size()) / plan.actual << " files/s, "
+            << std::setprecision(3) << plan.flushes << " flush(es), " << plan.flush_secs << " s flushing\n";
+        if (report.total() > 0) { report.print(err, "copy-bench"); ok = false; }
+        ErrorReport cleanup;
+        remove_tree(dst, cleanup);
+    }
+    out << std::defaultfloat;
+    g_durability = saved;
+    ErrorReport cleanup;
+    remove_tree(root, cleanup);
+    cleanup.print(err, "copy-bench cleanup");
+    return ok;
+}
+
+// Prints one entry with every metadata column (list_dir-style row or a record).
+void stat_path(const fs::path& p, std::ostream& out = std::cout, std::ostream& err = std::cerr) {
+    const unsigned cols = kColType | kColPerms | kColSize | kColMtime | kColInode | kColOwner;
+    RawDirent e;
+    e.name = p.filename().string();
+    std::error_code ec;
+    VfsStat lst;
+    if (vfs().stat(p, false, 0, lst, ec)) {
+        e.type = lst.type;
+        e.ino = lst.ino;
+    } else {
+        e.type = kTypeOther;
+        ec.clear();
+    }
+    auto row = stat_entry(p, e.type, cols, ec);
+    if (ec) { err << "Error: " << ec.message() << "\n"; return; }
+    if (g_format == OutputFormat::Text) {
+        print_listing_header(out, cols);
+        print_listing_row(out, cols, e, row);
+    } else {
+        RecordWriter w(out, g_format);
+        write_listing_record(w, cols, p.parent_path().native(), e, row);
+    }
+}
+
+// ---------------- Page cache ----------------
+// vmtouch-style tools: `cache` reports how much of a file or tree is resident (mmap + mincore),
+// `warm` pulls files in with readahead on the worker threads, optionally capped in bytes/s so
+// it does not starve other I/O, and `evict` drops clean pages with POSIX_FADV_DONTNEED.
+
+enum class CacheOp { Report, Warm, Evict };
+
+// Regular files at or under `p` (symlinks are not followed).
+std::vector<fs::path> collect_files(const fs::path& p, ErrorReport& report) {
+    std::vector<fs::path> files;
+    std::error_code ec;
+    VfsStat st;
+    if (!vfs().stat(p, false, 0, st, ec)) { report.add(p, ec); return files; }
+    if (st.type == kTypeFile) {
+        files.push_back(p);
+    } else if (st.type == kTypeDir) {
+        walk_tree(p, hdd_mode_for(p), [&](const fs::path& f, const RawDirent& e) {
+            if (e.type == kTypeFile) files.push_back(f);
+        }, report);
+    }
+    return files;
+}
+
+// Issues readahead for a whole file in kWarmChunk pieces, each charged to the warm class.
+std::uint64_t warm_file(const fs::path& p, std::error_code& ec) {
+    constexpr std::uint64_t kWarmChunk = 4ull << 20;
+#ifdef _WIN32
+    (void)p;
+    ec = std::make_error_code(std::errc::operation_not_supported);
+    return 0;
+#else
+    int fd = ::open(p.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) { set_errno(ec, errno); return 0; }
+    struct stat st;
+    if (::fstat(fd, &st) != 0) { set_errno(ec, errno); ::close(fd); return 0; }
+    const std::uint64_t size = static_cast<std::uint64_t>(st.st_size);
+    std::uint64_t done = 0;
+    for (; done < size; done += kWarmChunk) {
+        std::uint64_t len = std::min(kWarmChunk, size - done);
+        io_scheduler().charge(JobClass::Warm, len);
+#if defined(__linux__)
+        if (::readahead(fd, static_cast<off64_t>(done), len) != 0) { set_errno(ec, errno); break; }
+#elif defined(POSIX_FADV_WILLNEED)
+        if (int rc = ::posix_fadvise(fd, static_cast<off_t>(done), static_cast<off_t>(len), POSIX_FADV_WILLNEED)) {
+            set_errno(ec, rc);
+            break;
+        }
+#else
+        // No readahead hint: touch one byte per page through a mapping.
+        void* m = ::mmap(nullptr, len, PROT_READ, MAP_SHARED, fd, static_cast<off_t>(done));
+        if (m == MAP_FAILED) { set_errno(ec, errno); break; }
+        const std::size_t page = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+        volatile unsigned char sink = 0;
+        for (std::size_t i = 0; i < len; i += page) sink ^= static_cast<const unsigned char*>(m)[i];
+        ::munmap(m, len);
+#endif
+    }
+    ::close(fd);
+    return std::min(done, size);
+#endif
+}
+
+std::uint64_t evict_file(const fs::path& p, std::error_code& ec) {
+#if !defined(_WIN32) && defined(POSIX_FADV_DONTNEED)
+    int fd = ::open(p.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) { set_errno(ec, errno); return 0; }
+    struct stat st;
+    std::uint64_t size = ::fstat(fd, &st) == 0 ? static_cast<std::uint64_t>(st.st_size) : 0;
+    if (int rc = ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED)) { set_errno(ec, rc); size = 0; }
+    ::close(fd);
+    return size;
+#else
+    (void)p;
+    ec = std::make_error_code(std::errc::operation_not_supported);
+    return 0;
+#endif
+}
+
+// Reports residency per file (`verbose` or a single file) and for the whole target.
+void cache_report(const fs::path& p, bool verbose, std::ostream& out, std::ostream& err) {
+    ErrorReport report;
+    auto files = collect_files(p, report);
+    struct Residency { std::uint64_t resident = 0, total = 0; bool ok = false; };
+    std::vector<Residency> res(files.size());
+    auto dev = device_id(p);
+    unsigned threads = tuner().pick(dev, OpClass::Stat);
+    auto t0 = std::chrono::steady_clock::now();
+    parallel_for(files.size(), threads, [&](std::size_t i) {
+        std::error_code ec;
+        res[i].ok = page_cache_residency(files[i], res[i].resident, res[i].total, ec);
+        if (ec) report.add(files[i], ec);
+    });
+    tuner().record(dev, OpClass::Stat, threads, files.size(), seconds_since(t0));
+    auto pct = [](std::uint64_t r, std::uint64_t t) { return t ? static_cast<unsigned>(r * 100 / t) : 100u; };
+    std::uint64_t resident = 0, total = 0;
+    RecordWriter w(out, g_format);
+    bool per_file = verbose || files.size() == 1;
+    for (std::size_t i = 0; i < files.size(); ++i) {
+        if (!res[i].ok) continue;
+        resident += res[i].resident;
+        total += res[i].total;
+        if (!per_file) continue;
+        if (g_format == OutputFormat::Text) {
+            out << std::right << std::setw(4) << pct(res[i].resident, res[i].total) << "%  "
+                << std::setw(10) << res[i].resident << "/" << std::left << std::setw(10) << res[i].total
+                << " " << files[i].string() << "\n";
+        } else {
+            w.begin();
+            w.str(kFieldPath, "path", files[i].native());
+            w.num(kFieldPages, "pages", res[i].total);
+            w.num(kFieldResident, "resident", res[i].resident);
+            w.end();
+        }
+    }
+    w.flush();
+    if (g_format == OutputFormat::Text) {
+#ifdef _WIN32
+        const std::uint64_t page = 4096;
+#else
+        const auto page = static_cast<std::uint64_t>(::sysconf(_SC_PAGESIZE));
+#endif
+        out << "Files: " << files.size() << "  Resident pages: " << resident << "/" << total
+            << " (" << pct(resident, total) << "%, " << resident * page / (1 << 20) << " MiB)\n";
+    }
+    report.print(err, "cache");
+}
+
+// Warms or evicts every file under `p`. A nonzero `rate` sets the warm class's bytes/s cap.
+void cache_apply(const fs::path& p, CacheOp op, double rate, std::ostream& out, std::ostream& err) {
+    ErrorReport report;
+    auto files = collect_files(p, report);
+    if (hdd_mode_for(p)) order_by_physical_block(files);
+    if (rate > 0) {
+        auto l = io_scheduler().limits(JobClass::Warm);
+        l.bytes = rate;
+        io_scheduler().set_limits(JobClass::Warm, l);
+    }
+    auto dev = device_id(p);
+    unsigned threads = tuner().pick(dev, OpClass::Read);
+    std::atomic<std::uint64_t> bytes{0};
+    auto t0 = std::chrono::steady_clock::now();
+    parallel_for(files.size(), threads, [&](std::size_t i) {
+        std::error_code ec;
+        bytes += op == CacheOp::Warm ? warm_file(files[i], ec) : evict_file(files[i], ec);
+        if (ec) report.add(files[i], ec);
+    });
+    IoScheduler::leave_idle();
+    double secs = seconds_since(t0);
+    if (op == CacheOp::Warm && !io_scheduler().throttled(JobClass::Warm)) tuner().record(dev, OpClass::Read, threads, bytes, secs);
+    out << (op == CacheOp::Warm ? "Warmed " : "Evicted ") << files.size() << " file(s), "
+        << bytes / (1 << 20) << " MiB in " << std::fixed << std::setprecision(2) << secs << " s";
+    if (op == CacheOp::Warm && secs > 0) out << " (" << bytes / secs / (1 << 20) << " MiB/s)";
+    out << std::defaultfloat << "\n";
+    report.print(err, op == CacheOp::Warm ? "warm" : "evict");
+}
+
+// Front door for the `cache`, `warm` and `evict` commands.
+void page_cache_command(const fs::path& p, CacheOp op, bool verbose, double rate, std::ostream& out = std::cout,
+                        std::ostream& err = std::cerr) {
+    if (!vfs().real()) { err << "Page-cache commands need the real filesystem (--vfs=posix).\n"; return; }
+    if (op == CacheOp::Report) cache_report(p, verbose, out, err);
+    else cache_apply(p, op, rate, out, err);
+}
+
+// ---------------- SIMD text kernels ----------------
+// Byte-scanning loops used by count and the content commands. Each kernel has a portable
+// scalar version and, on x86 with GCC/Clang, an AVX2 version chosen at run time.
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FE_HAVE_AVX2 1
+#endif
+
+bool cpu_has_avx2() {
+#ifdef FE_HAVE_AVX2
+    static const bool has = __builtin_cpu_supports("avx2");
+    return has;
+#else
+    return false;
+#endif
+}
+
+struct TextCounts {
+    std::uint64_t lines = 0, words = 0, bytes = 0;
+
+    TextCounts& operator+=(const TextCounts& o) {
+        lines += o.lines;
+        words += o.words;
+        bytes += o.bytes;
+        return *this;
+    }
+};
+
+// C-locale wc rules: space and \t..\r end a word, printable bytes start or continue one,
+// and any other byte (controls, non-ASCII) leaves the state unchanged.
+inline bool is_text_space(unsigned char c) { return c == ' ' || (c >= '\t' && c <= '\r'); }
+inline bool is_text_graph(unsigned char c) { return c > ' ' && c < 0x7f; }
+
+// Counts newlines and word starts in one block. `in_word` carries across blocks.
+void count_text_scalar(const unsigned char* p, std::size_t n, TextCounts& c, bool& in_word) {
+    for (std::size_t i = 0; i < n; ++i) {
+        c.lines += p[i] == '\n';
+        if (is_text_space(p[i])) {
+            in_word = false;
+        } else if (is_text_graph(p[i])) {
+            c.words += !in_word;
+            in_word = true;
+        }
+    }
+    c.bytes += n;
+}
+
+#ifdef FE_HAVE_AVX2
+__attribute__((target("avx2"))) void count_text_avx2(const unsigned char* p, std::size_t n, TextCounts& c,
+                                                    bool& in_word) {
+    const __m256i nl = _mm256_set1_epi8('\n'), sp = _mm256_set1_epi8(' ');
+    const __m256i tab = _mm256_set1_epi8('\t'), ctl_span = _mm256_set1_epi8('\r' - '\t');
+    const __m256i bang = _mm256_set1_epi8('!'), graph_span = _mm256_set1_epi8('~' - '!');
+    std::size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+        // lo <= v <= lo + span (unsigned) is min(v - lo, span) == v - lo.
+        __m256i x = _mm256_sub_epi8(v, tab);
+        __m256i ctl = _mm256_cmpeq_epi8(_mm256_min_epu8(x, ctl_span), x);
+        __m256i g = _mm256_sub_epi8(v, bang);
+        auto graph = static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_min_epu8(g, graph_span), g)));
+        auto space = static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, sp), ctl)));
+        if ((space | graph) != 0xffffffffu) {
+            // Bytes that neither start nor end a word carry state across; rare in text.
+            count_text_scalar(p + i, 32, c, in_word);
+            continue;
+        }
+        auto lines = static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl)));
+        std::uint32_t starts = graph & ((space << 1) | (in_word ? 0u : 1u));
+        c.lines += static_cast<std::uint64_t>(__builtin_popcount(lines));
+        c.words += static_cast<std::uint64_t>(__builtin_popcount(starts));
+        c.bytes += 32;
+        in_word = (graph >> 31) != 0;
+    }
+    count_text_scalar(p + i, n - i, c, in_word);
+}
+#endif
+
+using CountTextFn = void (*)(const unsigned char*, std::size_t, TextCounts&, bool&);
+
+CountTextFn count_text_kernel() {
+#ifdef FE_HAVE_AVX2
+    if (cpu_has_avx2()) return count_text_avx2;
+#endif
+    return count_text_scalar;
+}
+
+// First occurrence of needle[0..m) in hay[0..n), or SIZE_MAX.
+std::size_t find_bytes_scalar(const unsigned char* hay, std::size_t n, const unsigned char* needle, std::size_t m) {
+    auto pos = std::string_view(reinterpret_cast<const char*>(hay), n)
+                   .find(std::string_view(reinterpret_cast<const char*>(needle), m));
+    return pos == std::string_view::npos ? SIZE_MAX : pos;
+}
+
+#ifdef FE_HAVE_AVX2
+// Compares the needle's first and last byte against 32 candidate positions at once and
+// verifies only positions where both match.
+__attribute__((target("avx2"))) std::size_t find_bytes_avx2(const unsigned char* hay, std::size_t n,
+                                                           const unsigned char* needle, std::size_t m) {
+    if (m == 0) return 0;
+    if (m > n) return SIZE_MAX;
+    const __m256i first = _mm256_set1_epi8(static_cast<char>(needle[0]));
+    const __m256i last = _mm256_set1_epi8(static_cast<char>(needle[m - 1]));
+    std::size_t i = 0;
+    for (; i + m - 1 + 32 <= n; i += 32) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(hay + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(hay + i + m - 1));
+        auto mask = static_cast<std::uint32_t>(
+            _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last))));
+        while (mask) {
+            unsigned bit = static_cast<unsigned>(__builtin_ctz(mask));
+            if (m <= 2 || std::memcmp(hay + i + bit + 1, needle + 1, m - 2) == 0) return i + bit;
+            mask &= mask - 1;
+        }
+    }
+    std::size_t rest = find_bytes_scalar(hay + i, n - i, needle, m);
+    return rest == SIZE_MAX ? SIZE_MAX : i + rest;
+}
+#endif
+
+using FindBytesFn = std::size_t (*)(const unsigned char*, std::size_t, const unsigned char*, std::size_t);
+
+FindBytesFn find_bytes_kernel() {
+#ifdef FE_HAVE_AVX2
+    if (cpu_has_avx2()) return find_bytes_avx2;
+#endif
+    return find_bytes_scalar;
+}
+
+// Last occurrence of byte `c` in p[0..n), or SIZE_MAX.
+std::size_t rfind_byte_scalar(const unsigned char* p, std::size_t n, unsigned char c) {
+    while (n > 0)
+        if (p[--n] == c) return n;
+    return SIZE_MAX;
+}
+
+#ifdef FE_HAVE_AVX2
+// Walks backwards 32 bytes at a time; the highest set mask bit is the last match.
+__attribute__((target("avx2"))) std::size_t rfind_byte_avx2(const unsigned char* p, std::size_t n, unsigned char c) {
+    const __m256i v = _mm256_set1_epi8(static_cast<char>(c));
+    while (n >= 32) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + n - 32));
+        auto mask = static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, v)));
+        if (mask) return n - 32 + static_cast<std::size_t>(31 - __builtin_clz(mask));
+        n -= 32;
+    }
+    return rfind_byte_scalar(p, n, c);
+}
+#endif
+
+using RfindByteFn = std::size_t (*)(const unsigned char*, std::size_t, unsigned char);
+
+RfindByteFn rfind_byte_kernel() {
+#ifdef FE_HAVE_AVX2
+    if (cpu_has_avx2()) return rfind_byte_avx2;
+#endif
+    return rfind_byte_scalar;
+}
+
+// hexdump -C rows: "OFFSET  hh hh hh hh hh hh hh hh  hh hh hh hh hh hh hh hh  |ascii...|".
+constexpr std::size_t kHexRowBytes = 16;
+
+void format_hex_row(const unsigned char* p, std::size_t n, std::uint64_t off, std::string& out) {
+    static const char digits[] = "0123456789abcdef";
+    char line[96];
+    int len = std::snprintf(line, sizeof line, "%08llx  ", static_cast<unsigned long long>(off));
+    out.append(line, static_cast<std::size_t>(len));
+    for (std::size_t i = 0; i < kHexRowBytes; ++i) {
+        if (i < n) {
+            out += digits[p[i] >> 4];
+            out += digits[p[i] & 15];
+            out += ' ';
+        } else {
+            out += "   ";
+        }
+        if (i == 7) out += ' ';
+    }
+    out += " |";
+    for (std::size_t i = 0; i < n; ++i) out += p[i] >= 0x20 && p[i] < 0x7f ? static_cast<char>(p[i]) : '.';
+    out += "|\n";
+}
+
+// Appends rows for p[0..n), whose first byte is at file offset `off`.
+void format_hex_scalar(const unsigned char* p, std::size_t n, std::uint64_t off, std::string& out) {
+    for (std::size_t i = 0; i < n; i += kHexRowBytes)
+        format_hex_row(p + i, std::min(kHexRowBytes, n - i), off + i, out);
+}
+
+#ifdef FE_HAVE_AVX2
+// Full rows are built with byte shuffles: nibbles index a digit table, the two digit
+// vectors are interleaved, and a second shuffle spreads each half-row's 16 digits over 24
+// columns with the separating spaces OR'ed in. ASCII is a range compare and a blend.
+__attribute__((target("avx2"))) void format_hex_avx2(const unsigned char* p, std::size_t n, std::uint64_t off,
+                                                    std::string& out) {
+    const __m128i digits = _mm_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+    const __m128i low4 = _mm_set1_epi8(0x0f);
+    const char z = static_cast<char>(0x80); // shuffle index that yields 0
+    const __m128i spread0 = _mm_setr_epi8(0, 1, z, 2, 3, z, 4, 5, z, 6, 7, z, 8, 9, z, 10);
+    const __m128i spread1 = _mm_setr_epi8(11, z, 12, 13, z, 14, 15, z, z, z, z, z, z, z, z, z);
+    const __m128i gaps0 = _mm_setr_epi8(0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0);
+    const __m128i gaps1 = _mm_setr_epi8(0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i space = _mm_set1_epi8(' '), span = _mm_set1_epi8(0x7e - 0x20), dot = _mm_set1_epi8('.');
+    std::size_t full = n / kHexRowBytes * kHexRowBytes;
+    char line[128];
+    for (std::size_t i = 0; i < full; i += kHexRowBytes) {
+        int pos = std::snprintf(line, sizeof line, "%08llx  ", static_cast<unsigned long long>(off + i));
+        char* h = line + pos;
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        __m128i hi = _mm_shuffle_epi8(digits, _mm_and_si128(_mm_srli_epi16(v, 4), low4));
+        __m128i lo = _mm_shuffle_epi8(digits, _mm_and_si128(v, low4));
+        __m128i a = _mm_unpacklo_epi8(hi, lo), b = _mm_unpackhi_epi8(hi, lo);
+        // Stores overlap: each later store overwrites the previous one's unused tail.
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(h), _mm_or_si128(_mm_shuffle_epi8(a, spread0), gaps0));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(h + 16), _mm_or_si128(_mm_shuffle_epi8(a, spread1), gaps1));
+        h[24] = ' ';
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(h + 25), _mm_or_si128(_mm_shuffle_epi8(b, spread0), gaps0));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(h + 41), _mm_or_si128(_mm_shuffle_epi8(b, spread1), gaps1));
+        h[49] = ' ';
+        h[50] = '|';
+        __m128i x = _mm_sub_epi8(v, space);
+        __m128i printable = _mm_cmpeq_epi8(_mm_min_epu8(x, span), x);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(h + 51), _mm_blendv_epi8(dot, v, printable));
+        h[67] = '|';
+        h[68] = '\n';
+        out.append(line, static_cast<std::size_t>(h + 69 - line));
+    }
+    if (full < n) format_hex_row(p + full, n - full, off + full, out);
+}
+#endif
+
+using FormatHexFn = void (*)(const unsigned char*, std::size_t, std::uint64_t, std::string&);
+
+FormatHexFn format_hex_kernel() {
+#ifdef FE_HAVE_AVX2
+    if (cpu_has_avx2()) return format_hex_avx2;
+#endif
+    return format_hex_scalar;
+}
+
+// ---------------- Count ----------------
+// `count ROOT` totals lines, words and bytes (wc semantics) per extension across a tree. The
+// walk runs level-parallel, files are counted concurrently in kCountBlock preads each.
+
+constexpr std::size_t kCountBlock = 1 << 20;
+
+bool count_file(const fs::path& p, TextCounts& c, std::error_code& ec) {
+    auto f = vfs().open_read(p, ec);
+    if (!f) return false;
+    static const CountTextFn kernel = count_text_kernel();
+    std::vector<unsigned char> buf(static_cast<std::size_t>(std::min<std::uint64_t>(kCountBlock, f->size() + 1)));
+    bool in_word = false;
+    for (std::uint64_t off = 0;;) {
+        long long n = f->read_at(buf.data(), buf.size(), off, ec);
+        if (n < 0) return false;
+        if (n == 0) break;
+        kernel(buf.data(), static_cast<std::size_t>(n), c, in_word);
+        off += static_cast<std::uint64_t>(n);
+    }
+    return true;
+}
+
+void count_tree(const fs::path& root, bool verbose, std::ostream& out = std::cout, std::ostream& err = std::cerr) {
+    ErrorReport report;
+    std::vector<fs::path> files;
+    std::error_code ec;
+    VfsStat st;
+    if (!vfs().stat(root, true, 0, st, ec)) {
+        report.add(root, ec);
+    } else if (st.type == kTypeDir) {
+        auto dev = device_id(root);
+        walk_tree_parallel(root, tuner().pick(dev, OpClass::Stat), hdd_mode_for(root),
+            [](const fs::path&, const RawDirent& e) { return e.type == kTypeFile; },
+            [&](const fs::path& p, const RawDirent&) { files.push_back(p); }, report);
+    } else {
+        files.push_back(root);
+    }
+    if (hdd_mode_for(root)) order_by_physical_block(files);
+    std::vector<TextCounts> counts(files.size());
+    std::vector<char> ok(files.size(), 0);
+    auto dev = device_id(root);
+    unsigned threads = tuner().pick(dev, OpClass::Read);
+    auto t0 = std::chrono::steady_clock::now();
+    parallel_for(files.size(), threads, [&](std::size_t i) {
+        std::error_code fec;
+        if (count_file(files[i], counts[i], fec)) ok[i] = 1;
+        else report.add(files[i], fec);
+    });
+    double secs = seconds_since(t0);
+    std::map<std::string, std::pair<std::size_t, TextCounts>> by_ext;
+    TextCounts total;
+    std::size_t counted = 0;
+    RecordWriter w(out, g_format);
+    auto emit = [&](const std::string& label, std::size_t n, const TextCounts& c, bool is_path) {
+        if (g_format == OutputFormat::Text) {
+            out << std::right << std::setw(12) << c.lines << std::setw(12) << c.words << std::setw(14) << c.bytes
+                << "  " << std::left;
+            if (!is_path) out << std::setw(8) << n;
+            out << label << "\n";
+            return;
+        }
+        w.begin();
+        w.str(is_path ? kFieldPath : kFieldExt, is_path ? "path" : "ext", label);
+        if (!is_path) w.num(kFieldFiles, "files", n);
+        w.num(kFieldLines, "lines", c.lines);
+        w.num(kFieldWords, "words", c.words);
+        w.num(kFieldSize, "bytes", c.bytes);
+        w.end();
+    };
+    for (std::size_t i = 0; i < files.size(); ++i) {
+        if (!ok[i]) continue;
+        if (verbose) emit(files[i].string(), 1, counts[i], true);
+        auto ext = files[i].extension().string();
+        auto& e = by_ext[ext.empty() ? "(none)" : ext];
+        ++e.first;
+        e.second += counts[i];
+        total += counts[i];
+        ++counted;
+    }
+    if (g_format == OutputFormat::Text)
+        out << std::right << std::setw(12) << "LINES" << std::setw(12) << "WORDS" << std::setw(14) << "BYTES"
+            << "  " << std::left << std::setw(8) << "FILES" << "EXT\n";
+    for (const auto& kv : by_ext) emit(kv.first, kv.second.first, kv.second.second, false);
+    emit("total", counted, total, false);
+    w.flush();
+    if (g_format == OutputFormat::Text && secs > 0)
+        out << std::fixed << std::setprecision(2) << secs << " s, "
+            << static_cast<double>(total.bytes) / secs / (1 << 20) << " MiB/s ("
+            << (cpu_has_avx2() ? "avx2" : "scalar") << ")\n" << std::defaultfloat;
+    tuner().record(dev, OpClass::Read, threads, total.bytes, secs);
+    report.print(err, "count");
+}
+
+// ---------------- Search and replace ----------------
+// `replace ROOT OLD NEW` rewrites every regular file containing OLD. A pre-scan on the
+// worker threads counts matches with the SIMD search kernel; only matching files are then
+// streamed into a temporary in their own directory and renamed over the original, keeping
+// permissions, owner and xattrs. Matches are non-overlapping, left to right. --dry-run
+// stops after the pre-scan.
+
+constexpr std::size_t kReplaceBlock = 1 << 20;
+
+// Streams `f` once, counting matches of `from` and, when `out` is set, writing the file
+// with each match replaced by `to`. Returns the match count, or -1 on error.
+long long stream_replace(VfsFile& f, const std::string& from, const std::string& to, VfsReplaceFile* out,
+                         std::error_code& ec) {
+    static const FindBytesFn find = find_bytes_kernel();
+    const auto* needle = reinterpret_cast<const unsigned char*>(from.data());
+    const std::size_t m = from.size();
+    std::vector<unsigned char> buf;
+    long long matches = 0;
+    std::uint64_t off = 0;
+    for (bool eof = false; !eof;) {
+        // Keep the last m-1 bytes of the previous block so matches across blocks are found.
+        std::size_t keep = buf.size();
+        buf.resize(keep + kReplaceBlock);
+        long long n = f.read_at(buf.data() + keep, kReplaceBlock, off, ec);
+        if (n < 0) return -1;
+        buf.resize(keep + static_cast<std::size_t>(n));
+        off += static_cast<std::uint64_t>(n);
+        eof = n == 0;
+        // Matches must start before `limit`; later ones may still grow into the next block.
+        std::size_t limit = eof ? buf.size() : (buf.size() >= m - 1 ? buf.size() - (m - 1) : 0);
+        std::size_t pos = 0;
+        for (;;) {
+            std::size_t hit = find(buf.data() + pos, buf.size() - pos, needle, m);
+            if (hit == SIZE_MAX || pos + hit >= limit) break;
+            ++matches;
+            if (out && (!out->write(buf.data() + pos, hit, ec) || !out->write(to.data(), to.size(), ec))) return -1;
+            pos += hit + m;
+        }
+        std::size_t emit = std::max(pos, limit);
+        if (out && emit > pos && !out->write(buf.data() + pos, emit - pos, ec)) return -1;
+        buf.erase(buf.begin(), buf.begin() + static_cast<std::ptrdiff_t>(emit));
+    }
+    return matches;
+}
+
+void replace_in_tree(const fs::path& root, const std::string& from, const std::string& to, bool dry_run,
+                     std::ostream& out = std::cout, std::ostream& err = std::cerr) {
+    if (from.empty()) { err << "Search string must not be empty.\n"; return; }
+    ErrorReport report;
+    std::vector<fs::path> files;
+    std::error_code ec;
+    VfsStat st;
+    auto dev = device_id(root);
+    if (!vfs().stat(root, false, 0, st, ec)) {
+        report.add(root, ec);
+    } else if (st.type == kTypeDir) {
+        walk_tree_parallel(root, tuner().pick(dev, OpClass::Stat), hdd_mode_for(root),
+            [](const fs::path&, const RawDirent& e) { return e.type == kTypeFile; },
+            [&](const fs::path& p, const RawDirent&) { files.push_back(p); }, report);
+    } else if (st.type == kTypeFile) {
+        files.push_back(root);
+    }
+    if (hdd_mode_for(root)) order_by_physical_block(files);
+    std::vector<long long> matches(files.size(), 0);
+    unsigned threads = tuner().pick(dev, OpClass::Read);
+    parallel_for(files.size(), threads, [&](std::size_t i) {
+        std::error_code fec;
+        auto f = vfs().open_read(files[i], fec);
+        long long n = f ? stream_replace(*f, from, from, nullptr, fec) : -1;
+        if (n < 0) report.add(files[i], fec);
+        else matches[i] = n;
+    });
+    std::vector<std::size_t> hits;
+    for (std::size_t i = 0; i < files.size(); ++i)
+        if (matches[i] > 0) hits.push_back(i);
+    std::vector<char> done(files.size(), 0);
+    if (!dry_run) {
+        parallel_for(hits.size(), threads, [&](std::size_t k) {
+            std::size_t i = hits[k];
+            std::error_code fec;
+            auto f = vfs().open_read(files[i], fec);
+            auto w = f ? vfs().open_replace(files[i], fec) : nullptr;
+            // The file may have changed since the pre-scan; the count that was written wins.
+            long long n = w ? stream_replace(*f, from, to, w.get(), fec) : -1;
+            if (n >= 0 && w->commit(g_durability != Durability::None, fec)) {
+                matches[i] = n;
+                done[i] = 1;
+            } else {
+                report.add(files[i], fec);
+            }
+        });
+    }
+    std::uint64_t total = 0, changed = 0;
+    RecordWriter w(out, g_format);
+    for (auto i : hits) {
+        if (!dry_run && !done[i]) continue;
+        total += static_cast<std::uint64_t>(matches[i]);
+        ++changed;
+        if (g_format == OutputFormat::Text) {
+            out << std::right << std::setw(8) << matches[i] << "  " << files[i].string() << "\n";
+        } else {
+            w.begin();
+            w.str(kFieldPath, "path", files[i].native());
+            w.num(kFieldMatches, "matches", static_cast<std::uint64_t>(matches[i]));
+            w.end();
+        }
+    }
+    w.flush();
+    if (g_format == OutputFormat::Text)
+        out << "Scanned " << files.size() << " file(s); " << total << " match(es) in " << changed << " file(s)"
+            << (dry_run ? " (dry run, nothing written)" : " replaced") << "\n";
+    report.print(err, "replace");
+}
+
+// ---------------- Hex viewer ----------------
+// `hexview FILE` prints a hexdump -C window of a file without reading the rest of it. A
+// FileWindow maps one page-aligned kHexWindow slice at a time (a pread buffer when the Vfs
+// is not the real filesystem, or on Windows) and moves it when the view or a search leaves
+// it, so memory use is constant in the file size. Searches run the SIMD find_bytes kernel
+// over successive windows that overlap by the needle length. -i starts an interactive
+// viewer with paging, jump-to-offset and repeated search.
+
+constexpr std::size_t kHexWindow = 8 << 20;
+constexpr std::size_t kHexPage = 256; // bytes shown per screen
+
+class FileWindow {
+public:
+    FileWindow() = default;
+    FileWindow(const FileWindow&) = delete;
+    FileWindow& operator=(const FileWindow&) = delete;
+    ~FileWindow() { unmap(); close(); }
+
+    bool open(const fs::path& p, std::error_code& ec) {
+#ifndef _WIN32
+        if (vfs().real()) {
+            fd_ = ::open(p.c_str(), O_RDONLY | O_CLOEXEC);
+            struct stat st;
+            if (fd_ < 0 || ::fstat(fd_, &st) != 0) { set_errno(ec, errno); return false; }
+            size_ = static_cast<std::uint64_t>(st.st_size);
+            return true;
+        }
+#endif
+        file_ = vfs().open_read(p, ec);
+        if (!file_) return false;
+        size_ = file_->size();
+        return true;
+    }
+
+    std::uint64_t size() const { return size_; }
+
+    // Returns file bytes [off, off + len) for len <= kHexWindow, moving the window if needed.
+    // The range must lie inside the file.
+    const unsigned char* at(std::uint64_t off, std::size_t len, std::error_code& ec) {
+        if (off >= base_ && off + len <= base_ + len_) return data_ + (off - base_);
+        unmap();
+#ifndef _WIN32
+        if (fd_ >= 0) {
+            static const auto page = static_cast<std::uint64_t>(::sysconf(_SC_PAGESIZE));
+            base_ = off / page * page;
+            len_ = static_cast<std::size_t>(std::min<std::uint64_t>(kHexWindow + page, size_ - base_));
+            void* m = ::mmap(nullptr, len_, PROT_READ, MAP_SHARED, fd_, static_cast<off_t>(base_));
+            if (m == MAP_FAILED) { set_errno(ec, errno); len_ = 0; return nullptr; }
+            ::madvise(m, len_, MADV_SEQUENTIAL);
+            map_ = m;
+            data_ = static_cast<const unsigned char*>(m);
+            return data_ + (off - base_);
+        }
+#endif
+        buf_.resize(kHexWindow);
+        base_ = off;
+        long long n = file_->read_at(buf_.data(), buf_.size(), off, ec);
+        if (n < 0) return nullptr;
+        len_ = static_cast<std::size_t>(n);
+        // A short read (e.g. a mirrored tree without contents) reads as zeros.
+        std::size_t want = static_cast<std::size_t>(std::min<std::uint64_t>(kHexWindow, size_ - off));
+        if (len_ < want) std::fill(buf_.begin() + static_cast<std::ptrdiff_t>(len_), buf_.begin() + want, 0);
+        len_ = want;
+        data_ = buf_.data();
+        return data_;
+    }
+
+    // First offset >= from where `needle` starts, or UINT64_MAX.
+    std::uint64_t find(std::string_view needle, std::uint64_t from, std::error_code& ec) {
+        static const FindBytesFn search = find_bytes_kernel();
+        const std::size_t m = needle.size();
+        if (m == 0 || m > kHexWindow / 2) return UINT64_MAX;
+        for (std::uint64_t off = from; off < size_ && size_ - off >= m;) {
+            std::size_t len = static_cast<std::size_t>(std::min<std::uint64_t>(kHexWindow, size_ - off));
+            const unsigned char* p = at(off, len, ec);
+            if (!p) return UINT64_MAX;
+            std::size_t pos = search(p, len, reinterpret_cast<const unsigned char*>(needle.data()), m);
+            if (pos != SIZE_MAX) return off + pos;
+            if (off + len == size_) break;
+            off += len - (m - 1);
+        }
+        return UINT64_MAX;
+    }
+
+private:
+    void unmap() {
+#ifndef _WIN32
+        if (map_) ::munmap(map_, len_);
+#endif
+        map_ = nullptr;
+        base_ = len_ = 0;
+    }
+    void close() {
+#ifndef _WIN32
+        if (fd_ >= 0) ::close(fd_);
+#endif
+        fd_ = -1;
+    }
+
+    int fd_ = -1;
+    std::unique_ptr<VfsFile> file_;
+    std::uint64_t size_ = 0, base_ = 0;
+    std::size_t len_ = 0;
+    void* map_ = nullptr;
+    const unsigned char* data_ = nullptr;
+    std::vector<unsigned char> buf_;
+};
+
+// Offsets are decimal with an optional K/M/G suffix, or hex with a 0x prefix.
+bool parse_offset(const std::string& s, std::uint64_t& out) {
+    if (s.size() > 2 && s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) {
+        char* end = nullptr;
+        errno = 0;
+        out = std::strtoull(s.c_str() + 2, &end, 16);
+        return errno == 0 && *end == '\0';
+    }
+    std::uintmax_t v = 0;
+    if (!parse_size(s, v)) return false;
+    out = v;
+    return true;
+}
+
+// "de ad be ef", "deadbeef" or "0xdeadbeef" to bytes.
+bool parse_hex_bytes(const std::string& s, std::string& out) {
+    std::string digits;
+    for (std::size_t i = 0; i < s.size(); ++i) {
+        if (s[i] == ' ') continue;
+        if (s[i] == '0' && i + 1 < s.size() && (s[i + 1] == 'x' || s[i + 1] == 'X')) { ++i; continue; }
+        if (!std::isxdigit(static_cast<unsigned char>(s[i]))) return false;
+        digits += s[i];
+    }
+    if (digits.empty() || digits.size() % 2) return false;
+    out.clear();
+    for (std::size_t i = 0; i < digits.size(); i += 2) out += static_cast<char>(std::stoi(digits.substr(i, 2), nullptr, 16));
+    return true;
+}
+
+// Writes [off, off + len) clipped to the file, starting at off's row.
+bool print_hex(FileWindow& w, std::uint64_t off, std::uint64_t len, std::ostream& out, std::error_code& ec) {
+    static const FormatHexFn format = format_hex_kernel();
+    std::uint64_t end = off >= w.size() || len >= w.size() - off ? w.size() : off + len;
+    off -= off % kHexRowBytes;
+    std::string text;
+    while (off < end) {
+        std::size_t n = static_cast<std::size_t>(std::min<std::uint64_t>(kHexWindow, end - off));
+        const unsigned char* p = w.at(off, n, ec);
+        if (!p) return false;
+        text.clear();
+        format(p, n, off, text);
+        out << text;
+        off += n;
+    }
+    return true;
+}
+
+// Interactive pager: Enter/n next screen, p previous, g OFFSET jump, /TEXT or x HEX search
+// forward from the current screen, N repeat the search, q quit.
+void hex_viewer(FileWindow& w, const fs::path& path, std::uint64_t off, std::istream& in, std::ostream& out) {
+    std::string needle, line;
+    std::error_code ec;
+    std::uint64_t last = UINT64_MAX; // offset of the last match
+    for (;;) {
+        off = std::min(off, w.size() ? (w.size() - 1) / kHexPage * kHexPage : 0);
+        out << path.string() << "  " << w.size() << " bytes, offset 0x" << std::hex << off;
+        if (last != UINT64_MAX) out << ", match at 0x" << last;
+        out << std::dec << "\n";
+        if (!print_hex(w, off, kHexPage, out, ec)) { out << "Read error: " << ec.message() << "\n"; return; }
+        out << "[Enter/n] next  [p] prev  [g OFF] goto  [/TEXT] [x HEX] find  [N] next match  [q] quit: ";
+        if (!std::getline(in, line) || line == "q") return;
+        std::uint64_t from = last == UINT64_MAX ? off : last + 1;
+        if (line.empty() || line == "n") {
+            off += kHexPage;
+            continue;
+        } else if (line == "p") {
+            off -= std::min<std::uint64_t>(off, kHexPage);
+            continue;
+        } else if (line.rfind("g ", 0) == 0) {
+            std::uint64_t to = 0;
+            if (parse_offset(line.substr(2), to)) off = to / kHexRowBytes * kHexRowBytes;
+            else out << "Bad offset.\n";
+            continue;
+        } else if (line[0] == '/' && line.size() > 1) {
+            needle = line.substr(1);
+            from = off;
+            last = UINT64_MAX;
+        } else if (line.rfind("x ", 0) == 0) {
+            if (!parse_hex_bytes(line.substr(2), needle)) { out << "Bad hex pattern.\n"; continue; }
+            from = off;
+            last = UINT64_MAX;
+        } else if (line != "N" || needle.empty()) {
+            out << "Unknown command.\n";
+            continue;
+        }
+        std::uint64_t hit = w.find(needle, from, ec);
+        if (hit == UINT64_MAX) {
+            out << (ec ? "Read error: " + ec.message() : std::string("Not found.")) << "\n";
+        } else {
+            last = hit;
+            off = hit / kHexRowBytes * kHexRowBytes;
+        }
+    }
+}
+
+// `hexview [-i] [--offset=N] [--length=N] [--find=HEX | --text=STR] FILE`. With a pattern, the
+// window starts at the row of its first match at or after the offset.
+bool hexview_command(const fs::path& p, std::uint64_t off, std::uint64_t len, const std::string& needle,
+                     bool interactive, std::ostream& out = std::cout, std::ostream& err = std::cerr) {
+    ErrorReport report;
+    FileWindow w;
+    std::error_code ec;
+    if (!w.open(p, ec)) { report.add(p, ec); report.print(err, "hexview"); return false; }
+    if (!needle.empty()) {
+        auto t0 = std::chrono::steady_clock::now();
+        std::uint64_t hit = w.find(needle, off, ec);
+        if (ec) { report.add(p, ec); report.print(err, "hexview"); return false; }
+        if (hit == UINT64_MAX) { out << "Pattern not found after offset " << off << ".\n"; return false; }
+        err << "hexview: match at offset " << hit << " (0x" << std::hex << hit << std::dec << "), searched "
+            << (hit - off) / (1 << 20) << " MiB in " << std::fixed << std::setprecision(3) << seconds_since(t0)
+            << " s\n" << std::defaultfloat;
+        off = hit;
+    }
+    if (interactive) {
+        hex_viewer(w, p, off / kHexRowBytes * kHexRowBytes, std::cin, out);
+        return true;
+    }
+    if (!print_hex(w, off, len, out, ec)) report.add(p, ec);
+    report.print(err, "hexview");
+    return report.total() == 0;
+}
+
+// ---------------- Content hashing ----------------
+// SHA-256 (FIPS 180-4): names backup chunks and identifies file contents.
+
+class Sha256 {
+public:
+    static constexpr std::size_t kSize = 32;
+    using Digest = std::array<unsigned char, kSize>;
+
+    Sha256() = default;
+
+    void update(const void* data, std::size_t len) {
+        auto p = static_cast<const unsigned char*>(data);
+        total_ += len;
+        if (buf_len_ > 0) {
+            std::size_t n = std::min(len, sizeof(buf_) - buf_len_);
+            std::memcpy(buf_ + buf_len_, p, n);
+            buf_len_ += n;
+            p += n;
+            len -= n;
+            if (buf_len_ < sizeof(buf_)) return;
+            block(buf_);
+            buf_len_ = 0;
+        }
+        for (; len >= 64; p += 64, len -= 64) block(p);
+        std::memcpy(buf_, p, len);
+        buf_len_ = len;
+    }
+
+    Digest final() {
+        std::uint64_t bits = total_ * 8;
+        unsigned char pad[72] = {0x80};
+        std::size_t n = (buf_len_ < 56 ? 56 : 120) - buf_len_;
+        for (int i = 0; i < 8; ++i) pad[n + i] = static_cast<unsigned char>(bits >> (56 - 8 * i));
+        update(pad, n + 8);
+        Digest d;
+        for (int i = 0; i < 8; ++i)
+            for (int j = 0; j < 4; ++j) d[4 * i + j] = static_cast<unsigned char>(h_[i] >> (24 - 8 * j));
+        return d;
+    }
+
+    static Digest of(const void* data, std::size_t len) {
+        Sha256 s;
+        s.update(data, len);
+        return s.final();
+    }
+
+private:
+    static std::uint32_t rotr(std::uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+    void block(const unsigned char* p) {
+        static constexpr std::uint32_t k[64] = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+        std::uint32_t w[64];
+        for (int i = 0; i < 16; ++i)
+            w[i] = static_cast<std::uint32_t>(p[4 * i]) << 24 | static_cast<std::uint32_t>(p[4 * i + 1]) << 16
+                 | static_cast<std::uint32_t>(p[4 * i + 2]) << 8 | p[4 * i + 3];
+        for (int i = 16; i < 64; ++i) {
+            std::uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            std::uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        std::uint32_t a = h_[0], b = h_[1], c = h_[2], d = h_[3], e = h_[4], f = h_[5], g = h_[6], h = h_[7];
+        for (int i = 0; i < 64; ++i) {
+            std::uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+            std::uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+        h_[0] += a; h_[1] += b; h_[2] += c; h_[3] += d;
+        h_[4] += e; h_[5] += f; h_[6] += g; h_[7] += h;
+    }
+
+    std::uint32_t h_[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    unsigned char buf_[64];
+    std::size_t buf_len_ = 0;
+    std::uint64_t total_ = 0;
+};
+
+std::string hex_digest(const Sha256::Digest& d) {
+    static const char* digits = "0123456789abcdef";
+    std::string s;
+    for (auto b : d) { s.push_back(digits[b >> 4]); s.push_back(digits[b & 15]); }
+    return s;
+}
+
+// Whole-file hashes are cached with the (size, mtime, inode) they were computed for, and
+// trusted only while all three still match, so re-hashing an unchanged tree costs a stat
+// per file. The record lives in the file's `user.file_explorer.hash` xattr, or, where
+// that cannot be written (no xattr support, read-only files, other platforms), in an
+// append-only sidecar log keyed by (device, inode). In-memory trees are not cached.
+class HashCache {
+public:
+    static constexpr const char* kXattr = "user.file_explorer.hash";
+    static constexpr unsigned char kAlgoSha256 = 1;
+
+    struct Record {
+        std::uint64_t size = 0, ino = 0;
+        std::int64_t mtime_ns = 0;
+        Sha256::Digest digest{};
+    };
+
+    explicit HashCache(std::string sidecar) : sidecar_(std::move(sidecar)) {}
+
+    bool lookup(const fs::path& p, std::uint64_t dev, const VfsStat& st, Sha256::Digest& d) {
+        Record r;
+        bool found = read_xattr(p, r) || find_sidecar(dev, st.ino, r);
+        if (found && r.size == st.size && r.mtime_ns == st.mtime_ns && r.ino == st.ino) {
+            d = r.digest;
+            ++hits_;
+            return true;
+        }
+        ++misses_;
+        return false;
+    }
+
+    void store(const fs::path& p, std::uint64_t dev, const VfsStat& st, const Sha256::Digest& d) {
+        Record r{st.size, st.ino, st.mtime_ns, d};
+        if (!write_xattr(p, r)) add_sidecar(dev, r);
+    }
+
+    std::size_t hits() const { return hits_; }
+    std::size_t misses() const { return misses_; }
+
+private:
+    // version, algorithm, size, mtime_ns, inode, digest
+    static std::string encode(const Record& r) {
+        std::string b;
+        b.push_back(1);
+        b.push_back(static_cast<char>(kAlgoSha256));
+        put_u64(b, r.size);
+        put_u64(b, static_cast<std::uint64_t>(r.mtime_ns));
+        put_u64(b, r.ino);
+        b.append(reinterpret_cast<const char*>(r.digest.data()), r.digest.size());
+        return b;
+    }
+
+    static bool decode(const char*& p, const char* end, Record& r) {
+        if (end - p < 2 || p[0] != 1 || static_cast<unsigned char>(p[1]) != kAlgoSha256) return false;
+        p += 2;
+        std::uint64_t mtime;
+        if (!get_u64(p, end, r.size) || !get_u64(p, end, mtime) || !get_u64(p, end, r.ino)
+            || end - p < static_cast<std::ptrdiff_t>(Sha256::kSize))
+            return false;
+        r.mtime_ns = static_cast<std::int64_t>(mtime);
+        std::memcpy(r.digest.data(), p, Sha256::kSize);
+        p += Sha256::kSize;
+        return true;
+    }
+
+    static bool read_xattr(const fs::path& p, Record& r) {
+#ifdef __linux__
+        if (!vfs().real()) return false;
+        char buf[128];
+        ssize_t n = ::getxattr(p.c_str(), kXattr, buf, sizeof(buf));
+        const char* q = buf;
+        return n > 0 && decode(q, buf + n, r);
+#else
+        (void)p; (void)r;
+        return false;
+#endif
+    }
+
+    static bool write_xattr(const fs::path& p, const Record& r) {
+#ifdef __linux__
+        if (!vfs().real()) return false;
+        std::string v = encode(r);
+        return ::setxattr(p.c_str(), kXattr, v.data(), v.size(), 0) == 0;
+#else
+        (void)p; (void)r;
+        return false;
+#endif
+    }
+
+    static std::string sidecar_key(std::uint64_t dev, std::uint64_t ino) {
+        std::string k;
+        put_u64(k, dev);
+        put_u64(k, ino);
+        return k;
+    }
+
+    // The log is read once; later records for an inode replace earlier ones.
+    void load_sidecar() {
+        if (loaded_) return;
+        loaded_ = true;
+        std::string data;
+        if (!read_whole_file(sidecar_, data)) return;
+        const char* p = data.data();
+        const char* end = p + data.size();
+        for (std::uint64_t dev; get_u64(p, end, dev);) {
+            Record r;
+            if (!decode(p, end, r)) break;
+            sidecar_map_[sidecar_key(dev, r.ino)] = r;
+        }
+    }
+
+    bool find_sidecar(std::uint64_t dev, std::uint64_t ino, Record& r) {
+        if (!vfs().real()) return false;
+        std::lock_guard<std::mutex> lk(mu_);
+        load_sidecar();
+        auto it = sidecar_map_.find(sidecar_key(dev, ino));
+        if (it == sidecar_map_.end()) return false;
+        r = it->second;
+        return true;
+    }
+
+    void add_sidecar(std::uint64_t dev, const Record& r) {
+        if (!vfs().real()) return;
+        std::lock_guard<std::mutex> lk(mu_);
+        load_sidecar();
+        sidecar_map_[sidecar_key(dev, r.ino)] = r;
+        std::string b;
+        put_u64(b, dev);
+        b += encode(r);
+        std::ofstream out(sidecar_, std::ios::binary | std::ios::app);
+        out.write(b.data(), static_cast<std::streamsize>(b.size()));
+    }
+
+    std::string sidecar_;
+    std::mutex mu_;
+    bool loaded_ = false;
+    std::unordered_map<std::string, Record> sidecar_map_;
+    std::atomic<std::size_t> hits_{0}, misses_{0};
+};
+
+HashCache& hash_cache() {
+    static HashCache c((index_dir() / "hashes.log").string());
+    return c;
+}
+
+// Digests are always looked up, but only written (xattrs or sidecar) with --hash-cache, so
+// read-only commands leave files untouched unless asked.
+bool g_store_hashes = false;
+
+// Hashes a whole file, or takes the cached hash while the file is unchanged.
+bool hash_file(const fs::path& p, Sha256::Digest& d, std::error_code& ec) {
+    constexpr std::size_t kBlock = 1 << 20;
+    constexpr unsigned kWant = kWantSize | kWantMtime;
+    VfsStat before, after;
+    if (!vfs().stat(p, true, kWant, before, ec)) return false;
+    auto dev = device_id(p);
+    if (hash_cache().lookup(p, dev, before, d)) return true;
+    auto f = vfs().open_read(p, ec);
+    if (!f) return false;
+    std::vector<char> buf(kBlock);
+    Sha256 s;
+    for (std::uint64_t off = 0;;) {
+        auto n = f->read_at(buf.data(), buf.size(), off, ec);
+        if (n < 0) return false;
+        if (n == 0) break;
+        s.update(buf.data(), static_cast<std::size_t>(n));
+        off += static_cast<std::uint64_t>(n);
+    }
+    d = s.final();
+    // Cache only what was stable while it was read, and not if the mtime is so recent that
+    // a write within the same timestamp tick could follow unnoticed (PathIndex::kRacyNs).
+    if (g_store_hashes && vfs().stat(p, true, kWant, after, ec) && after.size == before.size
+        && after.mtime_ns == before.mtime_ns && after.ino == before.ino
+        && after.mtime_ns < now_unix_ns() - PathIndex::kRacyNs)
+        hash_cache().store(p, dev, before, d);
+    ec.clear();
+    return true;
+}
+
+// Hashes the files in parallel; false entries in `ok` failed and are in `report`.
+std::vector<Sha256::Digest> hash_files(const std::vector<fs::path>& files, std::vector<char>& ok, ErrorReport& report) {
+    std::vector<Sha256::Digest> digests(files.size());
+    ok.assign(files.size(), 0);
+    parallel_for(files.size(), tuner().pick(files.empty() ? 0 : device_id(files[0]), OpClass::Read), [&](std::size_t i) {
+        std::error_code ec;
+        if (hash_file(files[i], digests[i], ec)) ok[i] = 1;
+        else report.add(files[i], ec);
+    });
+    return digests;
+}
+
+// `hash PATH...`: sha256sum-style digests of every file under the paths, in parallel.
+void hash_command(const std::vector<fs::path>& roots, std::ostream& out = std::cout, std::ostream& err = std::cerr) {
+    ErrorReport report;
+    auto t0 = std::chrono::steady_clock::now();
+    std::vector<fs::path> files;
+    for (const auto& root : roots) {
+        VfsStat st;
+        std::error_code ec;
+        if (!vfs().stat(root, true, 0, st, ec)) { report.add(root, ec); continue; }
+        if (st.type != kTypeDir) { files.push_back(root); continue; }
+        walk_tree_parallel(root, tuner().pick(device_id(root), OpClass::Stat), hdd_mode_for(root),
+            [](const fs::path&, const RawDirent& e) { return e.type == kTypeFile; },
+            [&](const fs::path& p, const RawDirent&) { files.push_back(p); }, report);
+    }
+    std::vector<char> ok;
+    std::size_t hits0 = hash_cache().hits();
+    auto digests = hash_files(files, ok, report);
+    for (std::size_t i = 0; i < files.size(); ++i)
+        if (ok[i]) out << hex_digest(digests[i]) << "  " << files[i].string() << "\n";
+    std::size_t cached = hash_cache().hits() - hits0;
+    err << "hash: " << files.size() << " file(s), " << cached << " from cache, " << files.size() - cached << " read, in "
+        << std::fixed << std::setprecision(2) << seconds_since(t0) << " s\n" << std::defaultfloat;
+    report.print(err, "hash");
+}
+
+// ---------------- Split and join ----------------
+// `split FILE SIZE` cuts a file into FILE.000, FILE.001, ... of at most SIZE bytes; with
+// --lines each cut moves back to the last newline so no line straddles two pieces. The
+// boundaries are found first (only a backward newline scan per cut), then all pieces are
+// written at once as kCopyChunk ranges through Vfs::copy_span, which is copy_file_range at
+// explicit offsets on Linux. `join OUT PIECE...` is the inverse: piece sizes give the output
+// offsets, so every range lands directly in place. --sums writes a sha256sum-compatible
+// manifest, and join --verify=SUMS checks the pieces against it (in parallel) before writing.
+
+struct SplitPiece {
+    fs::path path;
+    std::uint64_t off = 0, len = 0; // range in the joined file
+};
+
+// Moves the cut at `end` back to just past the last newline in (off, end]. Reads backwards in
+// kBlock windows; a line longer than the piece keeps the hard cut.
+std::uint64_t line_cut(VfsFile& f, std::uint64_t off, std::uint64_t end, std::error_code& ec) {
+    constexpr std::size_t kBlock = 64 << 10;
+    static const RfindByteFn rfind = rfind_byte_kernel();
+    std::vector<unsigned char> buf(kBlock);
+    for (std::uint64_t hi = end; hi > off;) {
+        std::uint64_t lo = hi - std::min<std::uint64_t>(kBlock, hi - off);
+        long long n = f.read_at(buf.data(), static_cast<std::size_t>(hi - lo), lo, ec);
+        if (n < 0) return 0;
+        std::size_t pos = rfind(buf.data(), static_cast<std::size_t>(n), '\n');
+        if (pos != SIZE_MAX) return lo + pos + 1;
+        hi = lo;
+    }
+    return end;
+}
+
+std::string piece_suffix(std::size_t i, std::size_t count) {
+    std::size_t width = std::max<std::size_t>(3, std::to_string(count - 1).size());
+    std::string s = std::to_string(i);
+    return "." + std::string(width - std::min(width, s.size()), '0') + s;
+}
+
+// Copies every piece range between `whole` and the pieces in kCopyChunk tasks, in parallel.
+// `to_pieces` selects the direction. Outputs must already have their final size.
+std::uint64_t copy_pieces(const fs::path& whole, const std::vector<SplitPiece>& pieces, bool to_pieces,
+                          ErrorReport& report) {
+    struct Task { std::size_t piece; std::uint64_t off, len; };
+    std::vector<Task> tasks;
+    for (std::size_t i = 0; i < pieces.size(); ++i)
+        for (std::uint64_t off = 0; off < pieces[i].len; off += kCopyChunk)
+            tasks.push_back(Task{i, off, std::min(kCopyChunk, pieces[i].len - off)});
+    std::unique_ptr<std::atomic<bool>[]> failed(new std::atomic<bool>[pieces.size()]);
+    for (std::size_t i = 0; i < pieces.size(); ++i) failed[i] = false;
+    std::atomic<std::uint64_t> bytes{0};
+    auto dev = device_id(whole);
+    auto t0 = std::chrono::steady_clock::now();
+    unsigned threads = tuner().pick(dev, OpClass::Read);
+    parallel_for(tasks.size(), threads, [&](std::size_t k) {
+        const Task& t = tasks[k];
+        const SplitPiece& p = pieces[t.piece];
+        if (failed[t.piece]) return;
+        io_scheduler().charge(JobClass::Copy, t.len);
+        std::error_code ec;
+        bool ok = to_pieces ? vfs().copy_span(whole, p.off + t.off, p.path, t.off, t.len, ec)
+                            : vfs().copy_span(p.path, t.off, whole, p.off + t.off, t.len, ec);
+        if (ok) {
+            bytes += t.len;
+        } else if (!failed[t.piece].exchange(true)) {
+            report.add(to_pieces ? p.path : whole, ec);
+        }
+    });
+    if (!io_scheduler().throttled(JobClass::Copy) && g_durability == Durability::None)
+        tuner().record(dev, OpClass::Read, threads, bytes, seconds_since(t0));
+    return bytes;
+}
+
+bool split_command(const fs::path& file, std::uint64_t piece_size, bool lines, bool sums, std::ostream& out = std::cout,
+                   std::ostream& err = std::cerr) {
+    ErrorReport report;
+    std::error_code ec;
+    auto f = vfs().open_read(file, ec);
+    if (!f) { report.add(file, ec); report.print(err, "split"); return false; }
+    std::uint64_t size = f->size();
+    std::vector<SplitPiece> pieces;
+    for (std::uint64_t off = 0; off < size || pieces.empty();) {
+        std::uint64_t end = std::min(size, off + piece_size);
+        if (lines && end < size) end = line_cut(*f, off, end, ec);
+        if (ec) { report.add(file, ec); report.print(err, "split"); return false; }
+        pieces.push_back(SplitPiece{fs::path(), off, end - off});
+        off = end;
+    }
+    f.reset();
+    for (std::size_t i = 0; i < pieces.size(); ++i) {
+        pieces[i].path = file.string() + piece_suffix(i, pieces.size());
+        if (!vfs().prepare_copy(file, pieces[i].path, pieces[i].len, ec)) {
+            report.add(pieces[i].path, ec);
+            report.print(err, "split");
+            return false;
+        }
+    }
+    ProgressMeter meter(JobClass::Copy, err);
+    auto t0 = std::chrono::steady_clock::now();
+    copy_pieces(file, pieces, true, report);
+    if (g_durability != Durability::None)
+        for (const auto& p : pieces)
+            if (!vfs().sync(p.path, false, ec)) report.add(p.path, ec);
+    double secs = seconds_since(t0);
+    if (sums && report.total() == 0) {
+        std::vector<fs::path> paths;
+        for (const auto& p : pieces) paths.push_back(p.path);
+        std::vector<char> ok;
+        auto digests = hash_files(paths, ok, report);
+        std::string manifest;
+        for (std::size_t i = 0; i < paths.size(); ++i)
+            manifest += hex_digest(digests[i]) + "  " + paths[i].filename().string() + "\n";
+        fs::path sums_path = file.string() + ".sha256";
+        if (report.total() == 0) {
+            // open_replace swaps in for an existing file; create it first (EEXIST is fine).
+            vfs().create_file(sums_path, ec);
+            ec.clear();
+            auto w = vfs().open_replace(sums_path, ec);
+            if (w && w->write(manifest.data(), manifest.size(), ec) && w->commit(g_durability != Durability::None, ec))
+                out << "Checksums: " << sums_path.string() << "\n";
+            else
+                report.add(sums_path, ec);
+        }
+    }
+    out << "Split " << file.string() << " (" << size << " bytes) into " << pieces.size() << " piece(s)"
+        << (lines ? " at line boundaries" : "") << " in " << std::fixed << std::setprecision(2) << secs << " s\n"
+        << std::defaultfloat;
+    meter.finish(out);
+    report.print(err, "split");
+    return report.total() == 0;
+}
+
+// Reads a sha256sum manifest into file name -> digest. Lines may use the binary marker '*'.
+bool load_sums(const fs::path& p, std::map<std::string, std::string>& sums, std::error_code& ec) {
+    auto f = vfs().open_read(p, ec);
+    if (!f) return false;
+    std::string data(static_cast<std::size_t>(f->size()), '\0');
+    long long n = f->read_at(data.data(), data.size(), 0, ec);
+    if (n < 0) return false;
+    data.resize(static_cast<std::size_t>(n));
+    std::istringstream in(data);
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.size() < 66 || line[64] != ' ') continue;
+        std::string name = line.substr(line[65] == '*' || line[65] == ' ' ? 66 : 65);
+        sums[fs::path(name).filename().string()] = line.substr(0, 64);
+    }
+    return true;
+}
+
+bool join_command(const fs::path& dest, const std::vector<fs::path>& parts, const std::string& verify,
+                  std::ostream& out = std::cout, std::ostream& err = std::cerr) {
+    ErrorReport report;
+    std::error_code ec;
+    // The output is truncated first, so it must not be one of the inputs.
+    for (const auto& p : parts)
+        if (same_file(p, dest)) {
+            out << "Output " << dest.string() << " is also an input piece (" << p.string() << "); nothing written.\n";
+            return false;
+        }
+    if (!verify.empty()) {
+        std::map<std::string, std::string> sums;
+        if (!load_sums(verify, sums, ec)) { report.add(verify, ec); report.print(err, "join"); return false; }
+        std::vector<char> ok;
+        auto digests = hash_files(parts, ok, report);
+        std::size_t bad = 0;
+        for (std::size_t i = 0; i < parts.size(); ++i) {
+            if (!ok[i]) { ++bad; continue; }
+            auto it = sums.find(parts[i].filename().string());
+            if (it == sums.end()) {
+                err << "join: " << parts[i].string() << ": not in " << verify << "\n";
+                ++bad;
+            } else if (it->second != hex_digest(digests[i])) {
+                err << "join: " << parts[i].string() << ": checksum mismatch\n";
+                ++bad;
+            }
+        }
+        report.print(err, "join");
+        if (bad) { out << "Verification failed for " << bad << " piece(s); nothing written.\n"; return false; }
+        out << "Verified " << parts.size() << " piece(s).\n";
+    }
+    std::vector<SplitPiece> pieces;
+    std::uint64_t total = 0;
+    for (const auto& p : parts) {
+        VfsStat st;
+        if (!vfs().stat(p, true, kWantSize, st, ec)) { report.add(p, ec); continue; }
+        pieces.push_back(SplitPiece{p, total, st.size});
+        total += st.size;
+    }
+    if (report.total() || pieces.empty()) { report.print(err, "join"); return false; }
+    if (!vfs().prepare_copy(parts[0], dest, total, ec)) { report.add(dest, ec); report.print(err, "join"); return false; }
+    ProgressMeter meter(JobClass::Copy, err);
+    auto t0 = std::chrono::steady_clock::now();
+    copy_pieces(dest, pieces, false, report);
+    if (g_durability != Durability::None && !vfs().sync(dest, false, ec)) report.add(dest, ec);
+    out << "Joined " << pieces.size() << " piece(s) into " << dest.string() << " (" << total << " bytes) in "
+        << std::fixed << std::setprecision(2) << seconds_since(t0) << " s\n" << std::defaultfloat;
+    meter.finish(out);
+    report.print(err, "join");
+    return report.total() == 0;
+}
+
+// ---------------- Backup store ----------------
+// `backup STORE ROOT [NAME]` splits every file under ROOT into content-defined chunks and
+// keeps each distinct chunk once in STORE. Chunk boundaries come from FastCDC: a gear
+// rolling hash cuts where its top bits are all zero, with a stricter mask before the
+// average size and a looser one after it, so cuts follow content and an edit only moves
+// the chunks around it. Chunks are named by SHA-256 and appended to pack files; the
+// snapshot manifest lists each path with its chunk names. `restore STORE NAME DEST`
+// rebuilds a snapshot. Chunking, hashing and restoring run one file per worker.
+
+constexpr std::size_t kCdcMin = 16 << 10, kCdcAvg = 64 << 10, kCdcMax = 256 << 10;
+constexpr std::uint64_t kPackLimit = 1ull << 30; // a new pack file past 1 GiB
+
+const std::array<std::uint64_t, 256>& gear_table() {
+    static const auto table = [] {
+        std::array<std::uint64_t, 256> t{};
+        std::uint64_t x = 0x6a09e667f3bcc908ull; // fixed seed: cut points must be stable across runs
+        for (auto& v : t) {
+            std::uint64_t z = (x += 0x9e3779b97f4a7c15ull);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+            v = z ^ (z >> 31);
+        }
+        return t;
+    }();
+    return table;
+}
+
+// Length of the chunk starting at `p`; `n` is below kCdcMax only at end of file.
+std::size_t cdc_cut(const unsigned char* p, std::size_t n) {
+    // The hash shifts left, so its top bits cover the last 64 bytes. Two bits more than
+    // log2(kCdcAvg) before the average, two fewer after ("normalized chunking").
+    constexpr std::uint64_t kMaskS = ((1ull << 18) - 1) << 46;
+    constexpr std::uint64_t kMaskL = ((1ull << 14) - 1) << 50;
+    if (n <= kCdcMin) return n;
+    const auto& gear = gear_table();
+    std::size_t normal = std::min(n, kCdcAvg), end = std::min(n, kCdcMax), i = kCdcMin;
+    std::uint64_t h = 0;
+    for (; i < normal; ++i)
+        if (!((h = (h << 1) + gear[p[i]]) & kMaskS)) return i + 1;
+    for (; i < end; ++i)
+        if (!((h = (h << 1) + gear[p[i]]) & kMaskL)) return i + 1;
+    return end;
+}
+
+struct ChunkRef {
+    Sha256::Digest digest;
+    std::uint32_t len = 0;
+};
+
+// Chunks in append-only pack files, located through an index saved after each backup.
+// Packs written by an interrupted run are never referenced, so they only cost space.
+class ChunkStore {
+public:
+    explicit ChunkStore(fs::path dir) : dir_(std::move(dir)) {}
+
+    bool open(std::error_code& ec) {
+        fs::create_directories(dir_ / "packs", ec);
+        if (!ec) fs::create_directories(dir_ / "snapshots", ec);
+        if (ec) return false;
+        std::string data;
+        if (!read_whole_file((dir_ / "chunks.idx").string(), data)) return true; // new store
+        const char* p = data.data();
+        const char* end = p + data.size();
+        std::uint32_t version, count;
+        if (data.compare(0, 4, "FECS") != 0 || !get_u32(p += 4, end, version) || version != 1 || !get_u32(p, end, count)) {
+            set_errno(ec, EINVAL);
+            return false;
+        }
+        for (std::uint32_t i = 0; i < count; ++i) {
+            Loc l;
+            if (end - p < static_cast<std::ptrdiff_t>(Sha256::kSize)) { set_errno(ec, EINVAL); return false; }
+            std::string key(p, Sha256::kSize);
+            p += Sha256::kSize;
+            if (!get_u32(p, end, l.pack) || !get_u64(p, end, l.off) || !get_u32(p, end, l.len)) { set_errno(ec, EINVAL); return false; }
+            next_pack_ = std::max(next_pack_, l.pack + 1);
+            index_.emplace(std::move(key), l);
+        }
+        return true;
+    }
+
+    // Appends the chunk unless one with this digest is stored already; true if it was new.
+    bool put(const Sha256::Digest& d, const unsigned char* data, std::size_t len, std::error_code& ec) {
+        std::string key(reinterpret_cast<const char*>(d.data()), d.size());
+        std::lock_guard<std::mutex> lk(mu_);
+        if (index_.count(key)) return false;
+        if (!pack_.is_open() || pack_size_ >= kPackLimit) {
+            if (pack_.is_open() && !close_pack(ec)) return false;
+            pack_no_ = next_pack_++;
+            pack_.open(pack_path(pack_no_), std::ios::binary | std::ios::trunc);
+            pack_size_ = 0;
+            if (!pack_) { set_errno(ec, EIO); return false; }
+        }
+        if (!pack_.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(len))) { set_errno(ec, EIO); return false; }
+        index_.emplace(std::move(key), Loc{pack_no_, pack_size_, static_cast<std::uint32_t>(len)});
+        pack_size_ += len;
+        return true;
+    }
+
+    // Closes the open pack and saves the index; packs reach the disk before the index names them.
+    bool commit(std::error_code& ec) {
+        std::lock_guard<std::mutex> lk(mu_);
+        if (pack_.is_open() && !close_pack(ec)) return false;
+        std::string b = "FECS";
+        put_u32(b, 1);
+        put_u32(b, static_cast<std::uint32_t>(index_.size()));
+        for (const auto& kv : index_) {
+            b += kv.first;
+            put_u32(b, kv.second.pack);
+            put_u64(b, kv.second.off);
+            put_u32(b, kv.second.len);
+        }
+        if (!write_whole_file((dir_ / "chunks.idx").string(), b)) { set_errno(ec, EIO); return false; }
+        return true;
+    }
+
+    bool has(const Sha256::Digest& d) const {
+        std::lock_guard<std::mutex> lk(mu_);
+        return index_.count(std::string(reinterpret_cast<const char*>(d.data()), d.size())) != 0;
+    }
+
+    std::size_t chunks() const {
+        std::lock_guard<std::mutex> lk(mu_);
+        return index_.size();
+    }
+
+    const fs::path& dir() const { return dir_; }
+
+    // One worker's view for reading chunks back: keeps the packs it touched open.
+    class Reader {
+    public:
+        explicit Reader(const ChunkStore& s) : store_(s) {}
+
+        // Reads and verifies a chunk.
+        bool read(const Sha256::Digest& d, std::string& out, std::error_code& ec) {
+            Loc l;
+            {
+                std::lock_guard<std::mutex> lk(store_.mu_);
+                auto it = store_.index_.find(std::string(reinterpret_cast<const char*>(d.data()), d.size()));
+                if (it == store_.index_.end()) { set_errno(ec, ENOENT); return false; }
+                l = it->second;
+            }
+            auto& in = packs_[l.pack];
+            if (!in.is_open()) in.open(store_.pack_path(l.pack), std::ios::binary);
+            out.resize(l.len);
+            in.clear();
+            in.seekg(static_cast<std::streamoff>(l.off));
+            if (!in.read(&out[0], static_cast<std::streamsize>(l.len))) { set_errno(ec, EIO); return false; }
+            if (Sha256::of(out.data(), out.size()) != d) { set_errno(ec, EILSEQ); return false; }
+            return true;
+        }
+
+    private:
+        const ChunkStore& store_;
+        std::map<std::uint32_t, std::ifstream> packs_;
+    };
+
+private:
+    struct Loc {
+        std::uint32_t pack = 0;
+        std::uint64_t off = 0;
+        std::uint32_t len = 0;
+    };
+
+    std::string pack_path(std::uint32_t n) const {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%08u.pack", n);
+        return (dir_ / "packs" / name).string();
+    }
+
+    bool close_pack(std::error_code& ec) {
+        pack_.close();
+        if (pack_.fail()) { set_errno(ec, EIO); return false; }
+        if (g_durability != Durability::None) {
+            PosixVfs disk;
+            if (!disk.sync(pack_path(pack_no_), false, ec)) return false;
+        }
+        return true;
+    }
+
+    fs::path dir_;
+    mutable std::mutex mu_;
+    std::unordered_map<std::string, Loc> index_;
+    std::ofstream pack_;
+    std::uint32_t pack_no_ = 0, next_pack_ = 0;
+    std::uint64_t pack_size_ = 0;
+};
+
+struct SnapshotEntry {
+    std::string rel; // '/'-separated, "" for the root
+    unsigned type = kTypeFile;
+    unsigned mode = 0;
+    std::int64_t mtime_ns = 0;
+    std::uint64_t size = 0;
+    std::vector<ChunkRef> chunks;
+};
+
+std::string snapshot_path(const fs::path& store, const std::string& name) {
+    return (store / "snapshots" / (name + ".snap")).string();
+}
+
+bool save_snapshot(const fs::path& store, const std::string& name, const fs::path& root,
+                   const std::vector<SnapshotEntry>& entries) {
+    std::string b = "FESN";
+    put_u32(b, 1);
+    put_str(b, root.generic_string());
+    put_u64(b, static_cast<std::uint64_t>(now_unix_ns()));
+    put_u32(b, static_cast<std::uint32_t>(entries.size()));
+    for (const auto& e : entries) {
+        put_str(b, e.rel);
+        b.push_back(static_cast<char>(e.type));
+        put_u32(b, e.mode);
+        put_u64(b, static_cast<std::uint64_t>(e.mtime_ns));
+        put_u64(b, e.size);
+        put_u32(b, static_cast<std::uint32_t>(e.chunks.size()));
+        for (const auto& c : e.chunks) {
+            b.append(reinterpret_cast<const char*>(c.digest.data()), c.digest.size());
+            put_u32(b, c.len);
+        }
+    }
+    return write_whole_file(snapshot_path(store, name), b);
+}
+
+// Restore joins `rel` onto the destination, so it must stay below it: relative, with no
+// empty, "." or ".." components.
+bool safe_relative(const std::string& rel) {
+    if (rel.empty() || fs::path(rel).has_root_name() || fs::path(rel).has_root_directory()) return false;
+    std::size_t start = 0;
+    for (;;) {
+        std::size_t slash = rel.find('/', start);
+        std::string_view part(rel.data() + start, (slash == std::string::npos ? rel.size() : slash) - start);
+        if (part.empty() || part == "." || part == ".." || part.find('\\') != std::string_view::npos) return false;
+        if (slash == std::string::npos) return true;
+        start = slash + 1;
+    }
+}
+
+bool load_snapshot(const fs::path& store, const std::string& name, fs::path& root, std::int64_t& created_ns,
+                   std::vector<SnapshotEntry>& entries) {
+    std::string data, r;
+    if (!read_whole_file(snapshot_path(store, name), data) || data.compare(0, 4, "FESN") != 0) return false;
+    const char* p = data.data() + 4;
+    const char* end = data.data() + data.size();
+    std::uint32_t version, count;
+    std::uint64_t created;
+    if (!get_u32(p, end, version) || version != 1 || !get_str(p, end, r) || !get_u64(p, end, created) || !get_u32(p, end, count))
+        return false;
+    root = r;
+    created_ns = static_cast<std::int64_t>(created);
+    entries.assign(count, SnapshotEntry{});
+    for (auto& e : entries) {
+        std::uint32_t mode, nchunks;
+        std::uint64_t mtime;
+        if (!get_str(p, end, e.rel) || p == end) return false;
+        // Only the first entry, the root itself, has an empty path.
+        if (&e == &entries[0] ? !e.rel.empty() : !safe_relative(e.rel)) return false;
+        e.type = static_cast<unsigned char>(*p++);
+        if (!get_u32(p, end, mode) || !get_u64(p, end, mtime) || !get_u64(p, end, e.size) || !get_u32(p, end, nchunks))
+            return false;
+        e.mode = mode;
+        e.mtime_ns = static_cast<std::int64_t>(mtime);
+        e.chunks.resize(nchunks);
+        for (auto& c : e.chunks) {
+            if (end - p < static_cast<std::ptrdiff_t>(Sha256::kSize)) return false;
+            std::memcpy(c.digest.data(), p, Sha256::kSize);
+            p += Sha256::kSize;
+            if (!get_u32(p, end, c.len)) return false;
+        }
+    }
+    return true;
+}
+
+// Chunks one file into `e.chunks`, storing new chunks. Adds to the byte counters.
+bool backup_file(const fs::path& p, SnapshotEntry& e, ChunkStore& store, std::atomic<std::uint64_t>& new_bytes,
+                 std::atomic<std::size_t>& new_chunks, std::error_code& ec) {
+    constexpr std::size_t kRead = 4 << 20;
+    auto f = vfs().open_read(p, ec);
+    if (!f) return false;
+    std::vector<unsigned char> buf;
+    std::size_t start = 0;
+    std::uint64_t off = 0;
+    bool eof = false;
+    while (!eof || start < buf.size()) {
+        // Keep a full maximum-size chunk ahead of `start` so every cut sees its whole window.
+        if (!eof && buf.size() - start < kCdcMax) {
+            buf.erase(buf.begin(), buf.begin() + static_cast<std::ptrdiff_t>(start));
+            start = 0;
+            std::size_t have = buf.size();
+            buf.resize(have + kRead);
+            auto n = f->read_at(buf.data() + have, kRead, off, ec);
+            if (n < 0) return false;
+            buf.resize(have + static_cast<std::size_t>(n));
+            off += static_cast<std::uint64_t>(n);
+            eof = n == 0;
+            io_scheduler().charge(JobClass::Copy, static_cast<std::uint64_t>(n), 0);
+            continue;
+        }
+        std::size_t len = cdc_cut(buf.data() + start, buf.size() - start);
+        ChunkRef c{Sha256::of(buf.data() + start, len), static_cast<std::uint32_t>(len)};
+        if (store.put(c.digest, buf.data() + start, len, ec)) { new_bytes += len; ++new_chunks; }
+        if (ec) return false;
+        e.chunks.push_back(c);
+        start += len;
+    }
+    io_scheduler().charge(JobClass::Copy, 0);
+    return true;
+}
+
+void backup_command(const fs::path& store_dir, const fs::path& root, std::string name, std::ostream& out = std::cout,
+                    std::ostream& err = std::cerr) {
+    ErrorReport report;
+    ChunkStore store(store_dir);
+    std::error_code ec;
+    if (!store.open(ec)) { err << "Error: " << store_dir.string() << ": " << ec.message() << "\n"; return; }
+    if (name.empty()) {
+        std::time_t t = std::time(nullptr);
+        char buf[32];
+        std::strftime(buf, sizeof(buf), "%Y%m%d-%H%M%S", std::localtime(&t));
+        name = buf;
+    }
+    if (fs::exists(snapshot_path(store_dir, name), ec)) { err << "Error: snapshot " << name << " already exists\n"; return; }
+    VfsStat rst;
+    if (!vfs().stat(root, true, 0, rst, ec) || rst.type != kTypeDir) {
+        err << "Error: " << root.string() << ": " << (ec ? ec.message() : "not a directory") << "\n";
+        return;
+    }
+    auto t0 = std::chrono::steady_clock::now();
+    std::vector<SnapshotEntry> entries(1);
+    entries[0].type = kTypeDir;
+    std::vector<fs::path> paths{root};
+    std::size_t skipped = 0;
+    auto dev = device_id(root);
+    walk_tree_parallel(root, tuner().pick(dev, OpClass::Stat), hdd_mode_for(root),
+        [](const fs::path&, const RawDirent&) { return true; },
+        [&](const fs::path& p, const RawDirent& e) {
+            if (e.type != kTypeFile && e.type != kTypeDir) { ++skipped; return; }
+            SnapshotEntry s;
+            s.rel = p.lexically_relative(root).generic_string();
+            s.type = e.type;
+            entries.push_back(std::move(s));
+            paths.push_back(p);
+        }, report);
+    unsigned threads = tuner().pick(dev, OpClass::Read);
+    parallel_for(entries.size(), threads, [&](std::size_t i) {
+        VfsStat st;
+        std::error_code sec;
+        if (!vfs().stat(paths[i], false, kWantMode | kWantSize | kWantMtime, st, sec)) { report.add(paths[i], sec); return; }
+        entries[i].mode = st.mode;
+        entries[i].mtime_ns = st.mtime_ns;
+        entries[i].size = entries[i].type == kTypeFile ? st.size : 0;
+    });
+    // Largest first, so one big file does not start last and run alone.
+    std::vector<std::size_t> files;
+    for (std::size_t i = 0; i < entries.size(); ++i)
+        if (entries[i].type == kTypeFile) files.push_back(i);
+    std::sort(files.begin(), files.end(), [&](std::size_t a, std::size_t b) { return entries[a].size > entries[b].size; });
+    std::atomic<std::uint64_t> new_bytes{0};
+    std::atomic<std::size_t> new_chunks{0};
+    std::vector<char> failed(entries.size(), 0);
+    ProgressMeter meter(JobClass::Copy, err);
+    parallel_for(files.size(), threads, [&](std::size_t k) {
+        auto i = files[k];
+        std::error_code fec;
+        if (!backup_file(paths[i], entries[i], store, new_bytes, new_chunks, fec)) { report.add(paths[i], fec); failed[i] = 1; }
+    });
+    double secs = seconds_since(t0);
+    std::vector<SnapshotEntry> kept;
+    std::uint64_t bytes = 0;
+    std::size_t nfiles = 0, nchunks = 0;
+    for (std::size_t i = 0; i < entries.size(); ++i) {
+        if (failed[i]) continue;
+        if (entries[i].type == kTypeFile) {
+            ++nfiles;
+            nchunks += entries[i].chunks.size();
+            for (const auto& c : entries[i].chunks) bytes += c.len;
+        }
+        kept.push_back(std::move(entries[i]));
+    }
+    if (!store.commit(ec) || !save_snapshot(store_dir, name, index_key_path(root), kept)) {
+        err << "Error: could not write snapshot " << name << (ec ? ": " + ec.message() : "") << "\n";
+        report.print(err, "backup");
+        return;
+    }
+    meter.finish(out);
+    out << "Snapshot " << name << ": " << nfiles << " file(s), " << kept.size() - nfiles << " dir(s), " << std::fixed
+        << std::setprecision(1) << static_cast<double>(bytes) / (1 << 20) << " MiB in " << std::setprecision(2) << secs
+        << " s (" << std::setprecision(1) << (secs > 0 ? static_cast<double>(bytes) / secs / (1 << 20) : 0.0) << " MiB/s)\n"
+        << "Chunks: " << nchunks << ", " << new_chunks.load() << " new, " << static_cast<double>(new_bytes) / (1 << 20)
+        << " MiB stored; dedup ratio "
+        << (new_bytes ? static_cast<double>(bytes) / static_cast<double>(new_bytes) : 0.0) << ":1"
+        << (new_bytes ? "" : " (nothing new)") << "\n" << std::defaultfloat;
+    if (skipped) out << "Skipped " << skipped << " entries that are neither files nor directories.\n";
+    report.print(err, "backup");
+}
+
+void restore_command(const fs::path& store_dir, const std::string& name, const fs::path& dest,
+                     std::ostream& out = std::cout, std::ostream& err = std::cerr) {
+    ErrorReport report;
+    ChunkStore store(store_dir);
+    std::error_code ec;
+    fs::path root;
+    std::int64_t created;
+    std::vector<SnapshotEntry> entries;
+    if (!store.open(ec) || !load_snapshot(store_dir, name, root, created, entries)) {
+        err << "Error: no readable snapshot " << name << " in " << store_dir.string() << " (missing or corrupt)\n";
+        return;
+    }
+    auto t0 = std::chrono::steady_clock::now();
+    auto path_of = [&](const SnapshotEntry& e) { return e.rel.empty() ? dest : dest / e.rel; };
+    std::vector<std::size_t> files, dirs;
+    for (std::size_t i = 0; i < entries.size(); ++i) (entries[i].type == kTypeDir ? dirs : files).push_back(i);
+    for (auto i : dirs)
+        if (!vfs().make_dirs(path_of(entries[i]), ec)) { report.add(path_of(entries[i]), ec); ec.clear(); }
+    std::sort(files.begin(), files.end(), [&](std::size_t a, std::size_t b) { return entries[a].size > entries[b].size; });
+    std::atomic<std::uint64_t> bytes{0};
+    ProgressMeter meter(JobClass::Copy, err);
+    parallel_for(files.size(), tuner().pick(device_id(dest), OpClass::Read), [&](std::size_t k) {
+        const auto& e = entries[files[k]];
+        fs::path p = path_of(e);
+        std::error_code fec;
+        ChunkStore::Reader reader(store);
+        std::string chunk;
+        if (!vfs().create_file(p, fec) && fec != std::errc::file_exists) { report.add(p, fec); return; }
+        fec.clear();
+        auto w = vfs().open_replace(p, fec);
+        if (!w) { report.add(p, fec); return; }
+        for (const auto& c : e.chunks) {
+            if (!reader.read(c.digest, chunk, fec) || !w->write(chunk.data(), chunk.size(), fec)) { report.add(p, fec); return; }
+            io_scheduler().charge(JobClass::Copy, chunk.size(), 0);
+            bytes += chunk.size();
+        }
+        io_scheduler().charge(JobClass::Copy, 0);
+        if (!w->commit(g_durability == Durability::File, fec) || !vfs().set_meta(p, e.mode, e.mtime_ns, fec))
+            report.add(p, fec);
+    });
+    // Directories last and deepest first: creating their contents moved their mtimes.
+    for (auto it = dirs.rbegin(); it != dirs.rend(); ++it) {
+        const auto& e = entries[*it];
+        if (!vfs().set_meta(path_of(e), e.mode, e.mtime_ns, ec)) { report.add(path_of(e), ec); ec.clear(); }
+    }
+    if (g_durability == Durability::Syncfs && !vfs().sync(dest, true, ec)) report.add(dest, ec);
+    double secs = seconds_since(t0);
+    meter.finish(out);
+    out << "Restored " << name << " (" << root.string() << ") to " << dest.string() << ": " << files.size() << " file(s), "
+        << dirs.size() << " dir(s), " << std::fixed << std::setprecision(1) << static_cast<double>(bytes) / (1 << 20)
+        << " MiB in " << std::setprecision(2) << secs << " s\n" << std::defaultfloat;
+    report.print(err, "restore");
+}
+
+void list_snapshots(const fs::path& store_dir, std::ostream& out = std::cout, std::ostream& err = std::cerr) {
+    std::error_code ec;
+    std::vector<std::string> names;
+    for (fs::directory_iterator it(store_dir / "snapshots", ec), end; !ec && it != end; it.increment(ec))
+        if (it->path().extension() == ".snap") names.push_back(it->path().stem().string());
+    if (ec) { err << "Error: " << store_dir.string() << ": " << ec.message() << "\n"; return; }
+    std::sort(names.begin(), names.end());
+    for (const auto& n : names) {
+        fs::path root;
+        std::int64_t created;
+        std::vector<SnapshotEntry> entries;
+        if (!load_snapshot(store_dir, n, root, created, entries)) { out << n << ": unreadable\n"; continue; }
+        std::uint64_t bytes = 0;
+        for (const auto& e : entries) bytes += e.size;
+        out << n << ": " << root.string() << ", " << entries.size() << " entries, " << bytes / (1 << 20) << " MiB\n";
+    }
+    out << "Snapshots: " << names.size() << "\n";
+}
+
+// ---------------- Deduplication ----------------
+// `dedupe ROOT...` groups regular files by size, then by SHA-256, and makes each group
+// share one copy on disk. It uses the FIDEDUPERANGE ioctl, in which the kernel compares the
+// bytes under lock and shares extents only where they match, so a file changed since it was
+// hashed is left alone. Groups run on workers. Each ioctl covers up to 16 MiB against up to
+// 32 destinations. With --hardlink, filesystems without reflink support (ext4, tmpfs) fall
+// back to replacing byte-identical duplicates with hard links. Only files with the same
+// permissions and owner are linked, because linked files share them.
+
+constexpr std::uint64_t kDedupeStep = 16 << 20;
+constexpr std::size_t kDedupeBatch = 32;
+
+struct DupFile {
+    fs::path path;
+    std::uint64_t size = 0, ino = 0, dev = 0;
+    unsigned mode = 0, uid = 0, gid = 0;
+};
+
+struct DedupeStats {
+    std::atomic<std::size_t> shared{0}, linked{0}, differ{0}, skipped{0};
+    std::atomic<std::uint64_t> bytes{0};
+    std::atomic<bool> unsupported{false};
+};
+
+// Groups of two or more files with identical contents (one device, distinct inodes).
+std::vector<std::vector<DupFile>> find_duplicates(const std::vector<fs::path>& roots, std::uint64_t min_size,
+                                                  ErrorReport& report) {
+    std::vector<DupFile> files;
+    for (const auto& root : roots) {
+        std::vector<fs::path> paths;
+        auto dev = device_id(root);
+        walk_tree_parallel(root, tuner().pick(dev, OpClass::Stat), hdd_mode_for(root),
+            [](const fs::path&, const RawDirent& e) { return e.type == kTypeFile; },
+            [&](const fs::path& p, const RawDirent&) { paths.push_back(p); }, report);
+        std::vector<DupFile> found(paths.size());
+        parallel_for(paths.size(), tuner().pick(dev, OpClass::Stat), [&](std::size_t i) {
+            VfsStat st;
+            std::error_code ec;
+            if (!vfs().stat(paths[i], false, kWantMode | kWantSize | kWantOwner, st, ec)) { report.add(paths[i], ec); return; }
+            found[i] = DupFile{paths[i], st.size, st.ino, device_id(paths[i]), st.mode, st.uid, st.gid};
+        });
+        for (auto& f : found)
+            if (!f.path.empty() && f.size >= std::max<std::uint64_t>(min_size, 1)) files.push_back(std::move(f));
+    }
+    // Same (dev, ino) reached twice is one file: overlapping roots or existing hard links.
+    std::sort(files.begin(), files.end(), [](const DupFile& a, const DupFile& b) {
+        return std::tie(a.size, a.dev, a.ino) < std::tie(b.size, b.dev, b.ino);
+    });
+    files.erase(std::unique(files.begin(), files.end(), [](const DupFile& a, const DupFile& b) {
+        return a.dev == b.dev && a.ino == b.ino;
+    }), files.end());
+    // Only files sharing a size with another file on the same device need hashing.
+    std::vector<std::size_t> candidates;
+    for (std::size_t i = 0; i < files.size(); ++i) {
+        bool prev = i > 0 && files[i - 1].size == files[i].size && files[i - 1].dev == files[i].dev;
+        bool next = i + 1 < files.size() && files[i + 1].size == files[i].size && files[i + 1].dev == files[i].dev;
+        if (prev || next) candidates.push_back(i);
+    }
+    std::vector<Sha256::Digest> digests(files.size());
+    std::vector<char> hashed(files.size(), 0);
+    parallel_for(candidates.size(), tuner().pick(files.empty() ? 0 : files[0].dev, OpClass::Read), [&](std::size_t k) {
+        auto i = candidates[k];
+        std::error_code ec;
+        if (hash_file(files[i].path, digests[i], ec)) hashed[i] = 1;
+        else report.add(files[i].path, ec);
+    });
+    std::map<std::tuple<std::uint64_t, std::uint64_t, Sha256::Digest>, std::vector<DupFile>> groups;
+    for (auto i : candidates)
+        if (hashed[i]) groups[std::make_tuple(files[i].dev, files[i].size, digests[i])].push_back(files[i]);
+    std::vector<std::vector<DupFile>> out;
+    for (auto& kv : groups)
+        if (kv.second.size() > 1) out.push_back(std::move(kv.second));
+    // Biggest savings first.
+    std::sort(out.begin(), out.end(), [](const auto& a, const auto& b) {
+        return a[0].size * (a.size() - 1) > b[0].size * (b.size() - 1);
+    });
+    return out;
+}
+
+#ifdef __linux__
+// Whether `a` and `b` hold the same bytes right now.
+bool same_contents(const fs::path& a, const fs::path& b, std::error_code& ec) {
+    constexpr std::size_t kBlock = 1 << 20;
+    auto fa = vfs().open_read(a, ec);
+    auto fb = fa ? vfs().open_read(b, ec) : nullptr;
+    if (!fb || fa->size() != fb->size()) return false;
+    std::vector<char> x(kBlock), y(kBlock);
+    for (std::uint64_t off = 0;;) {
+        auto n = fa->read_at(x.data(), kBlock, off, ec);
+        auto m = n < 0 ? n : fb->read_at(y.data(), kBlock, off, ec);
+        if (n < 0 || m < 0 || n != m) return false;
+        if (n == 0) return true;
+        if (std::memcmp(x.data(), y.data(), static_cast<std::size_t>(n)) != 0) return false;
+        off += static_cast<std::uint64_t>(n);
+    }
+}
+
+// Replaces `dup` with a hard link to `keep`: link beside it, then rename over it.
+bool link_duplicate(const DupFile& keep, const DupFile& dup, DedupeStats& stats, ErrorReport& report) {
+    if (keep.mode != dup.mode || keep.uid != dup.uid || keep.gid != dup.gid) { ++stats.skipped; return false; }
+    std::error_code ec;
+    if (!same_contents(keep.path, dup.path, ec)) {
+        if (ec) report.add(dup.path, ec);
+        else ++stats.differ;
+        return false;
+    }
+    fs::path tmp = dup.path.parent_path() / ("." + dup.path.filename().string() + ".fe-link");
+    if (::link(keep.path.c_str(), tmp.c_str()) != 0) { set_errno(ec, errno); report.add(dup.path, ec); return false; }
+    if (::rename(tmp.c_str(), dup.path.c_str()) != 0) {
+        set_errno(ec, errno);
+        ::unlink(tmp.c_str());
+        report.add(dup.path, ec);
+        return false;
+    }
+    ++stats.linked;
+    stats.bytes += dup.size;
+    return true;
+}
+
+// Shares group[0]'s extents with every other member through FIDEDUPERANGE.
+void dedupe_group(const std::vector<DupFile>& group, bool hardlink, DedupeStats& stats, ErrorReport& report) {
+    const DupFile& keep = group[0];
+    int src = ::open(keep.path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (src < 0) { report.add(keep.path, std::error_code(errno, std::generic_category())); return; }
+    for (std::size_t first = 1; first < group.size(); first += kDedupeBatch) {
+        std::size_t n = std::min(kDedupeBatch, group.size() - first);
+        std::vector<int> fds(n, -1);
+        std::vector<std::uint64_t> done(n, 0);
+        std::vector<char> active(n, 0);
+        for (std::size_t j = 0; j < n; ++j) {
+            const auto& d = group[first + j];
+            // Owners may dedupe into files they only read; others need write access.
+            fds[j] = ::open(d.path.c_str(), O_RDWR | O_CLOEXEC);
+            if (fds[j] < 0) fds[j] = ::open(d.path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fds[j] < 0) report.add(d.path, std::error_code(errno, std::generic_category()));
+            else active[j] = 1;
+        }
+        std::vector<unsigned char> buf(sizeof(file_dedupe_range) + n * sizeof(file_dedupe_range_info));
+        bool unsupported = false;
+        int batch_error = 0; // ioctl failure that stopped this batch
+        // The kernel may share less than asked for, so each destination keeps its own position
+        // and every call resumes the destinations that are furthest behind.
+        while (!unsupported) {
+            std::uint64_t off = keep.size;
+            for (std::size_t j = 0; j < n; ++j)
+                if (active[j]) off = std::min(off, done[j]);
+            if (off >= keep.size) break;
+            std::uint64_t len = std::min(kDedupeStep, keep.size - off);
+            std::fill(buf.begin(), buf.end(), 0);
+            auto* r = reinterpret_cast<file_dedupe_range*>(buf.data());
+            r->src_offset = off;
+            r->src_length = len;
+            std::vector<std::size_t> slot;
+            for (std::size_t j = 0; j < n; ++j) {
+                if (!active[j] || done[j] != off) continue;
+                r->info[slot.size()].dest_fd = fds[j];
+                r->info[slot.size()].dest_offset = off;
+                slot.push_back(j);
+            }
+            r->dest_count = static_cast<std::uint16_t>(slot.size());
+            if (::ioctl(src, FIDEDUPERANGE, r) != 0) {
+                int e = errno;
+                if (e == EOPNOTSUPP || e == ENOTTY || e == EXDEV) unsupported = true;
+                else batch_error = e;
+                break;
+            }
+            for (std::size_t s = 0; s < slot.size(); ++s) {
+                const auto& info = r->info[s];
+                auto j = slot[s];
+                if (info.status == FILE_DEDUPE_RANGE_SAME && info.bytes_deduped > 0) {
+                    done[j] += info.bytes_deduped;
+                } else {
+                    active[j] = 0;
+                    // A match that shares nothing would be retried forever; report it instead.
+                    int e = info.status < 0 ? -info.status : EAGAIN;
+                    if (info.status == FILE_DEDUPE_RANGE_DIFFERS) ++stats.differ;
+                    else report.add(group[first + j].path, std::error_code(e, std::generic_category()));
+                }
+            }
+        }
+        for (std::size_t j = 0; j < n; ++j) {
+            if (fds[j] >= 0) ::close(fds[j]);
+            if (unsupported) continue;
+            stats.bytes += done[j];
+            // Only fully shared files count; ones a failed call left part-way are errors.
+            if (done[j] == keep.size) ++stats.shared;
+            else if (active[j])
+                report.add(group[first + j].path, std::error_code(batch_error, std::generic_category()));
+        }
+        if (unsupported) {
+            stats.unsupported = true;
+            if (hardlink)
+                for (std::size_t j = 0; j < n; ++j) link_duplicate(keep, group[first + j], stats, report);
+        }
+    }
+    ::close(src);
+}
+#endif
+
+void dedupe_command(const std::vector<fs::path>& roots, bool dry_run, bool hardlink, std::uint64_t min_size,
+                    std::ostream& out = std::cout, std::ostream& err = std::cerr) {
+    ErrorReport report;
+    auto t0 = std::chrono::steady_clock::now();
+    std::size_t hits0 = hash_cache().hits(), misses0 = hash_cache().misses();
+    auto groups = find_duplicates(roots, min_size, report);
+    std::size_t cached = hash_cache().hits() - hits0, read = hash_cache().misses() - misses0;
+    out << "Hashed " << cached + read << " file(s): " << cached << " from cache, " << read << " read\n";
+    std::uint64_t reclaimable = 0;
+    std::size_t dups = 0;
+    for (const auto& g : groups) {
+        reclaimable += g[0].size * (g.size() - 1);
+        dups += g.size() - 1;
+    }
+    if (dry_run) {
+        for (const auto& g : groups) {
+            out << g.size() << " x " << g[0].size << " bytes:\n";
+            for (const auto& f : g) out << "  " << f.path.string() << "\n";
+        }
+        out << "Groups: " << groups.size() << ", " << dups << " duplicate(s), " << std::fixed << std::setprecision(1)
+            << static_cast<double>(reclaimable) / (1 << 20) << " MiB reclaimable\n" << std::defaultfloat;
+        report.print(err, "dedupe");
+        return;
+    }
+#ifdef __linux__
+    if (!vfs().real()) { err << "Error: dedupe needs a real filesystem\n"; return; }
+    DedupeStats stats;
+    parallel_for(groups.size(), tuner().pick(groups.empty() ? 0 : groups[0][0].dev, OpClass::Read), [&](std::size_t i) {
+        dedupe_group(groups[i], hardlink, stats, report);
+    });
+    out << "Groups: " << groups.size() << ", " << dups << " duplicate(s): " << stats.shared.load() << " shared, "
+        << stats.linked.load() << " hard-linked, " << stats.differ.load() << " changed since hashing";
+    if (stats.skipped) out << ", " << stats.skipped.load() << " not linked (permissions or owner differ)";
+    out << "\n" << std::fixed << std::setprecision(1) << static_cast<double>(stats.bytes.load()) / (1 << 20) << " of "
+        << static_cast<double>(reclaimable) / (1 << 20) << " MiB reclaimed in " << std::setprecision(2) << seconds_since(t0)
+        << " s\n" << std::defaultfloat;
+    if (stats.unsupported && !hardlink)
+        out << "This filesystem cannot share extents; --hardlink replaces duplicates with hard links instead.\n";
+#else
+    (void)hardlink;
+    (void)t0;
+    err << "Error: dedupe is only supported on Linux\n";
+#endif
+    report.print(err, "dedupe");
+}
+
+// ---------------- Change detection ----------------
+// `changed ROOT` keeps a Merkle summary of ROOT: per directory, a SHA-256 over its files'
+// names, sizes and mtimes and its subdirectories' names and hashes. A later run stats every
+// directory and re-reads only those whose mtime moved. Hashes are recomputed only on the
+// paths from those directories up to the root; everything else keeps its cached hash. A
+// directory's mtime moves when entries are added, removed or renamed, but not when a file
+// is rewritten in place. `--full` also stats the files of unchanged directories (still
+// without reading them) to catch that.
+
+struct MerkleFile {
+    std::string name;
+    std::uint64_t size = 0;
+    std::int64_t mtime_ns = 0;
+
+    bool operator==(const MerkleFile& o) const { return name == o.name && size == o.size && mtime_ns == o.mtime_ns; }
+};
+
+struct MerkleDir {
+    std::int64_t mtime_ns = 0;
+    Sha256::Digest digest{};
+    std::vector<MerkleFile> files;    // by name; symlinks and devices too, with lstat data
+    std::vector<std::string> subdirs; // by name
+};
+
+struct MerkleTree {
+    fs::path root;
+    std::int64_t built_ns = 0;
+    std::unordered_map<std::string, MerkleDir> dirs; // by rel, "" for the root
+
+    std::string serialize() const {
+        std::string b = "FEMK";
+        put_u32(b, 1);
+        put_str(b, root.generic_string());
+        put_u64(b, static_cast<std::uint64_t>(built_ns));
+        put_u32(b, static_cast<std::uint32_t>(dirs.size()));
+        for (const auto& kv : dirs) {
+            const MerkleDir& d = kv.second;
+            put_str(b, kv.first);
+            put_u64(b, static_cast<std::uint64_t>(d.mtime_ns));
+            b.append(reinterpret_cast<const char*>(d.digest.data()), d.digest.size());
+            put_u32(b, static_cast<std::uint32_t>(d.files.size()));
+            for (const auto& f : d.files) {
+                put_str(b, f.name);
+                put_u64(b, f.size);
+                put_u64(b, static_cast<std::uint64_t>(f.mtime_ns));
+            }
+            put_u32(b, static_cast<std::uint32_t>(d.subdirs.size()));
+            for (const auto& s : d.subdirs) put_str(b, s);
+        }
+        return b;
+    }
+
+    bool parse(const std::string& data) {
+        if (data.compare(0, 4, "FEMK") != 0) return false;
+        const char* p = data.data() + 4;
+        const char* end = data.data() + data.size();
+        std::uint32_t version, count;
+        std::uint64_t built;
+        std::string r;
+        if (!get_u32(p, end, version) || version != 1 || !get_str(p, end, r) || !get_u64(p, end, built) || !get_u32(p, end, count))
+            return false;
+        root = r;
+        built_ns = static_cast<std::int64_t>(built);
+        for (std::uint32_t i = 0; i < count; ++i) {
+            std::string rel;
+            MerkleDir d;
+            std::uint64_t mtime;
+            std::uint32_t nfiles, nsub;
+            if (!get_str(p, end, rel) || !get_u64(p, end, mtime) || end - p < static_cast<std::ptrdiff_t>(Sha256::kSize))
+                return false;
+            d.mtime_ns = static_cast<std::int64_t>(mtime);
+            std::memcpy(d.digest.data(), p, Sha256::kSize);
+            p += Sha256::kSize;
+            if (!get_u32(p, end, nfiles)) return false;
+            d.files.resize(nfiles);
+            for (auto& f : d.files) {
+                std::uint64_t fm;
+                if (!get_str(p, end, f.name) || !get_u64(p, end, f.size) || !get_u64(p, end, fm)) return false;
+                f.mtime_ns = static_cast<std::int64_t>(fm);
+            }
+            if (!get_u32(p, end, nsub)) return false;
+            d.subdirs.resize(nsub);
+            for (auto& s : d.subdirs)
+                if (!get_str(p, end, s)) return false;
+            dirs.emplace(std::move(rel), std::move(d));
+        }
+        return true;
+    }
+};
+
+struct MerkleChange {
+    std::string rel;
+    std::size_t added = 0, removed = 0, modified = 0;
+};
+
+// Differences between two name-sorted listings of one directory.
+void diff_listing(const MerkleDir& a, const MerkleDir& b, MerkleChange& c) {
+    auto diff = [&](const auto& x, const auto& y, auto name, auto same) {
+        std::size_t i = 0, j = 0;
+        while (i < x.size() || j < y.size()) {
+            if (j == y.size() || (i < x.size() && name(x[i]) < name(y[j]))) { ++c.removed; ++i; }
+            else if (i == x.size() || name(y[j]) < name(x[i])) { ++c.added; ++j; }
+            else { c.modified += !same(x[i], y[j]); ++i; ++j; }
+        }
+    };
+    diff(a.files, b.files, [](const MerkleFile& f) -> const std::string& { return f.name; },
+         [](const MerkleFile& f, const MerkleFile& g) { return f == g; });
+    diff(a.subdirs, b.subdirs, [](const std::string& s) -> const std::string& { return s; },
+         [](const std::string&, const std::string&) { return true; });
+}
+
+struct MerkleStats {
+    std::size_t dirs = 0, reread = 0, rehashed = 0, files_statted = 0;
+};
+
+// Brings `prev` (possibly empty) up to date into `next`, recording changed directories.
+void refresh_merkle(const fs::path& root, const MerkleTree& prev, bool full, MerkleTree& next,
+                    std::vector<MerkleChange>& changes, MerkleStats& stats, ErrorReport& report) {
+    struct Node {
+        std::string rel;
+        MerkleDir dir;
+        bool ok = false, dirty = false;
+    };
+    next.root = index_key_path(root);
+    next.built_ns = now_unix_ns();
+    auto path_of = [&](const std::string& rel) { return rel.empty() ? root : root / rel; };
+    auto dev = device_id(root);
+    unsigned threads = tuner().pick(dev, OpClass::Stat);
+    std::mutex mu;
+    std::vector<std::vector<Node>> levels;
+    std::vector<Node> level(1);
+    // Top-down: stat every directory, list only the ones that changed.
+    while (!level.empty()) {
+        parallel_for(level.size(), threads, [&](std::size_t i) {
+            Node& n = level[i];
+            fs::path dir = path_of(n.rel);
+            std::error_code ec;
+            VfsStat st;
+            if (!vfs().stat(dir, false, kWantMtime, st, ec)) { report.add(dir, ec); return; }
+            n.dir.mtime_ns = st.mtime_ns;
+            auto old = prev.dirs.find(n.rel);
+            bool have_old = old != prev.dirs.end();
+            std::size_t statted = 0;
+            bool reread = false;
+            if (have_old && old->second.mtime_ns == st.mtime_ns && st.mtime_ns < prev.built_ns - PathIndex::kRacyNs) {
+                n.dir.files = old->second.files;
+                n.dir.subdirs = old->second.subdirs;
+                if (full)
+                    for (auto& f : n.dir.files) {
+                        VfsStat fst;
+                        std::error_code fec;
+                        ++statted;
+                        if (vfs().stat(dir / f.name, false, kWantSize | kWantMtime, fst, fec)) {
+                            f.size = fst.size;
+                            f.mtime_ns = fst.mtime_ns;
+                        } else {
+                            f.size = UINT64_MAX; // gone or unreadable: counts as modified
+                        }
+                    }
+            } else {
+                std::vector<RawDirent> ents;
+                if (!read_dir_raw(dir, ents, ec)) { report.add(dir, ec); return; }
+                reread = true;
+                for (auto& e : ents) {
+                    if (e.type == 0) e.type = lstat_type(dir / e.name);
+                    if (e.type == kTypeDir) { n.dir.subdirs.push_back(e.name); continue; }
+                    MerkleFile f{e.name, 0, 0};
+                    VfsStat fst;
+                    std::error_code fec;
+                    ++statted;
+                    if (vfs().stat(dir / e.name, false, kWantSize | kWantMtime, fst, fec)) {
+                        f.size = fst.size;
+                        f.mtime_ns = fst.mtime_ns;
+                    }
+                    n.dir.files.push_back(std::move(f));
+                }
+                std::sort(n.dir.files.begin(), n.dir.files.end(),
+                          [](const MerkleFile& a, const MerkleFile& b) { return a.name < b.name; });
+                std::sort(n.dir.subdirs.begin(), n.dir.subdirs.end());
+            }
+            MerkleChange c{n.rel};
+            if (have_old) diff_listing(old->second, n.dir, c);
+            n.dirty = !have_old || c.added || c.removed || c.modified;
+            std::lock_guard<std::mutex> lk(mu);
+            stats.reread += reread;
+            stats.files_statted += statted;
+            if (have_old && n.dirty) changes.push_back(c);
+            n.ok = true;
+        });
+        std::vector<Node> below;
+        for (const auto& n : level)
+            if (n.ok)
+                for (const auto& s : n.dir.subdirs) {
+                    below.emplace_back();
+                    below.back().rel = n.rel.empty() ? s : n.rel + "/" + s;
+                }
+        levels.push_back(std::move(level));
+        level = std::move(below);
+    }
+    // Bottom-up: rehash a directory only if it or a subdirectory's hash changed.
+    for (auto lv = levels.rbegin(); lv != levels.rend(); ++lv) {
+        parallel_for(lv->size(), threads, [&](std::size_t i) {
+            Node& n = (*lv)[i];
+            if (!n.ok) return;
+            std::vector<const Sha256::Digest*> kids;
+            for (const auto& s : n.dir.subdirs) {
+                auto it = next.dirs.find(n.rel.empty() ? s : n.rel + "/" + s);
+                kids.push_back(it == next.dirs.end() ? nullptr : &it->second.digest);
+            }
+            auto old = prev.dirs.find(n.rel);
+            bool dirty = n.dirty || old == prev.dirs.end();
+            for (std::size_t k = 0; !dirty && k < kids.size(); ++k) {
+                auto o = prev.dirs.find(n.rel.empty() ? n.dir.subdirs[k] : n.rel + "/" + n.dir.subdirs[k]);
+                dirty = !kids[k] || o == prev.dirs.end() || o->second.digest != *kids[k];
+            }
+            if (!dirty) { n.dir.digest = old->second.digest; return; }
+            Sha256 h;
+            for (const auto& f : n.dir.files) {
+                h.update("f", 1);
+                h.update(f.name.c_str(), f.name.size() + 1);
+                h.update(&f.size, sizeof(f.size));
+                h.update(&f.mtime_ns, sizeof(f.mtime_ns));
+            }
+            for (std::size_t k = 0; k < kids.size(); ++k) {
+                h.update("d", 1);
+                h.update(n.dir.subdirs[k].c_str(), n.dir.subdirs[k].size() + 1);
+                if (kids[k]) h.update(kids[k]->data(), kids[k]->size());
+            }
+            n.dir.digest = h.final();
+            std::lock_guard<std::mutex> lk(mu);
+            ++stats.rehashed;
+        });
+        // Published after the level finishes: the level above reads these while hashing.
+        for (auto& n : *lv)
+            if (n.ok) {
+                ++stats.dirs;
+                next.dirs.emplace(std::move(n.rel), std::move(n.dir));
+            }
+    }
+    std::sort(changes.begin(), changes.end(), [](const MerkleChange& a, const MerkleChange& b) { return a.rel < b.rel; });
+}
+
+// Returns true when something under `root` changed since the last run.
+bool changed_command(const fs::path& root, bool full, std::ostream& out = std::cout, std::ostream& err = std::cerr) {
+    constexpr std::size_t kShown = 20;
+    ErrorReport report;
+    auto t0 = std::chrono::steady_clock::now();
+    std::string file = index_file(root, ".merkle"), data;
+    MerkleTree prev, next;
+    bool have_prev = read_whole_file(file, data) && prev.parse(data);
+    std::vector<MerkleChange> changes;
+    MerkleStats stats;
+    refresh_merkle(root, prev, full, next, changes, stats, report);
+    auto root_of = [](const MerkleTree& t) { auto it = t.dirs.find(""); return it == t.dirs.end() ? nullptr : &it->second; };
+    const MerkleDir* now = root_of(next);
+    if (!now) { report.print(err, "changed"); return false; }
+    write_whole_file(file, next.serialize());
+    bool changed = have_prev && root_of(prev) && root_of(prev)->digest != now->digest;
+    if (!have_prev) {
+        out << "Recorded " << stats.dirs << " directories under " << root.string() << " (" << hex_digest(now->digest).substr(0, 16) << ").\n";
+    } else if (!changed) {
+        out << "No changes under " << root.string() << " since " << (next.built_ns - prev.built_ns) / 1000000000 << " s ago.\n";
+    } else {
+        out << "Changed under " << root.string() << ": " << changes.size() << " director" << (changes.size() == 1 ? "y" : "ies") << "\n";
+        for (std::size_t i = 0; i < changes.size() && i < kShown; ++i) {
+            const auto& c = changes[i];
+            out << "  " << (c.rel.empty() ? "." : c.rel) << ": +" << c.added << " -" << c.removed << " ~" << c.modified << "\n";
+        }
+        if (changes.size() > kShown) out << "  ... " << changes.size() - kShown << " more\n";
+    }
+    out << "(" << stats.dirs << " directories checked, " << stats.reread << " read, " << stats.rehashed << " rehashed, "
+        << stats.files_statted << " files statted in " << std::fixed << std::setprecision(3) << seconds_since(t0) << " s)\n"
+        << std::defaultfloat;
+    report.print(err, "changed");
+    return changed;
+}
+
+// ---------------- Daemon mode ----------------
+// `--daemon[=SOCK]` serves list, stat, search, filter, copy and delete over a Unix domain socket,
+// so every client shares one process's prefetch cache, learned tuning and worker pool.
+// Parallel passes inside requests draw helper threads from one process-wide budget
+// (g_max_helpers, 4 per core), so the thread count stays bounded however many run.
+// Only clients running as the daemon's own user are accepted (SO_PEERCRED), since
+// requests execute with the daemon's privileges.
+//
+// All integers are little-endian; a string is u32 length + bytes.
+//   request:  u32 length | u32 id | u8 op | u8 format | string args...
+//   response: u32 length | u32 id | u8 status | string stdout | string stderr
+// Clients may pipeline requests; responses carry the request id and may arrive out of order.
+// A connection stops being read while kMaxInFlight of its requests are unanswered, and at
+// most kMaxConnections clients are served at once; further ones are closed on accept.
+// Workers only queue finished responses; each connection has its own writer thread, so a
+// client that stops reading stalls itself, not the pool. Its connection is dropped once
+// kMaxQueuedBytes of responses are waiting or a send blocks for kSendTimeout.
+
+#ifndef _WIN32
+
+enum class DaemonOp : std::uint8_t { List = 1, Stat, Search, Filter, Copy, Delete };
+constexpr std::uint32_t kMaxFrame = 1u << 20;
+constexpr unsigned kMaxInFlight = 64;
+constexpr unsigned kMaxConnections = 64;
+constexpr std::size_t kMaxQueuedBytes = 64u << 20;
+constexpr int kSendTimeout = 10; // seconds
+
+std::string default_socket_path() {
+    const char* dir = std::getenv("XDG_RUNTIME_DIR");
+    if (dir && *dir) return std::string(dir) + "/file_explorer.sock";
+    return "/tmp/file_explorer-" + std::to_string(::getuid()) + ".sock";
+}
+
+bool read_full(int fd, void* buf, std::size_t n) {
+    auto* c = static_cast<char*>(buf);
+    while (n > 0) {
+        ssize_t r = ::read(fd, c, n);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return false;
+        c += r;
+        n -= static_cast<std::size_t>(r);
+    }
+    return true;
+}
+
+bool write_full(int fd, const void* buf, std::size_t n) {
+    auto* c = static_cast<const char*>(buf);
+    while (n > 0) {
+        ssize_t r = ::write(fd, c, n);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return false;
+        c += r;
+        n -= static_cast<std::size_t>(r);
+    }
+    return true;
+}
+
+// Reads one length-prefixed frame into `body`.
+bool read_frame(int fd, std::string& body) {
+    char hdr[4];
+    if (!read_full(fd, hdr, 4)) return false;
+    const char* p = hdr;
+    std::uint32_t len;
+    get_u32(p, hdr + 4, len);
+    if (len > kMaxFrame) return false;
+    body.resize(len);
+    return len == 0 || read_full(fd, &body[0], len);
+}
+
+// Fixed set of threads draining a job queue; shared by every daemon connection.
+class WorkerPool {
+public:
+    explicit WorkerPool(unsigned n) {
+        for (unsigned i = 0; i < n; ++i)
+            threads_.emplace_back([this] {
+                for (;;) {
+                    std::function<void()> job;
+                    {
+                        std::unique_lock<std::mutex> lk(mu_);
+                        cv_.wait(lk, [this] { return stop_ || !jobs_.empty(); });
+                        if (stop_ && jobs_.empty()) return;
+                        job = std::move(jobs_.front());
+                        jobs_.pop_front();
+                    }
+                    job();
+                }
+            });
+    }
+
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        for (auto& t : threads_) t.join();
+    }
+
+    void submit(std::function<void()> job) {
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            jobs_.push_back(std::move(job));
+        }
+        cv_.notify_one();
+    }
+
+private:
+    std::mutex mu_;
+    std::condition_variable cv_;
+    std::deque<std::function<void()>> jobs_;
+    std::vector<std::thread> threads_;
+    bool stop_ = false;
+};
+
+// Runs one request against the shared in-process state. Returns the response status.
+std::uint8_t serve_request(DaemonOp op, const std::vector<std::string>& args, std::ostream& out, std::ostream& err) {
+    switch (op) {
+        case DaemonOp::List:
+            if (args.empty()) break;
+            g_columns = args.size() > 1 ? static_cast<unsigned>(std::strtoul(args[1].c_str(), nullptr, 10)) : kDefaultColumns;
+            list_dir(args[0], out, err);
+            return 0;
+        case DaemonOp::Stat:
+            if (args.size() != 1) break;
+            stat_path(args[0], out, err);
+            return 0;
+        case DaemonOp::Search:
+            if (args.size() != 2) break;
+            search_recursive(args[0], args[1], out, err);
+            return 0;
+        case DaemonOp::Filter:
+            if (args.size() != 2) break;
+            filter_search(args[0], args[1], out, err);
+            return 0;
+        case DaemonOp::Copy:
+            if (args.size() != 2) break;
+            copy_path(args[0], args[1], out, err);
+            return 0;
+        case DaemonOp::Delete:
+            if (args.size() != 1) break;
+            delete_path(args[0], out, err);
+            return 0;
+    }
+    err << "Bad request.\n";
+    return 1;
+}
+
+struct DaemonConn {
+    int fd;
+    std::mutex mu;
+    std::condition_variable drained, ready;
+    unsigned in_flight = 0;          // submitted, response not yet written
+    std::deque<std::string> replies; // finished responses waiting for the writer
+    std::size_t queued_bytes = 0;
+    bool closing = false; // reader is done; the writer exits once replies are empty
+    bool dead = false;    // send failed or the client fell too far behind
+    explicit DaemonConn(int f) : fd(f) {}
+    ~DaemonConn() { ::close(fd); }
+
+    // Called with `mu` held. Wakes the reader, which stops at its next read.
+    void drop() {
+        if (dead) return;
+        dead = true;
+        ::shutdown(fd, SHUT_RDWR);
+    }
+};
+
+// Sends queued responses in order; after a failure the rest are discarded.
+void write_replies(std::shared_ptr<DaemonConn> conn) {
+    std::unique_lock<std::mutex> lk(conn->mu);
+    for (;;) {
+        conn->ready.wait(lk, [&] { return conn->closing || !conn->replies.empty(); });
+        if (conn->replies.empty()) return;
+        std::string resp = std::move(conn->replies.front());
+        conn->replies.pop_front();
+        conn->queued_bytes -= resp.size();
+        bool skip = conn->dead;
+        lk.unlock();
+        bool ok = skip || write_full(conn->fd, resp.data(), resp.size());
+        lk.lock();
+        if (!ok) conn->drop();
+        --conn->in_flight;
+        conn->drained.notify_all();
+    }
+}
+
+std::atomic<unsigned> g_connections{0};
+
+void serve_connection(std::shared_ptr<DaemonConn> conn, WorkerPool& pool) {
+    timeval tv{kSendTimeout, 0};
+    ::setsockopt(conn->fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    std::thread writer(write_replies, conn);
+    std::string body;
+    for (;;) {
+        // Leave further requests in the socket until responses drain, so a client that
+        // pipelines without reading cannot grow the queue.
+        {
+            std::unique_lock<std::mutex> lk(conn->mu);
+            conn->drained.wait(lk, [&] { return conn->dead || conn->in_flight < kMaxInFlight; });
+            if (conn->dead) break;
+        }
+        if (!read_frame(conn->fd, body)) break;
+        const char* p = body.data();
+        const char* end = p + body.size();
+        std::uint32_t id;
+        if (!get_u32(p, end, id) || end - p < 2) break;
+        auto op = static_cast<DaemonOp>(static_cast<unsigned char>(*p++));
+        auto fmt = static_cast<OutputFormat>(static_cast<unsigned char>(*p++));
+        if (fmt > OutputFormat::Binary) break;
+        std::vector<std::string> args;
+        std::string a;
+        while (p < end && get_str(p, end, a)) args.push_back(a);
+        if (p != end) break;
+        {
+            std::lock_guard<std::mutex> lk(conn->mu);
+            ++conn->in_flight;
+        }
+        pool.submit([conn, id, op, fmt, args = std::move(args)] {
+            std::ostringstream out, err;
+            g_format = fmt;
+            std::uint8_t status = serve_request(op, args, out, err);
+            std::string resp, payload;
+            put_u32(payload, id);
+            payload.push_back(static_cast<char>(status));
+            put_str(payload, out.str());
+            put_str(payload, err.str());
+            put_u32(resp, static_cast<std::uint32_t>(payload.size()));
+            resp += payload;
+            std::lock_guard<std::mutex> lk(conn->mu);
+            if (conn->queued_bytes + resp.size() > kMaxQueuedBytes) conn->drop();
+            if (conn->dead) {
+                --conn->in_flight;
+                conn->drained.notify_all();
+                return;
+            }
+            conn->queued_bytes += resp.size();
+            conn->replies.push_back(std::move(resp));
+            conn->ready.notify_one();
+        });
+    }
+    // The slot is held until queued requests finish, so closed clients still count.
+    {
+        std::unique_lock<std::mutex> lk(conn->mu);
+        conn->drained.wait(lk, [&] { return conn->in_flight == 0; });
+        conn->closing = true;
+        conn->ready.notify_one();
+    }
+    writer.join();
+    --g_connections;
+}
+
+int run_daemon(const std::string& sock) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (sock.size() >= sizeof(addr.sun_path)) { std::cerr << "Socket path too long.\n"; return 1; }
+    std::memcpy(addr.sun_path, sock.c_str(), sock.size() + 1);
+    int lfd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (lfd < 0) { std::cerr << "Error: " << std::generic_category().message(errno) << "\n"; return 1; }
+    // Replace a stale socket, but never steal one from a live daemon.
+    if (::connect(lfd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0) {
+        std::cerr << "A daemon is already listening on " << sock << "\n";
+        ::close(lfd);
+        return 1;
+    }
+    ::close(lfd);
+    ::unlink(sock.c_str());
+    lfd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    mode_t old_mask = ::umask(077);
+    int rc = ::bind(lfd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+    ::umask(old_mask);
+    if (rc != 0 || ::listen(lfd, 64) != 0) {
+        std::cerr << "Error: " << std::generic_category().message(errno) << "\n";
+        ::close(lfd);
+        return 1;
+    }
+    ::signal(SIGPIPE, SIG_IGN);
+    WorkerPool pool(std::max(4u, std::thread::hardware_concurrency()));
+    g_max_helpers = 4 * std::max(4u, std::thread::hardware_concurrency());
+    std::cerr << "Daemon listening on " << sock << "\n";
+    for (;;) {
+        int cfd = ::accept4(lfd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (cfd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            std::cerr << "Error: " << std::generic_category().message(errno) << "\n";
+            break;
+        }
+        struct ucred cred;
+        socklen_t len = sizeof(cred);
+        if (::getsockopt(cfd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0 || cred.uid != ::getuid()) {
+            ::close(cfd);
+            continue;
+        }
+        if (g_connections >= kMaxConnections) {
+            ::close(cfd);
+            continue;
+        }
+        ++g_connections;
+        std::thread(serve_connection, std::make_shared<DaemonConn>(cfd), std::ref(pool)).detach();
+    }
+    ::close(lfd);
+    ::unlink(sock.c_str());
+    return 1;
+}
+
+class DaemonClient {
+public:
+    ~DaemonClient() { if (fd_ >= 0) ::close(fd_); }
+
+    bool connect(const std::string& sock) {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (sock.size() >= sizeof(addr.sun_path)) return false;
+        std::memcpy(addr.sun_path, sock.c_str(), sock.size() + 1);
+        fd_ = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd_ < 0) return false;
+        if (::connect(fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+            ::close(fd_);
+            fd_ = -1;
+            return false;
+        }
+        return true;
+    }
+
+    // Sends a request without waiting for its response; returns its id (0 on failure).
+    std::uint32_t send(DaemonOp op, OutputFormat fmt, const std::vector<std::string>& args) {
+        std::uint32_t id = next_id_++;
+        std::string payload, frame;
+        put_u32(payload, id);
+        payload.push_back(static_cast<char>(op));
+        payload.push_back(static_cast<char>(fmt));
+        for (const auto& a : args) put_str(payload, a);
+        put_u32(frame, static_cast<std::uint32_t>(payload.size()));
+        frame += payload;
+        return write_full(fd_, frame.data(), frame.size()) ? id : 0;
+    }
+
+    // Waits for the response to `id`, parking responses to other pipelined requests.
+    bool receive(std::uint32_t id, std::uint8_t& status, std::string& out, std::string& err) {
+        while (!pending_.count(id)) {
+            std::string body;
+            if (!read_frame(fd_, body)) return false;
+            const char* p = body.data();
+            const char* end = p + body.size();
+            std::uint32_t rid;
+            Response r;
+            if (!get_u32(p, end, rid) || p == end) return false;
+            r.status = static_cast<std::uint8_t>(*p++);
+            if (!get_str(p, end, r.out) || !get_str(p, end, r.err)) return false;
+            pending_[rid] = std::move(r);
+        }
+        auto& r = pending_[id];
+        status = r.status;
+        out = std::move(r.out);
+        err = std::move(r.err);
+        pending_.erase(id);
+        return true;
+    }
+
+    // Sends a request and copies its output to the local streams. Returns false on I/O errors.
+    bool call(DaemonOp op, const std::vector<std::string>& args, std::ostream& out = std::cout,
+              std::ostream& err = std::cerr) {
+        std::uint8_t status;
+        std::string o, e;
+        std::uint32_t id = send(op, g_format, args);
+        if (id == 0 || !receive(id, status, o, e)) {
+            err << "Lost connection to daemon.\n";
+            return false;
+        }
+        out << o;
+        err << e;
+        return true;
+    }
+
+private:
+    struct Response {
+        std::uint8_t status = 0;
+        std::string out, err;
+    };
+    int fd_ = -1;
+    std::uint32_t next_id_ = 1;
+    std::map<std::uint32_t, Response> pending_;
+};
+
+#endif
+
+// ---------------- Front end ----------------
+// Menu and command-line actions run locally, or are forwarded to a daemon after --connect.
+
+#ifndef _WIN32
+DaemonClient* g_client = nullptr;
+
+std::string absolute_string(const fs::path& p) {
+    std::error_code ec;
+    auto a = fs::absolute(p, ec);
+    return (ec ? p : a).string();
+}
+#endif
+
+void explorer_list(const fs::path& dir) {
+#ifndef _WIN32
+    if (g_client) { g_client->call(DaemonOp::List, {absolute_string(dir), std::to_string(g_columns)}); return; }
+#endif
+    list_dir(dir);
+}
+
+void explorer_stat(const fs::path& p) {
+#ifndef _WIN32
+    if (g_client) { g_client->call(DaemonOp::Stat, {absolute_string(p)}); return; }
+#endif
+    stat_path(p);
+}
+
+void explorer_search(const fs::path& root, const std::string& needle) {
+#ifndef _WIN32
+    if (g_client) { g_client->call(DaemonOp::Search, {absolute_string(root), needle}); return; }
+#endif
+    search_recursive(root, needle);
+}
+
+void explorer_filter(const fs::path& root, const std::string& query) {
+#ifndef _WIN32
+    if (g_client) { g_client->call(DaemonOp::Filter, {absolute_string(root), query}); return; }
+#endif
+    filter_search(root, query);
+}
+
+void explorer_copy(const fs::path& from, const fs::path& to) {
+#ifndef _WIN32
+    if (g_client) { g_client->call(DaemonOp::Copy, {absolute_string(from), absolute_string(to)}); return; }
+#endif
+    copy_path(from, to);
+}
+
+void explorer_delete(const fs::path& p) {
+#ifndef _WIN32
+    if (g_client) { g_client->call(DaemonOp::Delete, {absolute_string(p)}); return; }
+#endif
+    delete_path(p);
+}
+
+// ---------------- Self test ----------------
+// `selftest` runs copy, delete and filter against an in-memory tree, and their error paths
+// against a FaultyVfs that fails every call, then restores the configured backend. It
+// prints one line per check and exits 1 if any failed.
+
+// Installs `v` as the backend until destroyed.
+class VfsOverride {
+public:
+    explicit VfsOverride(std::unique_ptr<Vfs> v) : saved_(std::move(g_vfs)) { g_vfs = std::move(v); }
+    VfsOverride(const VfsOverride&) = delete;
+    VfsOverride& operator=(const VfsOverride&) = delete;
+    ~VfsOverride() { g_vfs = std::move(saved_); }
+
+private:
+    std::unique_ptr<Vfs> saved_;
+};
+
+bool put_test_file(Vfs& v, const fs::path& p, const std::string& data) {
+    std::error_code ec;
+    std::unique_ptr<VfsReplaceFile> w;
+    return v.make_dirs(p.parent_path(), ec) && v.create_file(p, ec) && (w = v.open_replace(p, ec))
+        && w->write(data.data(), data.size(), ec) && w->commit(false, ec);
+}
+
+// Whole contents of `p`, or "<missing>" when it cannot be read.
+std::string get_test_file(Vfs& v, const fs::path& p) {
+    std::error_code ec;
+    auto f = v.open_read(p, ec);
+    if (!f) return "<missing>";
+    std::string data(static_cast<std::size_t>(f->size()), '\0');
+    if (!data.empty() && f->read_at(&data[0], data.size(), 0, ec) != static_cast<long long>(data.size()))
+        return "<missing>";
+    return data;
+}
+
+bool run_selftest(std::ostream& out = std::cout) {
+    std::size_t checks = 0, failed = 0;
+    auto check = [&](const char* name, bool ok) {
+        ++checks;
+        if (!ok) ++failed;
+        out << (ok ? "ok    " : "FAIL  ") << name << "\n";
+    };
+    auto has = [](const std::ostringstream& s, const char* text) { return s.str().find(text) != std::string::npos; };
+    auto fixture = [](MemVfs& m) {
+        for (int i = 0; i < 20; ++i) {
+            std::string n = std::to_string(i);
+            put_test_file(m, "/src/d" + std::to_string(i % 4) + "/f" + n + ".log", "entry " + n + "\n");
+        }
+        put_test_file(m, "/src/notes.txt", "hello\n");
+        put_test_file(m, "/blocker", "a file where a directory is expected\n");
+    };
+    OutputFormat saved_format = g_format;
+    g_format = OutputFormat::Text;
+    {
+        auto owned = std::make_unique<MemVfs>();
+        MemVfs& m = *owned;
+        fixture(m);
+        VfsOverride use(std::move(owned));
+        std::ostringstream o, e;
+        copy_path("/src", "/dst", o, e);
+        bool same = e.str().find("error(s)") == std::string::npos;
+        for (int i = 0; i < 20 && same; ++i) {
+            fs::path rel = "d" + std::to_string(i % 4) + "/f" + std::to_string(i) + ".log";
+            same = get_test_file(m, "/dst" / rel) == get_test_file(m, "/src" / rel);
+        }
+        check("copy: tree copied with identical contents", same && get_test_file(m, "/dst/notes.txt") == "hello\n");
+
+        std::ostringstream o2, e2;
+        copy_path("/src/notes.txt", "/src/notes.txt", o2, e2);
+        check("copy: onto itself is refused and keeps the data",
+              has(o2, "same file") && get_test_file(m, "/src/notes.txt") == "hello\n");
+
+        std::ostringstream o3, e3;
+        copy_path("/nowhere", "/dst2", o3, e3);
+        check("copy: missing source is reported", has(o3, "Source does not exist"));
+
+        std::ostringstream o4, e4;
+        copy_path("/src", "/blocker/dst", o4, e4);
+        check("copy: destination under a file fails with ENOTDIR",
+              has(e4, "error(s)") && has(e4, std::generic_category().message(ENOTDIR).c_str())
+                  && get_test_file(m, "/blocker") != "<missing>");
+
+        std::ostringstream o5, e5;
+        filter_search("/src", "ext=.log type=f", o5, e5);
+        check("filter: specialized query finds every match", has(o5, "Matches: 20 (specialized)"));
+
+        std::ostringstream o6, e6;
+        filter_search("/src", "name=notes", o6, e6);
+        check("filter: generic query finds the match", has(o6, "Matches: 1 (generic)") && has(o6, "/src/notes.txt"));
+
+        std::ostringstream o7, e7;
+        filter_search("/src", "size=", o7, e7);
+        filter_search("/src", "colour=red", o7, e7);
+        auto first = e7.str().find("Invalid query.");
+        check("filter: malformed queries are rejected",
+              first != std::string::npos && first != e7.str().rfind("Invalid query."));
+
+        std::ostringstream o8, e8;
+        filter_search("/nowhere", "ext=.log", o8, e8);
+        check("filter: missing root reports ENOENT",
+              has(o8, "Matches: 0") && has(e8, std::generic_category().message(ENOENT).c_str()));
+
+        CopyPlan shrunk;
+        ErrorReport shrunk_report;
+        shrunk.items.push_back(CopyItem{"/src/notes.txt", "/shrunk", 2 * kCopyChunk}); // sized before it shrank
+        plan_copy(shrunk);
+        run_copy_plan(shrunk, "/", shrunk_report);
+        std::ostringstream e_shrunk;
+        shrunk_report.print(e_shrunk, "copy");
+        check("copy: source shorter than planned fails with ENODATA",
+              shrunk_report.total() > 0 && has(e_shrunk, std::generic_category().message(ENODATA).c_str()));
+
+        std::ostringstream o9, e9;
+        delete_path("/dst", o9, e9);
+        VfsStat st;
+        std::error_code ec;
+        check("delete: tree removed", has(o9, "Deleted entries: 26") && !m.stat("/dst", false, 0, st, ec));
+
+        std::ostringstream o10, e10;
+        delete_path("/dst", o10, e10);
+        check("delete: missing path is reported", has(o10, "Path does not exist"));
+    }
+    {
+        auto owned = std::make_unique<MemVfs>();
+        MemVfs& m = *owned;
+        fixture(m);
+        VfsOverride use(std::make_unique<FaultyVfs>(std::move(owned), std::chrono::microseconds(0), 1.0, EACCES));
+        const std::string denied = std::generic_category().message(EACCES);
+        std::ostringstream o, e;
+        filter_search("/src", "ext=.log", o, e);
+        check("filter: failing reads are counted by errno", has(o, "Matches: 0") && has(e, "search: 1 error(s)")
+                                                                && has(e, denied.c_str()));
+
+        ErrorReport report;
+        auto removed = remove_tree("/src", report);
+        check("delete: failing walk removes nothing and reports it",
+              removed == 0 && report.total() == 1 && get_test_file(m, "/src/notes.txt") == "hello\n");
+
+        CopyPlan plan;
+        ErrorReport copy_report;
+        copy_tree("/src", "/dst", plan, copy_report);
+        VfsStat st;
+        std::error_code ec;
+        check("copy: failing walk copies nothing and reports it",
+              copy_report.total() == 1 && plan.items.empty() && !m.stat("/dst", false, 0, st, ec));
+    }
+    g_format = saved_format;
+    out << checks - failed << "/" << checks << " checks passed\n";
+    return failed == 0;
+}
+
+void print_usage() {
+    std::cerr << "Usage: FileExplorer [options] [command]\n"
+              << "Options:\n"
+              << "  --format=text|jsonl|nul|binary\n"
+              << "  --vfs=posix|mem[,latency=USEC][,errors=RATE][,errno=N][,mirror=DIR]\n"
+              << "  --throttle=copy|delete|warm[,bytes=N][,ops=N][,idle]   (repeatable)\n"
+              << "  --durability=none|syncfs|dir|file   flushing after copies\n"
+              << "  --columns=LIST     listing columns: type,perms,size,mtime,inode,owner,cache,kind\n"
+              << "  --hash-cache       store computed SHA-256s in xattrs (or a sidecar) for reuse\n"
+              << "  --daemon[=SOCK]    serve requests on a Unix socket\n"
+              << "  --connect[=SOCK]   forward commands (or the menu) to a running daemon\n"
+              << "Commands:\n"
+              << "  ls [dir]\n"
+              << "  stat <path>\n"
+              << "  search <root> <name>\n"
+              << "  filter <root> <query...>\n"
+              << "  filter-bench [--entries=N] <query...>   specialized vs generic predicates (ext/type)\n"
+              << "  error-bench [--entries=N] [--rate=R] [--threads=N]   error_code vs exceptions on failing stats\n"
+              << "  copy-bench [--files=N] [--size=BYTES] [DIR]   copy throughput per --durability mode\n"
+              << "  selftest                     copy, delete and filter checks on an in-memory tree\n"
+              << "  copy <from> <to>\n"
+              << "  delete <path>\n"
+              << "  cache [-v] <path>            page-cache residency\n"
+              << "  warm [--rate=BYTES/s] <path> read into the page cache\n"
+              << "  evict <path>                 drop from the page cache\n"
+              << "  count [-v] <path>            lines/words/bytes per extension\n"
+              << "  replace [--dry-run] <root> <old> <new>\n"
+              << "  index build [--split] <root>...  index trees (--split: a shard per top-level dir)\n"
+              << "  index refresh [<root>...]    update shards (default: all)\n"
+              << "  index list | drop <root>...\n"
+              << "  isearch [<root>] <name>      search the index only (default root: /, all shards)\n"
+              << "  psearch [<root>] <prefix>    indexed paths whose name starts with prefix\n"
+              << "  complete [<root>] <prefix>   indexed names starting with prefix\n"
+              << "  names <root> <from> [<to>]   indexed names in [from, to)\n"
+              << "  backup <store> <root> [<name>]   deduplicating snapshot of a tree\n"
+              << "  restore <store> <name> <dest>\n"
+              << "  snapshots <store>\n"
+              << "  dedupe [--dry-run] [--hardlink] [--min=BYTES] <root>...   share identical files' blocks\n"
+              << "  changed [--full] <root>      what changed since the last run (exit 1 if anything)\n"
+              << "  hash <path>...               SHA-256 of every file (cached with --hash-cache)\n"
+              << "  hexview [-i] [--offset=N] [--length=N] [--find=HEX|--text=STR] <file>   hex dump window\n"
+              << "  split [--lines] [--sums] <file> <size>   cut into <file>.000, .001, ... in parallel\n"
+              << "  join [--verify=<sums>] <out> <piece>...  concatenate pieces in parallel\n"
+              << "Without a command the interactive menu starts.\n";
+}
+
+// Parses "CLASS[,bytes=N][,ops=N][,idle]" (N with K/M/G suffix, 0 = unlimited). Fields not
+// given keep their current values.
+bool parse_throttle(const std::string& spec, JobClass& c, IoScheduler::Limits& l) {
+    std::istringstream in(spec);
+    std::string name, opt;
+    std::getline(in, name, ',');
+    if (!parse_job_class(name, c)) return false;
+    l = io_scheduler().limits(c);
+    while (std::getline(in, opt, ',')) {
+        auto eq = opt.find('=');
+        std::string k = opt.substr(0, eq);
+        std::uintmax_t v = 0;
+        if (k == "idle" && eq == std::string::npos) { l.idle = true; continue; }
+        if (k == "noidle" && eq == std::string::npos) { l.idle = false; continue; }
+        if (eq == std::string::npos || !parse_size(opt.substr(eq + 1), v)) return false;
+        if (k == "bytes") l.bytes = static_cast<double>(v);
+        else if (k == "ops") l.ops = static_cast<double>(v);
+        else return false;
+    }
+    return true;
+}
+
+// Handles command-line options and commands. Returns the exit code, or -1 to continue
+// into the interactive menu.
+int run_cli(const std::vector<std::string>& args) {
+    std::size_t i = 0;
+    for (; i < args.size() && args[i].rfind("--", 0) == 0; ++i) {
+        const std::string& opt = args[i];
+        if (opt.rfind("--format=", 0) == 0 && parse_format(opt.substr(9), g_format)) continue;
+        if (opt.rfind("--vfs=", 0) == 0 && configure_vfs(opt.substr(6))) continue;
+        if (opt.rfind("--durability=", 0) == 0 && parse_durability(opt.substr(13), g_durability)) continue;
+        if (opt.rfind("--columns=", 0) == 0 && parse_columns(opt.substr(10), g_columns)) continue;
+        if (opt == "--hash-cache") { g_store_hashes = true; continue; }
+        if (opt.rfind("--throttle=", 0) == 0) {
+            JobClass c;
+            IoScheduler::Limits l;
+            if (parse_throttle(opt.substr(11), c, l)) { io_scheduler().set_limits(c, l); continue; }
+        }
+#ifndef _WIN32
+        if (opt == "--daemon" || opt.rfind("--daemon=", 0) == 0)
+            return run_daemon(opt.size() > 9 ? opt.substr(9) : default_socket_path());
+        if (opt == "--connect" || opt.rfind("--connect=", 0) == 0) {
+            static DaemonClient client;
+            std::string sock = opt.size() > 10 ? opt.substr(10) : default_socket_path();
+            if (!client.connect(sock)) {
+                std::cerr << "Cannot connect to daemon at " << sock << ": " << std::generic_category().message(errno) << "\n";
+                return 1;
+            }
+            g_client = &client;
+            continue;
+        }
+#endif
+        print_usage();
+        return 2;
+    }
+    if (i >= args.size()) return -1;
+    const std::string& cmd = args[i];
+    std::vector<std::string> rest(args.begin() + static_cast<std::ptrdiff_t>(i) + 1, args.end());
+    if (cmd == "ls" && rest.size() <= 1) {
+        explorer_list(rest.empty() ? start_dir() : fs::path(rest[0]));
+    } else if (cmd == "stat" && rest.size() == 1) {
+        explorer_stat(rest[0]);
+    } else if (cmd == "search" && rest.size() == 2) {
+        explorer_search(rest[0], rest[1]);
+    } else if (cmd == "filter-bench" && !rest.empty()) {
+        std::uint64_t entries = 10000000;
+        std::size_t k = 0;
+        if (rest[0].rfind("--entries=", 0) == 0) {
+            std::uintmax_t n = 0;
+            if (!parse_size(rest[k++].substr(10), n) || n == 0) { print_usage(); return 2; }
+            entries = n;
+        }
+        if (k == rest.size()) { print_usage(); return 2; }
+        std::string query;
+        for (std::size_t j = k; j < rest.size(); ++j) query += (j > k ? " " : "") + rest[j];
+        return filter_bench(query, entries) ? 0 : 1;
+    } else if (cmd == "error-bench") {
+        std::uintmax_t entries = 300000, threads = std::max(1u, std::thread::hardware_concurrency());
+        double rate = 0.3;
+        for (const auto& a : rest) {
+            bool ok = true;
+            if (a.rfind("--entries=", 0) == 0) ok = parse_size(a.substr(10), entries) && entries > 0;
+            else if (a.rfind("--threads=", 0) == 0) ok = parse_size(a.substr(10), threads) && threads > 0;
+            else if (a.rfind("--rate=", 0) == 0) ok = (rate = std::strtod(a.c_str() + 7, nullptr)) >= 0 && rate <= 1;
+            else ok = false;
+            if (!ok) { print_usage(); return 2; }
+        }
+        return error_bench(entries, rate, static_cast<unsigned>(threads)) ? 0 : 1;
+    } else if (cmd == "selftest" && rest.empty()) {
+        return run_selftest() ? 0 : 1;
+    } else if (cmd == "copy-bench") {
+        std::uintmax_t files = 2000, size = 4096;
+        fs::path dir = vfs().real() ? fs::temp_directory_path() : fs::path("/");
+        for (const auto& a : rest) {
+            bool ok = true;
+            if (a.rfind("--files=", 0) == 0) ok = parse_size(a.substr(8), files) && files > 0;
+            else if (a.rfind("--size=", 0) == 0) ok = parse_size(a.substr(7), size);
+            else if (a.rfind("--", 0) != 0) dir = a;
+            else ok = false;
+            if (!ok) { print_usage(); return 2; }
+        }
+        return copy_bench(files, size, dir) ? 0 : 1;
+    } else if (cmd == "filter" && rest.size() >= 2) {
+        std::string query;
+        for (std::size_t k = 1; k < rest.size(); ++k) query += (k > 1 ? " " : "") + rest[k];
+        explorer_filter(rest[0], query);
+    } else if (cmd == "copy" && rest.size() == 2) {
+        explorer_copy(rest[0], rest[1]);
+    } else if (cmd == "delete" && rest.size() == 1) {
+        explorer_delete(rest[0]);
+    } else if (cmd == "cache" && (rest.size() == 1 || (rest.size() == 2 && rest[0] == "-v"))) {
+        page_cache_command(rest.back(), CacheOp::Report, rest.size() == 2, 0);
+    } else if (cmd == "warm" && (rest.size() == 1 || (rest.size() == 2 && rest[0].rfind("--rate=", 0) == 0))) {
+        std::uintmax_t rate = 0;
+        if (rest.size() == 2 && !parse_size(rest[0].substr(7), rate)) { print_usage(); return 2; }
+        page_cache_command(rest.back(), CacheOp::Warm, false, static_cast<double>(rate));
+    } else if (cmd == "count" && (rest.size() == 1 || (rest.size() == 2 && rest[0] == "-v"))) {
+        count_tree(rest.back(), rest.size() == 2);
+    } else if (cmd == "backup" && (rest.size() == 2 || rest.size() == 3)) {
+        backup_command(rest[0], rest[1], rest.size() == 3 ? rest[2] : "");
+    } else if (cmd == "restore" && rest.size() == 3) {
+        restore_command(rest[0], rest[1], rest[2]);
+    } else if (cmd == "snapshots" && rest.size() == 1) {
+        list_snapshots(rest[0]);
+    } else if (cmd == "hash" && !rest.empty()) {
+        hash_command(std::vector<fs::path>(rest.begin(), rest.end()));
+    } else if (cmd == "hexview" && !rest.empty()) {
+        bool interactive = false;
+        std::uint64_t off = 0, len = kHexPage;
+        std::string needle;
+        for (std::size_t k = 0; k + 1 < rest.size(); ++k) {
+            const std::string& a = rest[k];
+            bool ok = true;
+            if (a == "-i") interactive = true;
+            else if (a.rfind("--offset=", 0) == 0) ok = parse_offset(a.substr(9), off);
+            else if (a.rfind("--length=", 0) == 0) ok = parse_offset(a.substr(9), len);
+            else if (a.rfind("--find=", 0) == 0) ok = parse_hex_bytes(a.substr(7), needle);
+            else if (a.rfind("--text=", 0) == 0) ok = (needle = a.substr(7), !needle.empty());
+            else ok = false;
+            if (!ok) { print_usage(); return 2; }
+        }
+        return hexview_command(rest.back(), off, len, needle, interactive) ? 0 : 1;
+    } else if (cmd == "split" && rest.size() >= 2) {
+        bool lines = false, sums = false;
+        std::vector<std::string> args;
+        for (const auto& a : rest) {
+            if (a == "--lines") lines = true;
+            else if (a == "--sums") sums = true;
+            else args.push_back(a);
+        }
+        std::uintmax_t size = 0;
+        if (args.size() != 2 || !parse_size(args[1], size) || size == 0) { print_usage(); return 2; }
+        return split_command(args[0], size, lines, sums) ? 0 : 1;
+    } else if (cmd == "join" && rest.size() >= 2) {
+        std::string verify;
+        std::size_t k = 0;
+        if (rest[0].rfind("--verify=", 0) == 0) verify = rest[k++].substr(9);
+        if (rest.size() - k < 2) { print_usage(); return 2; }
+        return join_command(rest[k], std::vector<fs::path>(rest.begin() + k + 1, rest.end()), verify) ? 0 : 1;
+    } else if (cmd == "changed" && (rest.size() == 1 || (rest.size() == 2 && rest[0] == "--full"))) {
+        return changed_command(rest.back(), rest.size() == 2) ? 1 : 0;
+    } else if (cmd == "dedupe" && !rest.empty()) {
+        bool dry_run = false, hardlink = false;
+        std::uintmax_t min_size = 4096;
+        std::vector<fs::path> roots;
+        for (const auto& a : rest) {
+            if (a == "--dry-run") dry_run = true;
+            else if (a == "--hardlink") hardlink = true;
+            else if (a.rfind("--min=", 0) == 0) { if (!parse_size(a.substr(6), min_size)) { print_usage(); return 2; } }
+            else roots.push_back(a);
+        }
+        if (roots.empty()) { print_usage(); return 2; }
+        dedupe_command(roots, dry_run, hardlink, min_size);
+    } else if (cmd == "replace" && (rest.size() == 3 || (rest.size() == 4 && rest[0] == "--dry-run"))) {
+        std::size_t k = rest.size() - 3;
+        replace_in_tree(rest[k], rest[k + 1], rest[k + 2], k == 1);
+    } else if (cmd == "index" && !rest.empty()
+               && ((rest[0] == "build" && rest.size() >= 2) || rest[0] == "refresh" || rest[0] == "list"
+                   || (rest[0] == "drop" && rest.size() >= 2))) {
+        index_command(rest[0], std::vector<std::string>(rest.begin() + 1, rest.end()));
+    } else if (cmd == "isearch" && (rest.size() == 1 || rest.size() == 2)) {
+        search_index(rest.size() == 2 ? rest[0] : "/", rest.back());
+    } else if ((cmd == "psearch" || cmd == "complete") && (rest.size() == 1 || rest.size() == 2)) {
+        dict_query(rest.size() == 2 ? rest[0] : "/", cmd == "psearch" ? DictQuery::Prefix : DictQuery::Complete,
+                   rest.back(), "");
+    } else if (cmd == "names" && (rest.size() == 2 || rest.size() == 3)) {
+        dict_query(rest[0], DictQuery::Range, rest[1], rest.size() == 3 ? rest[2] : "");
+    } else if (cmd == "evict" && rest.size() == 1) {
+        page_cache_command(rest[0], CacheOp::Evict, false, 0);
+    } else {
+        print_usage();
+        return 2;
+    }
+    return 0;
+}
+
+void print_menu() {
+    std::cout << "\nCommands:\n"
+              << "1. List current directory\n"
+              << "2. Enter directory\n"
+              << "3. Go up (..)\n"
+              << "4. Create file\n"
+              << "5. Create directory\n"
+              << "6. Delete file/directory\n"
+              << "7. Copy file/directory\n"
+              << "8. Move/Rename file/directory\n"
+              << "9. Search by name (recursive)\n"
+              << "10. Filter search (ext= size= age= type= name=)\n"
+              << "11. HDD mode (inode-order stat) [" << hdd_mode_name(g_hdd_mode) << "]\n"
+              << "12. Show tuned concurrency per device\n"
+              << "13. Listing columns [" << columns_to_string(g_columns) << "]\n"
+              << "14. Output format [" << format_name(g_format) << "]\n"
+              << "15. Page cache (report/warm/evict)\n"
+              << "16. I/O throttling\n"
+              << "17. Copy durability [" << durability_name(g_durability) << "]\n"
+              << "18. Count lines/words/bytes\n"
+              << "19. Search and replace in files\n"
+              << "20. Path index (build/refresh/search)\n"
+              << "21. Backup / restore snapshots\n"
+              << "22. Deduplicate identical files\n"
+              << "23. Check for changes since last run\n"
+              << "24. Split / join a large file\n"
+              << "25. Hex viewer\n"
+              << "0. Exit\n"
+              << "Choose: ";
+}
+
+int main(int argc, char** argv) {
+#ifdef _WIN32
+    // Enable colored console output on Windows
+    HANDLE hOut = GetStdHandle(STD_OUTPUT_HANDLE);
+    if (hOut != INVALID_HANDLE_VALUE) {
+        DWORD dwMode = 0;
+        if (GetConsoleMode(hOut, &dwMode)) {
+            dwMode |= 0x0004; // ENABLE_VIRTUAL_TERMINAL_PROCESSING
+            SetConsoleMode(hOut, dwMode);
+        }
+    }
+#endif
+
+    if (argc > 1) {
+        int rc = run_cli(std::vector<std::string>(argv + 1, argv + argc));
+        if (rc >= 0) return rc;
+    }
+
+    fs::path cur = start_dir();
+    std::string choice;
+    while (true) {
+        explorer_list(cur);
+        print_menu();
+        if (!std::getline(std::cin, choice)) break;
+        if (choice == "1") {
+            continue; // already listed
+        } else if (choice == "2") {
+            fs::path dir;
+            if (input_path("Enter directory name: ", dir)) {
+                fs::path cand = dir.is_absolute() ? dir : (cur / dir);
+                std::error_code ec;
+                VfsStat st;
+                auto canon = vfs().stat(cand, true, 0, st, ec) && st.type == kTypeDir ? vfs().canonical(cand, ec) : fs::path();
+                if (!canon.empty() && !ec) {
+                    prefetcher().cancel();
+                    cur = canon;
+                } else std::cout << "Not a directory.\n";
+            }
+        } else if (choice == "3") {
+            if (cur.has_parent_path()) {
+                prefetcher().cancel();
+                cur = cur.parent_path();
+            }
+        } else if (choice == "4") {
+            fs::path p;
+            if (input_path("Enter file path to create: ", p)) {
+                p = p.is_absolute() ? p : (cur / p);
+                create_file(p);
+            }
+        } else if (choice == "5") {
+            fs::path p;
+            if (input_path("Enter directory path to create: ", p)) {
+                p = p.is_absolute() ? p : (cur / p);
+                create_directory_path(p);
+            }
+        } else if (choice == "6") {
+            fs::path p;
+            if (input_path("Enter file/directory to delete: ", p)) {
+                p = p.is_absolute() ? p : (cur / p);
+                explorer_delete(p);
+            }
+        } else if (choice == "7") {
+            fs::path src, dst;
+            if (input_path("Enter source path: ", src) && input_path("Enter destination path: ", dst)) {
+                src = src.is_absolute() ? src : (cur / src);
+                dst = dst.is_absolute() ? dst : (cur / dst);
+                explorer_copy(src, dst);
+            }
+        } else if (choice == "8") {
+            fs::path src, dst;
+            if (input_path("Enter source path: ", src) && input_path("Enter destination path: ", dst)) {
+                src = src.is_absolute() ? src : (cur / src);
+                dst = dst.is_absolute() ? dst : (cur / dst);
+                move_path(src, dst);
+            }
+        } else if (choice == "9") {
+            std::cout << "Enter name to search: ";
+            std::string needle;
+            std::getline(std::cin, needle);
+            if (!needle.empty()) explorer_search(cur, needle);
+        } else if (choice == "10") {
+            std::cout << "Enter query (e.g. ext=.log size=1M.. age=..7 type=f): ";
+            std::string query;
+            std::getline(std::cin, query);
+            if (!query.empty()) explorer_filter(cur, query);
+        } else if (choice == "11") {
+            std::cout << "HDD mode (auto/on/off): ";
+            std::string mode;
+            std::getline(std::cin, mode);
+            if (mode == "auto") g_hdd_mode = HddMode::Auto;
+            else if (mode == "on") g_hdd_mode = HddMode::On;
+            else if (mode == "off") g_hdd_mode = HddMode::Off;
+            else std::cout << "Invalid mode.\n";
+            if (g_hdd_mode == HddMode::Auto)
+                std::cout << "Current disk is " << (is_rotational(cur) ? "rotational" : "non-rotational") << ".\n";
+        } else if (choice == "12") {
+            tuner().print(std::cout);
+        } else if (choice == "13") {
+            print_column_costs(g_columns);
+            std::cout << "Available: name,type,perms,size,mtime,inode,owner,cache,kind\n"
+                      << "Enter columns (comma separated): ";
+            std::string text;
+            std::getline(std::cin, text);
+            unsigned cols = g_columns;
+            if (!text.empty() && parse_columns(text, cols)) {
+                g_columns = cols;
+                print_column_costs(g_columns);
+            }
+        } else if (choice == "14") {
+            std::cout << "Output format (text/jsonl/nul/binary): ";
+            std::string text;
+            std::getline(std::cin, text);
+            if (!parse_format(text, g_format)) std::cout << "Invalid format.\n";
+        } else if (choice == "15") {
+            std::cout << "Action (report/warm/evict): ";
+            std::string action;
+            std::getline(std::cin, action);
+            fs::path p;
+            if (action != "report" && action != "warm" && action != "evict") {
+                std::cout << "Invalid action.\n";
+            } else if (input_path("Enter file or directory: ", p)) {
+                p = p.is_absolute() ? p : (cur / p);
+                std::uintmax_t rate = 0;
+                if (action == "warm") {
+                    std::cout << "Rate limit in bytes/s, K/M/G suffix (empty = unlimited): ";
+                    std::string text;
+                    std::getline(std::cin, text);
+                    if (!text.empty() && !parse_size(text, rate)) std::cout << "Invalid rate, not limiting.\n";
+                }
+                CacheOp op = action == "report" ? CacheOp::Report : action == "warm" ? CacheOp::Warm : CacheOp::Evict;
+                page_cache_command(p, op, true, static_cast<double>(rate));
+            }
+        } else if (choice == "16") {
+            io_scheduler().print(std::cout);
+            std::cout << "Set limits (e.g. copy,bytes=50M,ops=0,idle; empty = keep): ";
+            std::string spec;
+            std::getline(std::cin, spec);
+            JobClass c;
+            IoScheduler::Limits l;
+            if (spec.empty()) continue;
+            if (parse_throttle(spec, c, l)) {
+                io_scheduler().set_limits(c, l);
+                io_scheduler().print(std::cout);
+            } else {
+                std::cout << "Invalid limits.\n";
+            }
+        } else if (choice == "17") {
+            std::cout << "Durability (none/syncfs/dir/file): ";
+            std::string text;
+            std::getline(std::cin, text);
+            if (!parse_durability(text, g_durability)) std::cout << "Invalid mode.\n";
+        } else if (choice == "18") {
+            fs::path p;
+            if (!input_path("Enter file or directory (empty = current): ", p)) p = cur;
+            count_tree(p.is_absolute() ? p : (cur / p), false);
+        } else if (choice == "19") {
+            std::string from, to, dry;
+            std::cout << "Find: ";
+            std::getline(std::cin, from);
+            std::cout << "Replace with: ";
+            std::getline(std::cin, to);
+            std::cout << "Dry run? (y/n): ";
+            std::getline(std::cin, dry);
+            if (!from.empty()) replace_in_tree(cur, from, to, dry != "n");
+        } else if (choice == "20") {
+            std::cout << "Action (build/refresh/search/prefix/complete): ";
+            std::string action;
+            std::getline(std::cin, action);
+            if (action == "build" || action == "refresh") {
+                index_command(action, {cur.string()});
+            } else if (action == "search") {
+                std::cout << "Enter name to search: ";
+                std::string needle;
+                std::getline(std::cin, needle);
+                if (!needle.empty()) search_index(cur, needle);
+            } else if (action == "prefix" || action == "complete") {
+                std::cout << "Enter name prefix: ";
+                std::string prefix;
+                std::getline(std::cin, prefix);
+                dict_query(cur, action == "prefix" ? DictQuery::Prefix : DictQuery::Complete, prefix, "");
+            } else {
+                std::cout << "Invalid action.\n";
+            }
+        } else if (choice == "21") {
+            std::cout << "Store directory: ";
+            std::string store;
+            std::getline(std::cin, store);
+            std::cout << "Action (backup/restore/list): ";
+            std::string action;
+            std::getline(std::cin, action);
+            if (store.empty()) {
+                std::cout << "No store given.\n";
+            } else if (action == "backup") {
+                std::cout << "Snapshot name (empty for a timestamp): ";
+                std::string name;
+                std::getline(std::cin, name);
+                backup_command(store, cur, name);
+            } else if (action == "restore") {
+                std::cout << "Snapshot name: ";
+                std::string name, dest;
+                std::getline(std::cin, name);
+                std::cout << "Restore into: ";
+                std::getline(std::cin, dest);
+                if (!name.empty() && !dest.empty()) restore_command(store, name, dest);
+            } else if (action == "list") {
+                list_snapshots(store);
+            } else {
+                std::cout << "Invalid action.\n";
+            }
+        } else if (choice == "22") {
+            std::cout << "Dry run first? (y/n): ";
+            std::string dry, link;
+            std::getline(std::cin, dry);
+            if (dry != "n") {
+                dedupe_command({cur}, true, false, 4096);
+            } else {
+                std::cout << "Fall back to hard links where blocks cannot be shared? (y/n): ";
+                std::getline(std::cin, link);
+                dedupe_command({cur}, false, link == "y", 4096);
+            }
+        } else if (choice == "23") {
+            std::cout << "Also stat files in unchanged directories? (y/n): ";
+            std::string full;
+            std::getline(std::cin, full);
+            changed_command(cur, full == "y");
+        } else if (choice == "24") {
+            std::cout << "Action (split/join): ";
+            std::string action;
+            std::getline(std::cin, action);
+            if (action == "split") {
+                std::cout << "File: ";
+                std::string file, size_str, lines;
+                std::getline(std::cin, file);
+                std::cout << "Piece size (e.g. 100M): ";
+                std::getline(std::cin, size_str);
+                std::cout << "Cut at line boundaries? (y/n): ";
+                std::getline(std::cin, lines);
+                std::uintmax_t size = 0;
+                if (file.empty() || !parse_size(size_str, size) || size == 0) std::cout << "Invalid input.\n";
+                else split_command(cur / file, size, lines == "y", true);
+            } else if (action == "join") {
+                std::cout << "Output file: ";
+                std::string dest, line;
+                std::getline(std::cin, dest);
+                std::cout << "Pieces, in order (one per line, empty line to finish):\n";
+                std::vector<fs::path> parts;
+                while (std::getline(std::cin, line) && !line.empty()) parts.push_back(cur / line);
+                if (dest.empty() || parts.empty()) std::cout << "Invalid input.\n";
+                else join_command(cur / dest, parts, "");
+            } else {
+                std::cout << "Unknown action.\n";
+            }
+        } else if (choice == "25") {
+            std::cout << "File: ";
+            std::string file;
+            std::getline(std::cin, file);
+            if (!file.empty()) hexview_command(cur / file, 0, kHexPage, "", true);
+        } else if (choice == "0") {
+            std::cout << "Goodbye!\n";
+            break;
+        } else {
+            std::cout << "Invalid choice.\n";
+        }
+    }
+    return 0;
+}